@@ -0,0 +1,130 @@
+#ifndef BERT_COCHANNEL_H
+#define BERT_COCHANNEL_H
+
+// Only linux
+
+#include <cassert>
+#include <deque>
+#include <mutex>
+#include "CoSync.h"
+
+namespace ananas {
+
+///@brief Bounded channel for coroutines, like golang's chan
+///
+/// Send parks when channel is full, Recv parks when empty, the coroutines
+/// can be in different EventLoops.
+/// Usage:
+///@code
+/// auto ch = std::make_shared<CoChannel<int>>(16);
+/// // producer coroutine in loop A
+/// for (int i = 0; i < 100; ++ i)
+///     ch->Send(i);
+/// ch->Close();
+///
+/// // consumer coroutine in loop B
+/// int v;
+/// while (ch->Recv(v))
+///     Process(v);
+///@endcode
+template <typename T>
+class CoChannel {
+public:
+    explicit
+    CoChannel(std::size_t capacity) :
+        capacity_(capacity) {
+        assert (capacity > 0);
+    }
+
+    CoChannel(const CoChannel& ) = delete;
+    void operator= (const CoChannel& ) = delete;
+
+    ///@brief Send value, park if full, must be called in coroutine
+    ///@return False if channel is closed
+    template <typename U>
+    bool Send(U&& value) {
+        std::unique_lock<std::mutex> guard(mutex_);
+        while (!closed_ && buffer_.size() >= capacity_)
+            senders_.Wait(guard);
+
+        return _Push(std::forward<U>(value));
+    }
+
+    ///@brief Send value if not full, can be called anywhere
+    template <typename U>
+    bool TrySend(U&& value) {
+        std::unique_lock<std::mutex> guard(mutex_);
+        if (buffer_.size() >= capacity_)
+            return false;
+
+        return _Push(std::forward<U>(value));
+    }
+
+    ///@brief Receive value, park if empty, must be called in coroutine
+    ///@return False if channel is closed and empty
+    bool Recv(T& value) {
+        std::unique_lock<std::mutex> guard(mutex_);
+        while (!closed_ && buffer_.empty())
+            receivers_.Wait(guard);
+
+        return _Pop(value);
+    }
+
+    ///@brief Receive value if not empty, can be called anywhere
+    bool TryRecv(T& value) {
+        std::unique_lock<std::mutex> guard(mutex_);
+        return _Pop(value);
+    }
+
+    ///@brief No more Send, the buffered values can still be received
+    void Close() {
+        std::unique_lock<std::mutex> guard(mutex_);
+        closed_ = true;
+        senders_.NotifyAll();
+        receivers_.NotifyAll();
+    }
+
+    bool IsClosed() const {
+        std::unique_lock<std::mutex> guard(mutex_);
+        return closed_;
+    }
+
+    std::size_t Size() const {
+        std::unique_lock<std::mutex> guard(mutex_);
+        return buffer_.size();
+    }
+
+private:
+    template <typename U>
+    bool _Push(U&& value) {
+        if (closed_)
+            return false;
+
+        buffer_.push_back(std::forward<U>(value));
+        receivers_.NotifyOne();
+        return true;
+    }
+
+    bool _Pop(T& value) {
+        if (buffer_.empty())
+            return false;
+
+        value = std::move(buffer_.front());
+        buffer_.pop_front();
+        senders_.NotifyOne();
+        return true;
+    }
+
+    mutable std::mutex mutex_;
+    const std::size_t capacity_;
+    bool closed_ {false};
+    std::deque<T> buffer_;
+
+    internal::WaitQueue senders_;
+    internal::WaitQueue receivers_;
+};
+
+} // end namespace ananas
+
+#endif
+
@@ -0,0 +1,146 @@
+
+#include <cassert>
+#include <algorithm>
+#include "CoConnection.h"
+#include "CoroutineScheduler.h"
+#include "net/Connection.h"
+
+namespace ananas {
+
+CoConnectionPtr CoConnection::Attach(Connection* conn) {
+    assert (conn->GetLoop()->InThisLoop());
+
+    auto c = std::static_pointer_cast<Connection>(conn->shared_from_this());
+    auto stream = std::make_shared<CoConnection>(std::move(c));
+
+    // Avoid cycle reference: connection holds the callbacks.
+    std::weak_ptr<CoConnection> weak(stream);
+    conn->SetOnMessage([weak](Connection* , const char* , size_t ) -> size_t {
+        if (auto s = weak.lock())
+            s->_OnMessage();
+
+        return 0; // keep bytes in buffer, consumed by reader
+    });
+    conn->SetOnWriteComplete([weak](Connection* ) {
+        if (auto s = weak.lock())
+            s->_OnWriteComplete();
+    });
+    conn->SetOnDisconnect([weak](Connection* ) {
+        if (auto s = weak.lock())
+            s->_OnDisconnect();
+    });
+
+    return stream;
+}
+
+CoConnection::CoConnection(std::shared_ptr<Connection> conn) :
+    conn_(std::move(conn)) {
+}
+
+CoConnection::~CoConnection() {
+    if (!closed_ && conn_->IsWritable())
+        conn_->ActiveClose();
+}
+
+StringView CoConnection::ReadUntil(const StringView& delim) {
+    assert (!delim.Empty());
+    _ConsumeLastRead();
+
+    std::size_t searched = 0;
+    while (true) {
+        auto data = conn_->PeekRecvBuffer();
+        if (data.Size() >= delim.Size()) {
+            // delim may be splited by last read
+            std::size_t start = searched >= delim.Size() ? searched - delim.Size() + 1 : 0;
+            auto it = std::search(data.begin() + start, data.end(),
+                                  delim.begin(), delim.end());
+            if (it != data.end()) {
+                lastRead_ = static_cast<std::size_t>(it - data.begin()) + delim.Size();
+                return StringView(data.Data(), lastRead_);
+            }
+
+            searched = data.Size();
+        }
+
+        if (closed_)
+            return StringView();
+
+        _Park(reader_);
+    }
+}
+
+StringView CoConnection::ReadExactly(std::size_t n) {
+    _ConsumeLastRead();
+
+    while (true) {
+        auto data = conn_->PeekRecvBuffer();
+        if (data.Size() >= n) {
+            lastRead_ = n;
+            return StringView(data.Data(), n);
+        }
+
+        if (closed_)
+            return StringView();
+
+        _Park(reader_);
+    }
+}
+
+bool CoConnection::Write(const void* data, std::size_t len) {
+    if (closed_ || !conn_->SendPacket(data, len))
+        return false;
+
+    while (!closed_ && conn_->PendingSendBytes() > 0)
+        _Park(writer_);
+
+    return !closed_;
+}
+
+bool CoConnection::Write(const std::string& data) {
+    return Write(data.data(), data.size());
+}
+
+void CoConnection::Close() {
+    if (!closed_ && conn_->IsWritable())
+        conn_->ActiveClose();
+}
+
+void CoConnection::_ConsumeLastRead() {
+    if (lastRead_ > 0) {
+        conn_->ConsumeRecvBuffer(lastRead_);
+        lastRead_ = 0;
+    }
+}
+
+void CoConnection::_Park(CoroutinePtr& waiter) {
+    assert (conn_->GetLoop()->InThisLoop());
+    assert (!waiter && "Only one coroutine can wait for read or write");
+
+    waiter = Coroutine::Current();
+    assert (waiter && "Must be called in coroutine");
+
+    Coroutine::Yield();
+    waiter.reset();
+}
+
+void CoConnection::_Wake(CoroutinePtr& waiter) {
+    if (waiter)
+        CoroutineScheduler::Self().Ready(waiter);
+}
+
+void CoConnection::_OnMessage() {
+    _Wake(reader_);
+}
+
+void CoConnection::_OnWriteComplete() {
+    _Wake(writer_);
+}
+
+void CoConnection::_OnDisconnect() {
+    closed_ = true;
+    _Wake(reader_);
+    _Wake(writer_);
+}
+
+} // end namespace ananas
+
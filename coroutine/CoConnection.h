@@ -0,0 +1,106 @@
+#ifndef BERT_COCONNECTION_H
+#define BERT_COCONNECTION_H
+
+// Only linux
+
+#include <memory>
+#include <string>
+#include "Coroutine.h"
+#include "ananas/util/StringView.h"
+
+namespace ananas {
+
+class Connection;
+class CoConnection;
+using CoConnectionPtr = std::shared_ptr<CoConnection>;
+
+///@brief Blocking style stream for coroutine
+///
+/// The coroutine is parked when data is not ready, and resumed by the
+/// scheduler of the EventLoop after the read event is handled.
+/// Must be used in the loop thread of the connection.
+/// Usage:
+///@code
+/// void EchoSession(CoConnectionPtr stream) {
+///     while (true) {
+///         auto line = stream->ReadUntil("\r\n");
+///         if (line.Empty())
+///             break; // closed
+///
+///         if (!stream->Write(line.Data(), line.Size()))
+///             break;
+///     }
+/// }
+///
+/// conn->SetOnConnect([](Connection* c) {
+///     CoroutineScheduler::Self().Spawn(EchoSession, CoConnection::Attach(c));
+/// });
+///@endcode
+class CoConnection : public std::enable_shared_from_this<CoConnection> {
+public:
+    ///@brief Take over the message, disconnect and write complete
+    /// callbacks of conn.
+    static CoConnectionPtr Attach(Connection* conn);
+
+    ///@brief Connection is closed when stream is destroyed
+    ~CoConnection();
+
+    CoConnection(const CoConnection& ) = delete;
+    void operator= (const CoConnection& ) = delete;
+
+    ///@brief Read until delim is found
+    ///@return The bytes including delim, empty if connection is closed.
+    ///
+    /// The returned view points to the receive buffer of connection, it's valid
+    /// until next call to Read*, Write or any other function that may park.
+    StringView ReadUntil(const StringView& delim);
+
+    ///@brief Read exactly n bytes
+    ///@return The n bytes, empty if connection is closed before got n bytes.
+    ///
+    /// The lifetime of returned view is the same as ReadUntil.
+    StringView ReadExactly(std::size_t n);
+
+    ///@brief Send data, park until all data is passed to kernel
+    ///@return False if connection is closed
+    bool Write(const void* data, std::size_t len);
+    bool Write(const std::string& data);
+
+    ///@brief Active close the connection
+    void Close();
+
+    ///@brief Is peer closed or error happened
+    bool IsClosed() const {
+        return closed_;
+    }
+
+    Connection* GetConnection() const {
+        return conn_.get();
+    }
+
+    explicit
+    CoConnection(std::shared_ptr<Connection> conn);
+
+private:
+    void _ConsumeLastRead();
+    void _Park(CoroutinePtr& waiter);
+    void _Wake(CoroutinePtr& waiter);
+
+    void _OnMessage();
+    void _OnWriteComplete();
+    void _OnDisconnect();
+
+    std::shared_ptr<Connection> conn_;
+    bool closed_ {false};
+
+    // bytes returned by last read, consumed at next read
+    std::size_t lastRead_ {0};
+
+    CoroutinePtr reader_;
+    CoroutinePtr writer_;
+};
+
+} // end namespace ananas
+
+#endif
+
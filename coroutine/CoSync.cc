@@ -0,0 +1,139 @@
+
+#include <cassert>
+#include "CoSync.h"
+#include "CoroutineScheduler.h"
+
+namespace ananas {
+
+namespace internal {
+
+void WaitQueue::Wait(std::unique_lock<std::mutex>& guard) {
+    assert (guard.owns_lock());
+
+    CoWaiter w;
+    w.crt = Coroutine::Current();
+    assert (w.crt && "Must be called in coroutine");
+    w.sched = &CoroutineScheduler::Self();
+
+    waiters_.push_back(&w);
+    guard.unlock();
+
+    // Notifier may run in other thread before I yield, then don't park
+    int expect = CoWaiter::eRunning;
+    if (w.state.compare_exchange_strong(expect, CoWaiter::eParked,
+                                        std::memory_order_acq_rel)) {
+        // Only the notifier readies this coroutine, but check anyway
+        do {
+            Coroutine::Yield();
+        } while (w.state.load(std::memory_order_acquire) != CoWaiter::eNotified);
+    }
+
+    guard.lock();
+}
+
+bool WaitQueue::NotifyOne() {
+    if (waiters_.empty())
+        return false;
+
+    CoWaiter* w = waiters_.front();
+    waiters_.pop_front();
+    _Notify(w);
+    return true;
+}
+
+void WaitQueue::NotifyAll() {
+    while (NotifyOne())
+        ;
+}
+
+void WaitQueue::_Notify(CoWaiter* w) {
+    // After notified is set, w may be freed at any time
+    auto crt = std::move(w->crt);
+    auto sched = w->sched;
+    if (w->state.exchange(CoWaiter::eNotified, std::memory_order_acq_rel) == CoWaiter::eParked)
+        sched->Post(crt);
+}
+
+} // end namespace internal
+
+void CoMutex::Lock() {
+    std::unique_lock<std::mutex> guard(mutex_);
+    if (!locked_) {
+        locked_ = true;
+        return;
+    }
+
+    // Unlock hands over the lock
+    waiters_.Wait(guard);
+    assert (locked_);
+}
+
+bool CoMutex::TryLock() {
+    std::unique_lock<std::mutex> guard(mutex_);
+    if (locked_)
+        return false;
+
+    locked_ = true;
+    return true;
+}
+
+void CoMutex::Unlock() {
+    std::unique_lock<std::mutex> guard(mutex_);
+    assert (locked_);
+
+    if (!waiters_.NotifyOne())
+        locked_ = false;
+}
+
+CoSemaphore::CoSemaphore(int count) :
+    count_(count) {
+    assert (count >= 0);
+}
+
+void CoSemaphore::Acquire() {
+    std::unique_lock<std::mutex> guard(mutex_);
+    if (count_ > 0) {
+        -- count_;
+        return;
+    }
+
+    // Release hands over the count
+    waiters_.Wait(guard);
+}
+
+bool CoSemaphore::TryAcquire() {
+    std::unique_lock<std::mutex> guard(mutex_);
+    if (count_ == 0)
+        return false;
+
+    -- count_;
+    return true;
+}
+
+void CoSemaphore::Release() {
+    std::unique_lock<std::mutex> guard(mutex_);
+    if (!waiters_.NotifyOne())
+        ++ count_;
+}
+
+void WaitGroup::Add(int delta) {
+    std::unique_lock<std::mutex> guard(mutex_);
+    counter_ += delta;
+    assert (counter_ >= 0);
+
+    if (counter_ == 0)
+        waiters_.NotifyAll();
+}
+
+void WaitGroup::Done() {
+    Add(-1);
+}
+
+void WaitGroup::Wait() {
+    std::unique_lock<std::mutex> guard(mutex_);
+    while (counter_ > 0)
+        waiters_.Wait(guard);
+}
+
+} // end namespace ananas
+
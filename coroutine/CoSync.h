@@ -0,0 +1,121 @@
+#ifndef BERT_COSYNC_H
+#define BERT_COSYNC_H
+
+// Only linux
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include "Coroutine.h"
+
+///@file CoSync.h
+///@brief Synchronization primitives which suspend coroutine, not thread.
+///
+/// They can be shared by coroutines in different EventLoops, the waiters
+/// are resumed in their own loops.
+namespace ananas {
+
+class CoroutineScheduler;
+
+namespace internal {
+
+struct CoWaiter {
+    enum State {
+        eRunning,
+        eParked,
+        eNotified,
+    };
+
+    CoroutinePtr crt;
+    CoroutineScheduler* sched {nullptr};
+    // The notifier posts crt only if it's parked, so never resumed twice
+    std::atomic<int> state {eRunning};
+};
+
+///@brief Queue of parked coroutines, protected by the lock of owner
+class WaitQueue {
+public:
+    ///@brief Park current coroutine until notified
+    ///
+    /// guard is unlocked when parked, and locked again when return.
+    void Wait(std::unique_lock<std::mutex>& guard);
+
+    ///@brief Resume the earliest waiter
+    ///@return False if no waiter
+    bool NotifyOne();
+    void NotifyAll();
+
+    bool Empty() const {
+        return waiters_.empty();
+    }
+
+private:
+    static void _Notify(CoWaiter* w);
+
+    std::deque<CoWaiter*> waiters_; // on waiters' stacks
+};
+
+} // end namespace internal
+
+///@brief Mutex for coroutines
+///
+/// Lock is handed over to the waiter by Unlock, so no starvation.
+class CoMutex {
+public:
+    CoMutex() = default;
+    CoMutex(const CoMutex& ) = delete;
+    void operator= (const CoMutex& ) = delete;
+
+    ///@brief Must be called in coroutine
+    void Lock();
+    bool TryLock();
+    void Unlock();
+
+private:
+    std::mutex mutex_;
+    bool locked_ {false};
+    internal::WaitQueue waiters_;
+};
+
+///@brief Counting semaphore for coroutines
+class CoSemaphore {
+public:
+    explicit
+    CoSemaphore(int count = 0);
+    CoSemaphore(const CoSemaphore& ) = delete;
+    void operator= (const CoSemaphore& ) = delete;
+
+    ///@brief Must be called in coroutine
+    void Acquire();
+    bool TryAcquire();
+    ///@brief Can be called anywhere
+    void Release();
+
+private:
+    std::mutex mutex_;
+    int count_;
+    internal::WaitQueue waiters_;
+};
+
+///@brief Wait for a group of jobs, like golang's sync.WaitGroup
+class WaitGroup {
+public:
+    WaitGroup() = default;
+    WaitGroup(const WaitGroup& ) = delete;
+    void operator= (const WaitGroup& ) = delete;
+
+    void Add(int delta = 1);
+    void Done();
+    ///@brief Park until counter is zero, must be called in coroutine
+    void Wait();
+
+private:
+    std::mutex mutex_;
+    int counter_ {0};
+    internal::WaitQueue waiters_;
+};
+
+} // end namespace ananas
+
+#endif
+
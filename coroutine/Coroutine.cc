@@ -5,20 +5,20 @@
 
 namespace ananas {
 
-unsigned int Coroutine::sid_ = 0;
-Coroutine Coroutine::main_;
-Coroutine* Coroutine::current_ = nullptr;
+thread_local unsigned int Coroutine::sid_ = Coroutine::kMainID;
+thread_local Coroutine Coroutine::main_ {Coroutine::MainTag()};
+thread_local Coroutine* Coroutine::current_ = nullptr;
+
+Coroutine::Coroutine(MainTag ) :
+    id_(kMainID),
+    state_(State::Running) {
+}
 
 Coroutine::Coroutine(std::size_t size) :
     id_( ++ sid_),
     state_(State::Init),
     stack_(size > kDefaultStackSize ? size : kDefaultStackSize) {
-    if (this == &main_) {
-        std::vector<char>().swap(stack_);
-        return;
-    }
-
-    if (id_ == main_.id_)
+    while (id_ <= kMainID)
         id_ = ++ sid_;  // when sid_ overflow
 
     int ret = ::getcontext(&handle_);
@@ -98,5 +98,16 @@ AnyPointer Coroutine::Next(const CoroutinePtr& crt) {
     return Coroutine::Send(crt);
 }
 
+CoroutinePtr Coroutine::Current() {
+    if (!InCoroutine())
+        return CoroutinePtr();
+
+    return Coroutine::current_->shared_from_this();
+}
+
+bool Coroutine::InCoroutine() {
+    return Coroutine::current_ && Coroutine::current_ != &Coroutine::main_;
+}
+
 } // end namespace ananas
 
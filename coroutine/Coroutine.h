@@ -17,7 +17,9 @@ using AnyPointer = std::shared_ptr<void>;
 class Coroutine;
 using CoroutinePtr = std::shared_ptr<Coroutine>;
 
-class Coroutine {
+class CoroutineScheduler;
+
+class Coroutine : public std::enable_shared_from_this<Coroutine> {
     enum class State {
         Init,
         Running,
@@ -39,6 +41,10 @@ public:
     static AnyPointer Yield(const AnyPointer& = AnyPointer(nullptr));
     static AnyPointer Next(const CoroutinePtr& crt);
 
+    // The running coroutine of this thread, nullptr if in main
+    static CoroutinePtr Current();
+    static bool InCoroutine();
+
 public:
     // !!!
     // NEVER define coroutine object, please use CreateCoroutine.
@@ -80,30 +86,44 @@ public:
         return  id_;
     }
     static unsigned int GetCurrentID()  {
-        return current_->id_;
+        return current_ ? current_->id_ : kMainID;
+    }
+
+    bool IsFinished() const {
+        return state_ == State::Finish;
     }
 
 private:
+    friend class CoroutineScheduler;
+
+    struct MainTag {};
+    explicit
+    Coroutine(MainTag );
+
     AnyPointer _Send(Coroutine* crt, AnyPointer = AnyPointer(nullptr));
     AnyPointer _Yield(const AnyPointer& = AnyPointer(nullptr));
     static void _Run(Coroutine* cxt);
 
     unsigned int id_;  // 1: main
     State state_;
+    bool inRunQueue_ {false}; // see CoroutineScheduler
     AnyPointer yieldValue_;
 
     typedef ucontext_t HANDLE;
 
     static const std::size_t kDefaultStackSize = 8 * 1024;
+    static const unsigned int kMainID = 1;
     std::vector<char> stack_;
 
     HANDLE handle_;
     std::function<void ()> func_;
     AnyPointer result_;
 
-    static Coroutine main_;
-    static Coroutine* current_;
-    static unsigned int sid_;
+    // Each thread has its own main & current coroutine,
+    // so coroutines can run in every EventLoop thread.
+    static thread_local Coroutine main_;
+    static thread_local Coroutine* current_;
+    static thread_local unsigned int sid_;
 };
 
 } // end namespace ananas
@@ -0,0 +1,102 @@
+
+#include <cassert>
+#include <thread>
+#include "CoroutineScheduler.h"
+
+namespace ananas {
+
+CoroutineScheduler& CoroutineScheduler::Self() {
+    static thread_local CoroutineScheduler sched;
+    if (!sched.loop_)
+        sched._Bind();
+
+    return sched;
+}
+
+CoroutineScheduler::CoroutineScheduler() {
+}
+
+void CoroutineScheduler::_Bind() {
+    // EventLoop may be created after scheduler, so try bind every time.
+    loop_ = EventLoop::Self();
+    if (loop_)
+        loop_->AddIterationHook(std::bind(&CoroutineScheduler::Run, this));
+}
+
+void CoroutineScheduler::Ready(const CoroutinePtr& crt) {
+    assert (crt);
+    if (crt->inRunQueue_ || crt->IsFinished())
+        return;
+
+    crt->inRunQueue_ = true;
+    ready_.push_back(crt);
+}
+
+void CoroutineScheduler::Post(const CoroutinePtr& crt) {
+    assert (loop_ && "Post needs EventLoop to wakeup");
+    if (loop_->InThisLoop()) {
+        Ready(crt);
+        return;
+    }
+
+    inbox_.Push(crt);
+    if (!wakeup_.exchange(true))
+        loop_->Execute(std::bind(&CoroutineScheduler::_DrainInbox, this));
+}
+
+void CoroutineScheduler::_DrainInbox() {
+    // Clear flag first, later Post will wakeup loop again
+    wakeup_ = false;
+
+    CoroutinePtr crt;
+    while (true) {
+        if (inbox_.Pop(crt))
+            Ready(crt);
+        else if (inbox_.Empty())
+            break;
+        else
+            std::this_thread::yield(); // a producer is in the middle of Push
+    }
+}
+
+void CoroutineScheduler::Yield() {
+    auto crt = Coroutine::Current();
+    assert (crt && "Yield must be called in coroutine");
+
+    Ready(crt);
+    Coroutine::Yield();
+}
+
+void CoroutineScheduler::Sleep(DurationMs duration) {
+    auto crt = Coroutine::Current();
+    assert (crt && "Sleep must be called in coroutine");
+    assert (loop_ && loop_->InThisLoop());
+
+    bool done = false;
+    loop_->ScheduleAfter(duration, [this, crt, &done]() {
+        done = true;
+        this->Ready(crt);
+    });
+
+    while (!done)
+        Coroutine::Yield();
+}
+
+bool CoroutineScheduler::Run() {
+    assert (!Coroutine::InCoroutine());
+
+    // Use tmp : coroutine may be readied again when running
+    decltype(ready_) crts;
+    crts.swap(ready_);
+
+    for (auto& crt : crts) {
+        crt->inRunQueue_ = false;
+        if (!crt->IsFinished())
+            Coroutine::Send(crt);
+    }
+
+    return !ready_.empty();
+}
+
+} // end namespace ananas
+
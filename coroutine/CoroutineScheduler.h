@@ -0,0 +1,137 @@
+#ifndef BERT_COROUTINESCHEDULER_H
+#define BERT_COROUTINESCHEDULER_H
+
+// Only linux
+
+#include <atomic>
+#include <deque>
+#include "Coroutine.h"
+#include "ananas/net/EventLoop.h"
+#include "ananas/util/MpscQueue.h"
+
+namespace ananas {
+
+///@brief Per-thread coroutine scheduler
+///
+/// Each thread has at most one scheduler. If the thread runs an EventLoop,
+/// the scheduler is bound to it, and the ready coroutines will be resumed
+/// at the end of every loop iteration.
+/// Usage:
+///@code
+/// // In the EventLoop thread
+/// CoroutineScheduler::Self().Spawn([]() {
+///     do_something();
+///     CoroutineScheduler::Self().Yield(); // give up, resumed in next round
+///     do_other_thing();
+/// });
+///@endcode
+class CoroutineScheduler {
+public:
+    ///@brief The scheduler of this thread, created when first called
+    static CoroutineScheduler& Self();
+
+    CoroutineScheduler(const CoroutineScheduler& ) = delete;
+    void operator= (const CoroutineScheduler& ) = delete;
+
+    ///@brief Create coroutine and put it into run queue
+    template <typename F, typename... Args>
+    CoroutinePtr Spawn(F&& f, Args&&... args);
+
+    ///@brief Put coroutine into run queue, it'll be resumed later.
+    ///
+    /// NOT thread-safe, crt must be created in this thread.
+    /// Ready a queued coroutine again has no effect.
+    void Ready(const CoroutinePtr& crt);
+
+    ///@brief Put coroutine into run queue, thread-safe
+    ///
+    /// Called in other thread, crt is pushed into a lock-free inbox, and the
+    /// bound EventLoop is waked up once for a batch of coroutines.
+    void Post(const CoroutinePtr& crt);
+
+    ///@brief Give up cpu, current coroutine will be resumed in next round
+    void Yield();
+
+    ///@brief Suspend current coroutine for a while
+    ///
+    /// Resumed by timer of the bound EventLoop, other coroutines keep running.
+    void Sleep(DurationMs duration);
+
+    ///@brief Suspend current coroutine until future is satisfied
+    ///@return The result of future, may contain exception
+    ///
+    /// Future may be satisfied in any thread, but the coroutine is always
+    /// resumed in the bound EventLoop.
+    template <typename T>
+    typename TryWrapper<T>::Type Await(Future<T>&& fut);
+
+    ///@brief Resume ready coroutines
+    ///@return True if there are still ready coroutines
+    ///
+    /// Called by the bound EventLoop, if this thread has no EventLoop,
+    /// you should call it in main context by yourself.
+    bool Run();
+
+    ///@brief Size of run queue
+    std::size_t ReadySize() const {
+        return ready_.size();
+    }
+
+    ///@brief The EventLoop bound with, may be null
+    EventLoop* GetLoop() const {
+        return loop_;
+    }
+
+private:
+    CoroutineScheduler();
+    void _Bind();
+    void _DrainInbox();
+
+    EventLoop* loop_ {nullptr};
+    std::deque<CoroutinePtr> ready_;
+
+    // coroutines readied by other threads
+    MpscQueue<CoroutinePtr> inbox_;
+    std::atomic<bool> wakeup_ {false};
+};
+
+template <typename F, typename... Args>
+CoroutinePtr CoroutineScheduler::Spawn(F&& f, Args&&... args) {
+    auto crt = Coroutine::CreateCoroutine(std::forward<F>(f), std::forward<Args>(args)...);
+    Ready(crt);
+    return crt;
+}
+
+template <typename T>
+typename TryWrapper<T>::Type CoroutineScheduler::Await(Future<T>&& fut) {
+    auto crt = Coroutine::Current();
+    assert (crt && "Await must be called in coroutine");
+    assert (loop_ && loop_->InThisLoop());
+
+    // Result lives on coroutine stack, the callback holds crt so
+    // the stack will not be freed before callback is run.
+    typename TryWrapper<T>::Type result;
+    bool done = false;
+    // The callback runs in loop_, maybe inline if fut is already satisfied,
+    // don't ready the running coroutine then, it may park on others later.
+    bool parked = false;
+    fut.Then(loop_, [this, crt, &result, &done, &parked](typename TryWrapper<T>::Type&& t) {
+        result = std::move(t);
+        done = true;
+        if (parked)
+            this->Ready(crt);
+    });
+
+    while (!done) {
+        parked = true;
+        Coroutine::Yield();
+        parked = false;
+    }
+
+    return result;
+}
+
+} // end namespace ananas
+
+#endif
+
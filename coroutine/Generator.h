@@ -0,0 +1,244 @@
+#ifndef BERT_GENERATOR_H
+#define BERT_GENERATOR_H
+
+// Only linux
+
+#include <cassert>
+#include <exception>
+#include <functional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "Coroutine.h"
+
+namespace ananas {
+
+namespace internal {
+
+// Storage for one value, no heap allocation
+template <typename T>
+class Slot {
+public:
+    Slot() {
+    }
+    ~Slot() {
+        Reset();
+    }
+
+    Slot(const Slot& ) = delete;
+    void operator= (const Slot& ) = delete;
+
+    template <typename... A>
+    void Emplace(A&&... args) {
+        Reset();
+        new (&storage_) T(std::forward<A>(args)...);
+        has_ = true;
+    }
+
+    T Take() {
+        assert (has_);
+        T t(std::move(*_Ptr()));
+        Reset();
+        return t;
+    }
+
+    bool Has() const {
+        return has_;
+    }
+
+    void Reset() {
+        if (has_) {
+            _Ptr()->~T();
+            has_ = false;
+        }
+    }
+
+private:
+    T* _Ptr() {
+        return reinterpret_cast<T*>(&storage_);
+    }
+
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage_;
+    bool has_ {false};
+};
+
+template <>
+class Slot<void> {
+public:
+    void Emplace() {
+        has_ = true;
+    }
+
+    void Take() {
+        assert (has_);
+        has_ = false;
+    }
+
+    bool Has() const {
+        return has_;
+    }
+
+    void Reset() {
+        has_ = false;
+    }
+
+private:
+    bool has_ {false};
+};
+
+} // end namespace internal
+
+///@brief Typed coroutine, like python generator
+///
+/// Y: type of yielded value, S: type of sent value, R: type of return value.
+/// Values are passed by move through slots inside generator, so resume
+/// never allocates, unlike the AnyPointer API of Coroutine.
+/// The body is called as `R f(Generator::Yielder& , Args...)`.
+/// Usage:
+///@code
+/// void Fib(Generator<int>::Yielder& yielder, int n) {
+///     int a = 0, b = 1;
+///     while (n-- > 0) {
+///         yielder.Yield(a);
+///         std::tie(a, b) = std::make_tuple(b, a + b);
+///     }
+/// }
+///
+/// Generator<int> gen(Fib, 10);
+/// while (gen.Next())
+///     std::cout << gen.Value() << std::endl;
+///@endcode
+template <typename Y, typename S = void, typename R = void>
+class Generator {
+public:
+    class Yielder {
+    public:
+        ///@brief Give value to caller
+        ///@return Value sent by caller, S() if resumed by Next
+        template <typename U>
+        S Yield(U&& y) {
+            static_assert(!std::is_void<Y>::value, "Yield value for void Y");
+            gen_->yielded_.Emplace(std::forward<U>(y));
+            return gen_->_Suspend();
+        }
+
+        ///@brief Give up to caller, for void Y
+        S Yield() {
+            static_assert(std::is_void<Y>::value, "Yield nothing for non-void Y");
+            gen_->yielded_.Emplace();
+            return gen_->_Suspend();
+        }
+
+    private:
+        friend class Generator;
+        explicit
+        Yielder(Generator* gen) : gen_(gen) { }
+
+        Generator* gen_;
+    };
+
+    template <typename F, typename... Args>
+    explicit
+    Generator(F&& f, Args&&... args) :
+        yielder_(this) {
+        auto fn = std::bind(std::forward<F>(f), std::ref(yielder_), std::forward<Args>(args)...);
+        crt_ = Coroutine::CreateCoroutine([this, fn]() mutable {
+            this->_Run(fn, std::is_void<R>());
+        });
+    }
+
+    // Yielder holds pointer to generator
+    Generator(const Generator& ) = delete;
+    void operator= (const Generator& ) = delete;
+
+    ///@brief Resume the generator
+    ///@return True if yielded, false if finished
+    ///
+    /// Exception thrown by body is rethrown here.
+    bool Next() {
+        return _Resume();
+    }
+
+    ///@brief Resume the generator with value, like python's send
+    ///@return True if yielded, false if finished
+    template <typename U>
+    bool Send(U&& s) {
+        static_assert(!std::is_void<S>::value, "Send value for void S");
+        if (!started_)
+            throw std::runtime_error("Can't send non-void value to a just-created generator");
+
+        sent_.Emplace(std::forward<U>(s));
+        return _Resume();
+    }
+
+    ///@brief Take the yielded value
+    Y Value() {
+        return yielded_.Take();
+    }
+
+    ///@brief Take the return value, when finished
+    R Result() {
+        assert (IsFinished());
+        return result_.Take();
+    }
+
+    bool IsFinished() const {
+        return crt_->IsFinished();
+    }
+
+private:
+    bool _Resume() {
+        if (crt_->IsFinished())
+            throw std::runtime_error("Resume a finished generator.");
+
+        started_ = true;
+        yielded_.Reset();
+        Coroutine::Send(crt_); // null AnyPointer, no allocation
+
+        if (exception_) {
+            auto e = std::move(exception_);
+            exception_ = nullptr;
+            std::rethrow_exception(e);
+        }
+
+        return !crt_->IsFinished();
+    }
+
+    S _Suspend() {
+        Coroutine::Yield();
+        return sent_.Has() ? sent_.Take() : S();
+    }
+
+    template <typename Fn>
+    void _Run(Fn& fn, std::true_type ) {
+        try {
+            fn();
+            result_.Emplace();
+        } catch (...) {
+            exception_ = std::current_exception();
+        }
+    }
+
+    template <typename Fn>
+    void _Run(Fn& fn, std::false_type ) {
+        try {
+            result_.Emplace(fn());
+        } catch (...) {
+            exception_ = std::current_exception();
+        }
+    }
+
+    Yielder yielder_;
+    CoroutinePtr crt_;
+    bool started_ {false};
+
+    internal::Slot<Y> yielded_;
+    internal::Slot<S> sent_;
+    internal::Slot<R> result_;
+    std::exception_ptr exception_;
+};
+
+} // end namespace ananas
+
+#endif
+
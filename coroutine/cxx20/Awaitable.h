@@ -0,0 +1,391 @@
+#ifndef BERT_AWAITABLE_H
+#define BERT_AWAITABLE_H
+
+#if __cplusplus < 202002L
+#error "C++20 is required, please build with -DUSE_CXX20=ON"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+#include <deque>
+#include <memory>
+#include <string>
+
+#include "Task.h"
+#include "ananas/future/Future.h"
+#include "ananas/net/EventLoop.h"
+#include "ananas/net/Connection.h"
+#include "ananas/util/StringView.h"
+
+namespace ananas {
+
+namespace cxx20 {
+
+namespace internal {
+
+// Per-thread queue, resumed at the end of each loop iteration,
+// so coroutines never run inside the read/write handlers.
+class ResumeQueue {
+public:
+    static ResumeQueue& Self() {
+        static thread_local ResumeQueue queue;
+        if (!queue.bound_) {
+            if (auto loop = EventLoop::Self()) {
+                queue.bound_ = true;
+                loop->AddIterationHook([]() {
+                    return ResumeQueue::Self()._Run();
+                });
+            }
+        }
+
+        return queue;
+    }
+
+    // Resume inline if no EventLoop in this thread
+    void Post(std::coroutine_handle<> h) {
+        if (bound_)
+            handles_.push_back(h);
+        else
+            h.resume();
+    }
+
+private:
+    bool _Run() {
+        decltype(handles_) tmp;
+        tmp.swap(handles_);
+        for (auto h : tmp)
+            h.resume();
+
+        return !handles_.empty();
+    }
+
+    bool bound_ {false};
+    std::deque<std::coroutine_handle<> > handles_;
+};
+
+} // end namespace internal
+
+///@brief Awaiter of Future
+///
+/// Coroutine is resumed in the EventLoop where it's suspended, never on
+/// the stack which suspends it.
+template <typename T>
+class FutureAwaiter {
+public:
+    explicit
+    FutureAwaiter(Future<T>&& fut) :
+        fut_(std::move(fut)) {
+    }
+
+    bool await_ready() {
+        if (!fut_.IsReady())
+            return false;
+
+        result_ = fut_.Wait();
+        return true;
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) {
+        // If loop is null, resume in the thread which satisfies future.
+        // The callback runs inline if future is satisfied in this loop
+        // meanwhile, then don't suspend. The later of both resumes.
+        fut_.Then(EventLoop::Self(), [this, h](typename TryWrapper<T>::Type&& t) {
+            result_ = std::move(t);
+            if (settled_.exchange(true))
+                h.resume();
+        });
+
+        return !settled_.exchange(true);
+    }
+
+    T await_resume() {
+        if constexpr (std::is_void<T>::value)
+            result_.Check();
+        else
+            return std::move(result_).Value();
+    }
+
+private:
+    Future<T> fut_;
+    typename TryWrapper<T>::Type result_;
+    std::atomic<bool> settled_ {false};
+};
+
+///@brief Sleep in coroutine, resumed by timer of current EventLoop
+class SleepAwaiter {
+public:
+    explicit
+    SleepAwaiter(DurationMs duration) :
+        duration_(duration) {
+    }
+
+    bool await_ready() const noexcept {
+        return duration_.count() <= 0;
+    }
+
+    void await_suspend(std::coroutine_handle<> h) {
+        auto loop = EventLoop::Self();
+        assert (loop && "SleepFor must be called in EventLoop");
+        loop->ScheduleAfter(duration_, [h]() {
+            h.resume();
+        });
+    }
+
+    void await_resume() noexcept {
+    }
+
+private:
+    DurationMs duration_;
+};
+
+inline SleepAwaiter SleepFor(DurationMs duration) {
+    return SleepAwaiter(duration);
+}
+
+class AsyncConnection;
+using AsyncConnectionPtr = std::shared_ptr<AsyncConnection>;
+
+///@brief Awaitable stream, stackless version of CoConnection
+///
+/// Must be used in the loop thread of the connection, the reads return
+/// views of receive buffer, valid until next co_await.
+/// Usage:
+///@code
+/// Task<void> EchoSession(AsyncConnectionPtr stream) {
+///     while (true) {
+///         auto line = co_await stream->ReadUntil("\r\n");
+///         if (line.Empty() || !co_await stream->Write(line.Data(), line.Size()))
+///             break;
+///     }
+/// }
+///@endcode
+class AsyncConnection : public std::enable_shared_from_this<AsyncConnection> {
+public:
+    class ReadAwaiter {
+    public:
+        ReadAwaiter(AsyncConnection* c, StringView delim, std::size_t n) :
+            c_(c),
+            delim_(delim),
+            n_(n) {
+        }
+
+        bool await_ready() {
+            c_->_ConsumeLastRead();
+            return _TryRead();
+        }
+
+        void await_suspend(std::coroutine_handle<> h) {
+            assert (!c_->reader_ && "Only one coroutine can wait for read");
+            c_->reader_ = this;
+            h_ = h;
+        }
+
+        // Receive buffer may be moved by later ::recv, so make view here
+        StringView await_resume() noexcept {
+            if (c_->lastRead_ == 0)
+                return StringView();
+
+            return StringView(c_->conn_->PeekRecvBuffer().Data(), c_->lastRead_);
+        }
+
+    private:
+        friend class AsyncConnection;
+
+        // Return true if done: got data, or connection closed
+        bool _TryRead() {
+            auto data = c_->conn_->PeekRecvBuffer();
+            if (delim_.Empty()) {
+                if (data.Size() >= n_) {
+                    c_->lastRead_ = n_;
+                    return true;
+                }
+            } else if (data.Size() >= delim_.Size()) {
+                std::size_t start = searched_ >= delim_.Size() ? searched_ - delim_.Size() + 1 : 0;
+                auto it = std::search(data.begin() + start, data.end(),
+                                      delim_.begin(), delim_.end());
+                if (it != data.end()) {
+                    c_->lastRead_ = static_cast<std::size_t>(it - data.begin()) + delim_.Size();
+                    return true;
+                }
+
+                searched_ = data.Size();
+            }
+
+            return c_->closed_;
+        }
+
+        AsyncConnection* c_;
+        StringView delim_;
+        std::size_t n_;
+        std::size_t searched_ {0};
+        std::coroutine_handle<> h_;
+    };
+
+    class WriteAwaiter {
+    public:
+        WriteAwaiter(AsyncConnection* c, const void* data, std::size_t len) :
+            c_(c),
+            data_(data),
+            len_(len) {
+        }
+
+        bool await_ready() {
+            if (c_->closed_ || !c_->conn_->SendPacket(data_, len_))
+                return true;
+
+            return c_->conn_->PendingSendBytes() == 0;
+        }
+
+        void await_suspend(std::coroutine_handle<> h) {
+            assert (!c_->writer_ && "Only one coroutine can wait for write");
+            c_->writer_ = h;
+        }
+
+        bool await_resume() const noexcept {
+            return !c_->closed_ && c_->conn_->IsWritable();
+        }
+
+    private:
+        AsyncConnection* c_;
+        const void* data_;
+        std::size_t len_;
+    };
+
+    ///@brief Take over the message, disconnect and write complete
+    /// callbacks of conn.
+    static AsyncConnectionPtr Attach(Connection* conn) {
+        assert (conn->GetLoop()->InThisLoop());
+
+        auto c = std::static_pointer_cast<Connection>(conn->shared_from_this());
+        auto stream = std::make_shared<AsyncConnection>(std::move(c));
+
+        std::weak_ptr<AsyncConnection> weak(stream);
+        conn->SetOnMessage([weak](Connection* , const char* , size_t ) -> size_t {
+            if (auto s = weak.lock())
+                s->_OnMessage();
+
+            return 0; // keep bytes in buffer, consumed by reader
+        });
+        conn->SetOnWriteComplete([weak](Connection* ) {
+            if (auto s = weak.lock())
+                s->_WakeWriter();
+        });
+        conn->SetOnDisconnect([weak](Connection* ) {
+            if (auto s = weak.lock())
+                s->_OnDisconnect();
+        });
+
+        return stream;
+    }
+
+    explicit
+    AsyncConnection(std::shared_ptr<Connection> conn) :
+        conn_(std::move(conn)) {
+    }
+
+    ///@brief Connection is closed when stream is destroyed
+    ~AsyncConnection() {
+        Close();
+    }
+
+    AsyncConnection(const AsyncConnection& ) = delete;
+    void operator= (const AsyncConnection& ) = delete;
+
+    ///@brief Read until delim is found, the result includes delim
+    ///
+    /// Empty view if connection is closed.
+    ReadAwaiter ReadUntil(StringView delim) {
+        assert (!delim.Empty());
+        return ReadAwaiter(this, delim, 0);
+    }
+
+    ///@brief Read exactly n bytes, empty view if connection is closed
+    ReadAwaiter ReadExactly(std::size_t n) {
+        return ReadAwaiter(this, StringView(), n);
+    }
+
+    ///@brief Send data, resume when all data is passed to kernel
+    ///
+    /// Result false if connection is closed
+    WriteAwaiter Write(const void* data, std::size_t len) {
+        return WriteAwaiter(this, data, len);
+    }
+
+    WriteAwaiter Write(const std::string& data) {
+        return WriteAwaiter(this, data.data(), data.size());
+    }
+
+    void Close() {
+        if (!closed_ && conn_->IsWritable())
+            conn_->ActiveClose();
+    }
+
+    bool IsClosed() const {
+        return closed_;
+    }
+
+    Connection* GetConnection() const {
+        return conn_.get();
+    }
+
+private:
+    void _ConsumeLastRead() {
+        if (lastRead_ > 0) {
+            conn_->ConsumeRecvBuffer(lastRead_);
+            lastRead_ = 0;
+        }
+    }
+
+    void _OnMessage() {
+        if (reader_ && reader_->_TryRead())
+            _WakeReader();
+    }
+
+    void _OnDisconnect() {
+        closed_ = true;
+        if (reader_) {
+            reader_->_TryRead(); // maybe the last bytes
+            _WakeReader();
+        }
+
+        _WakeWriter();
+    }
+
+    void _WakeReader() {
+        auto h = reader_->h_;
+        reader_ = nullptr;
+        internal::ResumeQueue::Self().Post(h);
+    }
+
+    void _WakeWriter() {
+        if (writer_) {
+            auto h = writer_;
+            writer_ = nullptr;
+            internal::ResumeQueue::Self().Post(h);
+        }
+    }
+
+    std::shared_ptr<Connection> conn_;
+    bool closed_ {false};
+
+    // bytes returned by last read, consumed at next read
+    std::size_t lastRead_ {0};
+
+    ReadAwaiter* reader_ {nullptr};
+    std::coroutine_handle<> writer_;
+};
+
+} // end namespace cxx20
+
+///@brief Make Future awaitable in C++20 coroutine
+template <typename T>
+cxx20::FutureAwaiter<T> operator co_await(Future<T>&& fut) {
+    return cxx20::FutureAwaiter<T>(std::move(fut));
+}
+
+} // end namespace ananas
+
+#endif
+
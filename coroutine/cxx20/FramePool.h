@@ -0,0 +1,102 @@
+#ifndef BERT_FRAMEPOOL_H
+#define BERT_FRAMEPOOL_H
+
+#include <cstddef>
+#include <new>
+
+namespace ananas {
+
+namespace cxx20 {
+
+///@brief Per-thread freelist allocator for coroutine frames
+///
+/// Frames are rounded up to kAlignment, each size class caches at most
+/// kMaxCached free frames. Frame freed in other thread is cached by that
+/// thread, so memory can migrate but never leak.
+class FramePool {
+public:
+    static void* Allocate(std::size_t size) {
+        std::size_t index = _Index(size);
+        if (index >= kClasses)
+            return ::operator new(size);
+
+        auto& pool = _ThreadPool();
+        Node* node = pool.heads[index];
+        if (node) {
+            pool.heads[index] = node->next;
+            -- pool.counts[index];
+            return node;
+        }
+
+        return ::operator new((index + 1) * kAlignment);
+    }
+
+    static void Deallocate(void* p, std::size_t size) {
+        std::size_t index = _Index(size);
+        if (index >= kClasses) {
+            ::operator delete(p);
+            return;
+        }
+
+        auto& pool = _ThreadPool();
+        if (pool.counts[index] >= kMaxCached) {
+            ::operator delete(p);
+            return;
+        }
+
+        Node* node = static_cast<Node*>(p);
+        node->next = pool.heads[index];
+        pool.heads[index] = node;
+        ++ pool.counts[index];
+    }
+
+    ///@brief Cached bytes of this thread, for test and monitor
+    static std::size_t CachedBytes() {
+        auto& pool = _ThreadPool();
+        std::size_t bytes = 0;
+        for (std::size_t i = 0; i < kClasses; ++ i)
+            bytes += pool.counts[i] * (i + 1) * kAlignment;
+
+        return bytes;
+    }
+
+private:
+    static constexpr std::size_t kAlignment = 64;
+    static constexpr std::size_t kClasses = 32; // max frame 2KB
+    static constexpr std::size_t kMaxCached = 256;
+
+    struct Node {
+        Node* next;
+    };
+
+    struct Pool {
+        Node* heads[kClasses] {};
+        std::size_t counts[kClasses] {};
+
+        ~Pool() {
+            for (auto head : heads) {
+                while (head) {
+                    Node* next = head->next;
+                    ::operator delete(head);
+                    head = next;
+                }
+            }
+        }
+    };
+
+    static std::size_t _Index(std::size_t size) {
+        return (size + kAlignment - 1) / kAlignment - 1;
+    }
+
+    static Pool& _ThreadPool() {
+        static thread_local Pool pool;
+        return pool;
+    }
+};
+
+} // end namespace cxx20
+
+} // end namespace ananas
+
+#endif
+
@@ -0,0 +1,247 @@
+#ifndef BERT_TASK_H
+#define BERT_TASK_H
+
+#if __cplusplus < 202002L
+#error "C++20 is required, please build with -DUSE_CXX20=ON"
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <memory>
+#include <utility>
+
+#include "FramePool.h"
+#include "ananas/future/Future.h"
+#include "ananas/net/EventLoop.h"
+
+namespace ananas {
+
+namespace cxx20 {
+
+template <typename T>
+class Task;
+
+namespace internal {
+
+struct PromiseBase {
+    // All frames are from FramePool
+    static void* operator new(std::size_t size) {
+        return FramePool::Allocate(size);
+    }
+    static void operator delete(void* p, std::size_t size) {
+        FramePool::Deallocate(p, size);
+    }
+
+    // Lazy: task starts when it's awaited or spawned
+    std::suspend_always initial_suspend() noexcept {
+        return {};
+    }
+
+    // Transfer to the awaiting coroutine, no recursion
+    struct FinalAwaiter {
+        bool await_ready() noexcept {
+            return false;
+        }
+
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+            auto cont = h.promise().continuation_;
+            return cont ? cont : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {
+        }
+    };
+
+    FinalAwaiter final_suspend() noexcept {
+        return {};
+    }
+
+    void unhandled_exception() {
+        exception_ = std::current_exception();
+    }
+
+    std::coroutine_handle<> continuation_;
+    std::exception_ptr exception_;
+};
+
+template <typename T>
+struct TaskPromise : public PromiseBase {
+    Task<T> get_return_object();
+
+    template <typename U>
+    void return_value(U&& v) {
+        value_.emplace(std::forward<U>(v));
+    }
+
+    T Result() {
+        if (exception_)
+            std::rethrow_exception(exception_);
+
+        return std::move(*value_);
+    }
+
+    std::optional<T> value_;
+};
+
+template <>
+struct TaskPromise<void> : public PromiseBase {
+    Task<void> get_return_object();
+
+    void return_void() {
+    }
+
+    void Result() {
+        if (exception_)
+            std::rethrow_exception(exception_);
+    }
+};
+
+} // end namespace internal
+
+///@brief Stackless coroutine, return T to the awaiting coroutine
+///
+/// Task is lazy, it runs when co_await-ed or spawned to EventLoop.
+/// Usage:
+///@code
+/// Task<int> Compute() {
+///     co_await SleepFor(std::chrono::milliseconds(10));
+///     co_return 42;
+/// }
+///
+/// Task<void> Main() {
+///     int v = co_await Compute();
+/// }
+///
+/// Spawn(loop, Main());
+///@endcode
+template <typename T = void>
+class Task {
+public:
+    using promise_type = internal::TaskPromise<T>;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    explicit
+    Task(Handle h) :
+        handle_(h) {
+    }
+
+    Task(const Task& ) = delete;
+    void operator= (const Task& ) = delete;
+
+    Task(Task&& other) noexcept :
+        handle_(std::exchange(other.handle_, nullptr)) {
+    }
+
+    Task& operator= (Task&& other) noexcept {
+        if (this != &other) {
+            if (handle_)
+                handle_.destroy();
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+
+        return *this;
+    }
+
+    ~Task() {
+        if (handle_)
+            handle_.destroy();
+    }
+
+    // awaitable
+    bool await_ready() const noexcept {
+        return !handle_ || handle_.done();
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        handle_.promise().continuation_ = awaiting;
+        return handle_;
+    }
+
+    T await_resume() {
+        return handle_.promise().Result();
+    }
+
+private:
+    Handle handle_;
+};
+
+namespace internal {
+
+template <typename T>
+inline Task<T> TaskPromise<T>::get_return_object() {
+    return Task<T>(Task<T>::Handle::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() {
+    return Task<void>(Task<void>::Handle::from_promise(*this));
+}
+
+// The root coroutine of Spawn, frame is destroyed when finished
+struct Detached {
+    struct promise_type : public PromiseBase {
+        Detached get_return_object() {
+            return {};
+        }
+
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+
+        void return_void() {
+        }
+
+        void unhandled_exception() {
+            std::terminate();
+        }
+    };
+};
+
+template <typename T>
+Detached RunTask(Task<T> task, Promise<T> pm) {
+    try {
+        pm.SetValue(co_await task);
+    } catch (...) {
+        pm.SetException(std::current_exception());
+    }
+}
+
+inline Detached RunTask(Task<void> task, Promise<void> pm) {
+    try {
+        co_await task;
+        pm.SetValue();
+    } catch (...) {
+        pm.SetException(std::current_exception());
+    }
+}
+
+} // end namespace internal
+
+///@brief Run task in loop
+///@return Future of task result, may be waited in other thread
+///
+/// The task starts in loop, and the awaiters in it will resume in loop too.
+template <typename T>
+Future<T> Spawn(EventLoop* loop, Task<T> task) {
+    Promise<T> pm;
+    auto fut = pm.GetFuture();
+
+    // std::function demands copyable
+    auto t = std::make_shared<Task<T>>(std::move(task));
+    loop->Execute([t, pm]() {
+        internal::RunTask(std::move(*t), pm);
+    });
+
+    return fut;
+}
+
+} // end namespace cxx20
+
+} // end namespace ananas
+
+#endif
+
@@ -21,11 +21,11 @@ RedisContext::RedisContext(ananas::Connection* conn) : hostConn_(conn) {
     _ResetResponse();
 }
 
-ananas::AnyPointer RedisContext::Get(const std::string& key) {
+bool RedisContext::Get(const std::string& key) {
     // Redis inline protocol request
     std::string req_buf = BuildRedisRequest("get", key);
     if (!hostConn_->SendPacket(req_buf.data(), req_buf.size()))
-        return ananas::AnyPointer();
+        return false;
 
     RedisContext::Request req;
     req.request.push_back("get");
@@ -34,7 +34,7 @@ ananas::AnyPointer RedisContext::Get(const std::string& key) {
     req.crt = current_;
     pending_.push(std::move(req));
 
-    return ananas::AnyPointer((int*)0x1, [] (int* ) {});
+    return true;
 }
 
 
@@ -103,8 +103,9 @@ size_t RedisContext::OnRecv(ananas::Connection* conn, const char* data, size_t l
             std::cout << arg << " ";
         std::cout << "]\n--- Response: ";
 
-        ananas::Coroutine::Send(req.crt, std::make_shared<std::string>(content_));
+        auto crt = std::move(req.crt);
         pending_.pop();
+        crt->Send(std::move(content_)); // moved by slot, no allocation
 
         _ResetResponse();
     }
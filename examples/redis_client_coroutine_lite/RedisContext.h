@@ -5,7 +5,7 @@
 #include <string>
 #include <vector>
 #include "net/Connection.h"
-#include "coroutine/Coroutine.h"
+#include "coroutine/Generator.h"
 
 #define CRLF "\r\n"
 
@@ -36,6 +36,9 @@ std::string BuildRedisRequest(H&& head, T&&... tails) {
     return h + " " + BuildRedisRequest(std::forward<T>(tails)...);
 }
 
+// Yield nothing, receive response
+using RedisCoroutine = ananas::Generator<void, std::string>;
+
 class RedisContext {
 public:
     explicit
@@ -43,18 +46,12 @@ public:
 
     template <typename F, typename... Args>
     bool StartCoroutine(F&& f, Args&&... args) {
-        current_ = ananas::Coroutine::CreateCoroutine(std::forward<F>(f), std::forward<Args>(args)...);
-        auto result = ananas::Coroutine::Send(current_); // prime the coroutine
-        if (!result) {
-            ananas::Coroutine::Send(current_);
-            return false;
-        }
-
-        return true;
+        current_ = std::make_shared<RedisCoroutine>(std::forward<F>(f), std::forward<Args>(args)...);
+        return current_->Next(); // prime the coroutine, false if request failed
     }
 
     // Redis get command
-    ananas::AnyPointer Get(const std::string& key);
+    bool Get(const std::string& key);
     // Parse response
     size_t OnRecv(ananas::Connection* conn, const char* data, size_t len);
 
@@ -65,7 +62,7 @@ private:
 
     struct Request {
         std::vector<std::string> request;
-        ananas::CoroutinePtr crt;
+        std::shared_ptr<RedisCoroutine> crt;
 
         Request(Request const& ) = delete;
         void operator= (Request const& ) = delete;
@@ -96,7 +93,7 @@ private:
 
     void _ResetResponse();
 
-    ananas::CoroutinePtr current_;
+    std::shared_ptr<RedisCoroutine> current_;
 };
 
 #endif
@@ -3,19 +3,21 @@
 #include "net/EventLoop.h"
 #include "net/Application.h"
 
-void GetSomeRedisKey(std::shared_ptr<RedisContext> ctx, const std::string& key) {
+void GetSomeRedisKey(RedisCoroutine::Yielder& yielder,
+                     std::shared_ptr<RedisContext> ctx,
+                     const std::string& key) {
     std::cout << "Coroutine is primed\n";
 
-    auto rsp = ananas::Coroutine::Yield(ctx->Get(key));
+    if (!ctx->Get(key)) {
+        std::cerr << "send request failed\n";
+        return;
+    }
 
-    std::cout << "Coroutine is resumed\n";
+    std::string rsp = yielder.Yield();
 
-    if (rsp) {
-        std::cout << "Value for key " << key
-                  << " is " << *std::static_pointer_cast<std::string>(rsp) << std::endl;
-    } else {
-        std::cerr << "got rsp failed\n";
-    }
+    std::cout << "Coroutine is resumed\n";
+    std::cout << "Value for key " << key
+              << " is " << rsp << std::endl;
 }
 
 void OnConnect(std::shared_ptr<RedisContext> ctx, ananas::Connection* conn) {
@@ -172,6 +172,13 @@ public:
         return state_ != nullptr;
     }
 
+    // True if value or exception is set and not retrieved, Wait will not block
+    bool
+    IsReady() const {
+        std::unique_lock<std::mutex> guard(state_->thenLock_);
+        return state_->progress_ == Progress::Done;
+    }
+
     // The blocking interface
     // PAY ATTENTION to deadlock: Wait thread must NOT be same as promise thread!!!
     typename State<T>::ValueType
@@ -1,4 +1,6 @@
 #include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <cassert>
 #include "EventLoop.h"
 #include "Application.h"
@@ -13,6 +15,41 @@ namespace internal {
 
 const int Acceptor::kListenQueue = 1024;
 
+namespace {
+
+// Remove the socket file left by a dead server. Never remove other files,
+// nor the socket of a live server, it's not ours to take over.
+bool RemoveStaleUnixSocket(const std::string& path,
+                           const sockaddr_storage& addr, socklen_t len) {
+    struct stat st;
+    if (::lstat(path.c_str(), &st) != 0)
+        return errno == ENOENT;
+
+    if (!S_ISSOCK(st.st_mode)) {
+        ANANAS_ERR << path << " exists and is not a socket";
+        return false;
+    }
+
+    int probe = CreateUnixSocket();
+    if (probe == kInvalid)
+        return false;
+
+    // nonblock: a live server with full backlog makes EAGAIN, don't wait
+    SetNonBlock(probe);
+    const bool refused = ::connect(probe, (const struct sockaddr*)&addr, len) == kError &&
+                         errno == ECONNREFUSED;
+    CloseSocket(probe);
+
+    if (!refused) {
+        ANANAS_ERR << path << " is in use by another server";
+        return false;
+    }
+
+    return ::unlink(path.c_str()) == 0 || errno == ENOENT;
+}
+
+} // end namespace
+
 Acceptor::Acceptor(EventLoop* loop) :
     localSock_(kInvalid),
     localPort_(SocketAddr::kInvalidPort),
@@ -21,6 +58,8 @@ Acceptor::Acceptor(EventLoop* loop) :
 
 Acceptor::~Acceptor() {
     CloseSocket(localSock_);
+    if (!unixPath_.empty())
+        ::unlink(unixPath_.c_str());
     ANANAS_INF << "Close Acceptor " << localPort_ ;
 }
 
@@ -29,6 +68,10 @@ void Acceptor::SetNewConnCallback(NewTcpConnCallback cb) {
     newConnCallback_ = std::move(cb);
 }
 
+void Acceptor::SetCallbacks(std::shared_ptr<ConnectionCallbacks> callbacks) {
+    callbacks_ = std::move(callbacks);
+}
+
 bool Acceptor::Bind(const SocketAddr& addr) {
     if (!addr.IsValid())
         return false;
@@ -38,26 +81,41 @@ bool Acceptor::Bind(const SocketAddr& addr) {
         return false;
     }
 
-    localSock_ = CreateTCPSocket();
+    const bool isUnix = addr.IsUnix();
+    localSock_ = isUnix ? CreateUnixSocket() : CreateTCPSocket();
     if (localSock_ == kInvalid)
         return false;
 
     localPort_ = addr.GetPort();
 
     SetNonBlock(localSock_);
-    SetNodelay(localSock_);
-    SetReuseAddr(localSock_);
+    if (!isUnix) {
+        SetNodelay(localSock_);
+        SetReuseAddr(localSock_);
+    }
     SetRcvBuf(localSock_);
     SetSndBuf(localSock_);
 
-    auto serv = addr.GetAddr();
+    sockaddr_storage serv;
+    socklen_t len = addr.ToSockaddr(serv);
+    if (len == 0) {
+        ANANAS_ERR << "Bad address " << addr.ToString();
+        return false;
+    }
+
+    // socket file left by previous process
+    if (isUnix && !RemoveStaleUnixSocket(addr.GetPath(), serv, len))
+        return false;
 
-    int ret = ::bind(localSock_, (struct sockaddr*)&serv, sizeof serv);
+    int ret = ::bind(localSock_, (struct sockaddr*)&serv, len);
     if (kError == ret) {
         ANANAS_ERR << "Cannot bind to " << addr.ToString();
         return false;
     }
 
+    if (isUnix)
+        unixPath_ = addr.GetPath();
+
     ret = ::listen(localSock_, kListenQueue);
     if (kError == ret) {
         ANANAS_ERR << "Cannot listen on " << addr.ToString();
@@ -68,7 +126,7 @@ bool Acceptor::Bind(const SocketAddr& addr) {
         return false;
 
     ANANAS_INF << "Create listen socket " << localSock_
-               << " on port " << localPort_;
+               << " on " << addr.ToString();
     return  true;
 }
 
@@ -81,11 +139,15 @@ bool Acceptor::HandleReadEvent() {
         int connfd = _Accept();
         if (connfd != kInvalid) {
             auto loop = Application::Instance().Next();
-            auto func = [loop, newCb = newConnCallback_, connfd, peer = peer_]() {
-                auto conn(std::make_shared<Connection>(loop));
+            auto func = [loop, newCb = newConnCallback_, callbacks = callbacks_, connfd, peer = peer_]() {
+                auto conn(Connection::Create(loop));
                 conn->Init(connfd, peer);
+                if (callbacks)
+                    conn->SetCallbacks(callbacks);
+
                 if (loop->Register(eET_Read, conn)) {
-                    newCb(conn.get());
+                    if (newCb)
+                        newCb(conn.get());
                     conn->_OnConnect();
                 } else {
                     ANANAS_ERR << "Failed to register socket " << conn->Identifier();
@@ -149,8 +211,13 @@ void Acceptor::HandleErrorEvent() {
 }
 
 int Acceptor::_Accept() {
-    socklen_t addrLength = sizeof peer_;
-    return ::accept(localSock_, (struct sockaddr *)&peer_, &addrLength);
+    sockaddr_storage addr;
+    socklen_t addrLength = sizeof addr;
+    int fd = ::accept(localSock_, (struct sockaddr *)&addr, &addrLength);
+    if (fd != kInvalid)
+        peer_.Init(addr, addrLength);
+
+    return fd;
 }
 
 } // end namespace internal
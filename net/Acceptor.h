@@ -2,6 +2,8 @@
 #ifndef BERT_ACCEPTOR_H
 #define BERT_ACCEPTOR_H
 
+#include <memory>
+
 #include "Socket.h"
 #include "Typedefs.h"
 
@@ -18,6 +20,8 @@ public:
     void operator= (const Acceptor& ) = delete;
 
     void SetNewConnCallback(NewTcpConnCallback cb);
+    ///@brief Shared by all accepted connections, before NewConnCallback
+    void SetCallbacks(std::shared_ptr<ConnectionCallbacks> callbacks);
     bool Bind(const SocketAddr& addr);
 
     int Identifier() const override;
@@ -31,11 +35,13 @@ private:
     SocketAddr peer_;
     int localSock_;
     uint16_t localPort_;
+    std::string unixPath_; // unlinked when closed
 
     EventLoop* const loop_; // which loop belong to
 
     //register msg callback and on connect callback for conn
     NewTcpConnCallback newConnCallback_;
+    std::shared_ptr<ConnectionCallbacks> callbacks_;
 
     static const int kListenQueue;
 };
@@ -73,6 +73,10 @@ void Application::Run(int ac, char* av[]) {
 
     // start loops in thread pool
     _StartWorkers();
+    for (auto& f : afterStart_)
+        f();
+    afterStart_.clear();
+
     BaseLoop()->Run();
 
     printf("Stopped BaseEventLoop...\n");
@@ -126,6 +130,28 @@ void Application::Listen(const char* ip,
     Listen(addr, std::move(cb), std::move(bfcb));
 }
 
+void Application::Listen(const SocketAddr& listenAddr,
+                         std::shared_ptr<ConnectionCallbacks> callbacks,
+                         NewTcpConnCallback cb,
+                         BindCallback bfcb) {
+    auto loop = BaseLoop();
+    loop->Execute([loop, listenAddr, callbacks, cb, bfcb]() {
+        if (!loop->Listen(listenAddr, std::move(callbacks), std::move(cb)))
+            bfcb(false, listenAddr);
+        else
+            bfcb(true, listenAddr);
+    });
+}
+
+void Application::Listen(const char* ip,
+                         uint16_t hostPort,
+                         std::shared_ptr<ConnectionCallbacks> callbacks,
+                         NewTcpConnCallback cb,
+                         BindCallback bfcb) {
+    SocketAddr addr(ip, hostPort);
+    Listen(addr, std::move(callbacks), std::move(cb), std::move(bfcb));
+}
+
 void Application::ListenUDP(const SocketAddr& addr,
                             UDPMessageCallback mcb,
                             UDPCreateCallback ccb,
@@ -147,6 +173,60 @@ void Application::ListenUDP(const char* ip, uint16_t hostPort,
     ListenUDP(addr, std::move(mcb), std::move(ccb), std::move(bfcb));
 }
 
+void Application::ListenUDPSharded(const SocketAddr& addr,
+                                   UDPMessageCallback mcb,
+                                   UDPCreateCallback ccb,
+                                   bool steerByFlow,
+                                   BindCallback bfcb) {
+    auto listen = [this, addr, mcb, ccb, steerByFlow, bfcb]() {
+        _ListenUDPShards(addr, mcb, ccb, steerByFlow, bfcb);
+    };
+
+    // need worker loops
+    if (state_ == State::eS_Started)
+        BaseLoop()->Execute(listen);
+    else
+        afterStart_.push_back(listen);
+}
+
+void Application::_ListenUDPShards(const SocketAddr& addr,
+                                   UDPMessageCallback mcb,
+                                   UDPCreateCallback ccb,
+                                   bool steerByFlow,
+                                   BindCallback bfcb) {
+    auto base = BaseLoop();
+    std::vector<EventLoop*> loops;
+    for (const auto& loop : loops_)
+        loops.push_back(loop.get());
+    if (loops.empty())
+        loops.push_back(base);
+
+    const std::size_t groups = steerByFlow ? loops.size() : 0;
+    auto left = std::make_shared<std::atomic<std::size_t>>(loops.size());
+    auto succ = std::make_shared<std::atomic<bool>>(true);
+    for (auto loop : loops) {
+        loop->Execute([base, loop, addr, mcb, ccb, groups, bfcb, left, succ]() {
+            if (!loop->ListenUDPShard(addr, mcb, ccb, groups))
+                *succ = false;
+
+            if (-- *left == 0) {
+                base->Execute([addr, bfcb, succ]() {
+                    bfcb(*succ, addr);
+                });
+            }
+        });
+    }
+}
+
+void Application::ListenUDPSharded(const char* ip, uint16_t hostPort,
+                                   UDPMessageCallback mcb,
+                                   UDPCreateCallback ccb,
+                                   bool steerByFlow,
+                                   BindCallback bfcb) {
+    SocketAddr addr(ip, hostPort);
+    ListenUDPSharded(addr, std::move(mcb), std::move(ccb), steerByFlow, std::move(bfcb));
+}
+
 void Application::CreateClientUDP(UDPMessageCallback mcb,
                                   UDPCreateCallback ccb) {
     auto loop = BaseLoop();
@@ -82,6 +82,20 @@ public:
     void Listen(const char* ip, uint16_t hostPort,
                 NewTcpConnCallback cb,
                 BindCallback bfcb = &Application::_DefaultBindCallback);
+    ///@brief Listener for TCP, accepted connections share callbacks
+    ///
+    /// It saves a callback table per connection, see Connection::SetCallbacks.
+    ///@param callbacks Set to connection before cb
+    ///@param cb The callback for connection returned by ::accept, may be null
+    void Listen(const SocketAddr& listenAddr,
+                std::shared_ptr<ConnectionCallbacks> callbacks,
+                NewTcpConnCallback cb,
+                BindCallback bfcb = &Application::_DefaultBindCallback);
+    ///@brief Listener for TCP, accepted connections share callbacks
+    void Listen(const char* ip, uint16_t hostPort,
+                std::shared_ptr<ConnectionCallbacks> callbacks,
+                NewTcpConnCallback cb,
+                BindCallback bfcb = &Application::_DefaultBindCallback);
 
     ///@brief Listener for UDP
     void ListenUDP(const SocketAddr& listenAddr,
@@ -95,6 +109,25 @@ public:
                    UDPCreateCallback ccb,
                    BindCallback bfcb = &Application::_DefaultBindCallback);
 
+    ///@brief Listener for UDP, one SO_REUSEPORT socket per worker loop
+    ///
+    /// Kernel spreads datagrams across the sockets, so callbacks are called
+    /// in all worker threads concurrently. If steerByFlow, a flow hash
+    /// program pins each peer to one socket. Call it before Run.
+    ///@param bfcb Called once in base loop, true if all sockets are bound
+    void ListenUDPSharded(const SocketAddr& listenAddr,
+                          UDPMessageCallback mcb,
+                          UDPCreateCallback ccb,
+                          bool steerByFlow = false,
+                          BindCallback bfcb = &Application::_DefaultBindCallback);
+    ///@brief Listener for UDP, one SO_REUSEPORT socket per worker loop
+    void ListenUDPSharded(const char* ip,
+                          uint16_t hostPort,
+                          UDPMessageCallback mcb,
+                          UDPCreateCallback ccb,
+                          bool steerByFlow = false,
+                          BindCallback bfcb = &Application::_DefaultBindCallback);
+
     ///@brief UDP client
     void CreateClientUDP(UDPMessageCallback mcb,
                          UDPCreateCallback ccb);
@@ -146,6 +179,11 @@ private:
     Application();
 
     void _StartWorkers();
+    void _ListenUDPShards(const SocketAddr& listenAddr,
+                          UDPMessageCallback mcb,
+                          UDPCreateCallback ccb,
+                          bool steerByFlow,
+                          BindCallback bfcb);
 
     // The default loop for accept/connect, or as worker if empty worker pool
     EventLoop base_;
@@ -156,6 +194,9 @@ private:
     size_t numLoop_ {0};
     mutable std::atomic<size_t> currentLoop_ {0};
 
+    // run in base loop after workers started
+    std::vector<std::function<void ()>> afterStart_;
+
     enum class State {
         eS_None,
         eS_Started,
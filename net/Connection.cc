@@ -1,30 +1,66 @@
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <limits>
 
 #include <errno.h>
 #include <unistd.h>
+#include <sys/socket.h>
 #include <sys/uio.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#endif
 
 #include "EventLoop.h"
+#include "Application.h"
 #include "Connection.h"
+#include "ShmTransport.h"
 #include "AnanasDebug.h"
 #include "util/Util.h"
+#include "util/BufferPool.h"
 
 namespace ananas {
 
 using internal::eET_Read;
 using internal::eET_Write;
 
+namespace {
+const std::size_t kNoLimit = std::numeric_limits<std::size_t>::max();
+
+const std::shared_ptr<ConnectionCallbacks>& EmptyCallbacks() {
+    static auto empty = std::make_shared<ConnectionCallbacks>();
+    return empty;
+}
+}
+
 Connection::Connection(EventLoop* loop) :
     loop_(loop),
     localSock_(kInvalid),
-    minPacketSize_(1) {
+    minPacketSize_(1),
+    callbacks_(EmptyCallbacks()) {
 }
 
 Connection::~Connection() {
     if (localSock_ != kInvalid) {
         Shutdown(ShutdownMode::eSM_Both); // Force send FIN
-        CloseSocket(localSock_);
+        if (!zeroCopySends_.empty() && !Application::Instance().IsExit())
+            _LingerZeroCopy();
+        else
+            CloseSocket(localSock_);
+    }
+
+    _ClearPendingSend();
+    _ReleaseUpstreams();
+    s_pendingSendBytes -= reportedPending_;
+
+    if (recvFds_) {
+        for (int fd : *recvFds_)
+            ::close(fd);
     }
+
+    delete outbound_.load(std::memory_order_acquire);
 }
 
 bool Connection::Init(int fd, const SocketAddr& peer) {
@@ -45,7 +81,7 @@ void Connection::ActiveClose() {
     if (localSock_ == kInvalid)
         return;
 
-    if (sendBuf_.Empty()) {
+    if (!_HasPendingSend()) {
         Shutdown(ShutdownMode::eSM_Both);
         state_ = State::eS_ActiveClose;
     } else {
@@ -53,7 +89,7 @@ void Connection::ActiveClose() {
         Shutdown(ShutdownMode::eSM_Read); // disable read
     }
 
-    loop_->Modify(eET_Write, shared_from_this());
+    _Modify(eET_Write);
 }
 
 void Connection::Shutdown(ShutdownMode mode) {
@@ -63,18 +99,18 @@ void Connection::Shutdown(ShutdownMode mode) {
         break;
 
     case ShutdownMode::eSM_Write:
-        if (!sendBuf_.Empty()) {
+        if (_HasPendingSend()) {
             ANANAS_WRN << localSock_ << " shutdown write, but still has data to send";
-            sendBuf_.Clear();
+            _ClearPendingSend();
         }
 
         ::shutdown(localSock_, SHUT_WR);
         break;
 
     case ShutdownMode::eSM_Both:
-        if (!sendBuf_.Empty()) {
+        if (_HasPendingSend()) {
             ANANAS_WRN << localSock_ << " shutdown both, but still has data to send";
-            sendBuf_.Clear();
+            _ClearPendingSend();
         }
 
         ::shutdown(localSock_, SHUT_RDWR);
@@ -96,19 +132,78 @@ bool Connection::HandleReadEvent() {
         return false;
     }
 
+    readIteration_ = loop_->iteration_;
+    readMore_ = false;
+
+    if (shm_)
+        return _HandleShmReadEvent();
+
+    if (sharedRecv_ && !recvRing_) {
+        // the partial packet left last time is prepended
+        scratch_ = &loop_->RecvScratch();
+        assert (scratch_->IsEmpty());
+        if (!recvBuf_.IsEmpty()) {
+            scratch_->PushData(recvBuf_.ReadAddr(), recvBuf_.ReadableSize());
+            Buffer().Swap(recvBuf_);
+        }
+    }
+
     processingRead_ = true;
     ANANAS_DEFER {
         processingRead_ = false;
-        if (!batchSendBuf_.IsEmpty()) {
-            SendPacket(batchSendBuf_);
-            batchSendBuf_.Clear();
+        if (scratch_) {
+            // keep only the unconsumed bytes
+            if (!scratch_->IsEmpty())
+                recvBuf_.PushData(scratch_->ReadAddr(), scratch_->ReadableSize());
+
+            scratch_->Clear();
+            scratch_ = nullptr;
         }
+
+        if (!dirty_)
+            _FlushBatch();
     };
 
+    // fairness: leave the rest to the next loop iteration
+    const std::size_t maxBytes = loop_->readBudgetBytes_;
+    const std::size_t maxMessages = loop_->readBudgetMessages_ ?
+                                    loop_->readBudgetMessages_ : kNoLimit;
+    std::size_t bytesRead = 0;
+    std::size_t messages = 0;
+
     bool busy = false;
+    if (messagesLeft_) {
+        // messages received last time, but out of budget
+        messagesLeft_ = false;
+        messages = _ProcessRecvBuffer(maxMessages);
+        busy = messages > 0;
+    }
+
     while (true) {
-        recvBuf_.AssureSpace(8 * 1024);
-        int bytes = ::recv(localSock_, recvBuf_.WriteAddr(), recvBuf_.WritableSize(), 0);
+        if (readPauses_ > 0)
+            return true; // paused by user or flow control
+
+        if ((maxBytes > 0 && bytesRead >= maxBytes) || messages >= maxMessages) {
+            // don't rely on next poll, it may be edge triggered
+            readMore_ = true;
+            if (!readyQueued_) {
+                readyQueued_ = true;
+                loop_->_AddReady(std::static_pointer_cast<Connection>(shared_from_this()));
+            }
+            break;
+        }
+
+        std::size_t writable = 0;
+        char* addr = _RecvWriteAddr(writable);
+        if (maxRecvBuf_ > 0) {
+            // limit may be lowered in onMessage
+            if (_RecvReadableSize() >= maxRecvBuf_)
+                break;
+
+            writable = std::min(writable, maxRecvBuf_ - _RecvReadableSize());
+        }
+
+        int bytes = _Recv(addr, writable);
         if (bytes == kError) {
             if (EAGAIN == errno || EWOULDBLOCK == errno)
                 return true;
@@ -124,51 +219,168 @@ bool Connection::HandleReadEvent() {
 
         if (bytes == 0) {
             ANANAS_WRN << localSock_ << " HandleReadEvent EOF ";
-            if (sendBuf_.Empty()) {
+            if (!_HasPendingSend()) {
                 Shutdown(ShutdownMode::eSM_Both);
                 state_ = State::eS_PassiveClose;
             } else {
                 state_ = State::eS_CloseWaitWrite;
                 Shutdown(ShutdownMode::eSM_Read);
-                loop_->Modify(eET_Write, shared_from_this()); // disable read
+                _Modify(eET_Write); // disable read
             }
 
             return false;
         }
 
-        recvBuf_.Produce(static_cast<size_t>(bytes));
-        while (recvBuf_.ReadableSize() >= minPacketSize_) {
-            size_t bytes = 0;
-            if (onMessage_) {
-                bytes = onMessage_(this,
-                                   recvBuf_.ReadAddr(),
-                                   recvBuf_.ReadableSize());
-            } else {
-                // default: just echo
-                bytes = recvBuf_.ReadableSize();
-                SendPacket(recvBuf_);
-            }
+        _RecvProduce(static_cast<size_t>(bytes));
+        lastRead_ = loop_->timeoutWheel_.Now();
+        bytesRead += static_cast<size_t>(bytes);
 
-            if (bytes == 0) {
-                break;
-            } else {
-                recvBuf_.Consume(bytes);
-                busy = true;
+        if (shmAccept_) {
+            // the first bytes are hello of ConnectShm
+            const int ret = _AcceptShm();
+            if (ret < 0) {
+                Shutdown(ShutdownMode::eSM_Both);
+                state_ = State::eS_Error;
+                return false;
             }
+
+            if (ret == 0)
+                continue;
+
+            return true; // the first bytes in ring ring the doorbell
+        }
+
+        const std::size_t n = _ProcessRecvBuffer(maxMessages - messages);
+        if (n > 0) {
+            messages += n;
+            busy = true;
         }
     }
 
-    if (busy)
+    if (busy && !recvRing_ && !scratch_)
         recvBuf_.Shrink();
 
     return true;
 }
 
+std::size_t Connection::_ProcessRecvBuffer(std::size_t maxMessages) {
+    std::size_t messages = 0;
+    while (readPauses_ == 0 && _RecvReadableSize() >= minPacketSize_) {
+        if (messages == maxMessages) {
+            messagesLeft_ = true;
+            return messages;
+        }
+
+        size_t bytes = 0;
+        if (callbacks_->onMessage) {
+            // hold the table, SetOnMessage in onMessage copies it on write
+            const auto callbacks = callbacks_;
+            bytes = callbacks->onMessage(this,
+                                         _RecvReadAddr(),
+                                         _RecvReadableSize());
+        } else {
+            // default: just echo
+            bytes = _RecvReadableSize();
+            SendPacket(_RecvReadAddr(), bytes);
+        }
+
+        if (bytes == 0) {
+            break;
+        } else {
+            _RecvConsume(bytes);
+            ++ messages;
+        }
+    }
+
+    // user can't consume it now, stop reading until ResumeRead
+    if (maxRecvBuf_ > 0 &&
+        _RecvReadableSize() >= maxRecvBuf_ &&
+        !recvFullPaused_) {
+        ANANAS_WRN << localSock_ << " recv buffer is full, pause reading";
+        recvFullPaused_ = true;
+        _PauseRead();
+    }
+
+    return messages;
+}
+
+char* Connection::_RecvWriteAddr(std::size_t& writable) {
+    if (scratch_) {
+        scratch_->AssureSpace(64 * 1024);
+        writable = scratch_->WritableSize();
+        return scratch_->WriteAddr();
+    }
+
+    if (recvRing_) {
+        if (!recvRing_->AssureSpace(8 * 1024)) {
+            // can't grow the mapping, fallback to Buffer
+            ANANAS_WRN << localSock_ << " RingBuffer AssureSpace failed";
+            recvBuf_.PushData(recvRing_->ReadAddr(), recvRing_->ReadableSize());
+            recvRing_.reset();
+        } else {
+            writable = recvRing_->WritableSize();
+            return recvRing_->WriteAddr();
+        }
+    }
+
+    recvBuf_.AssureSpace(8 * 1024);
+    writable = recvBuf_.WritableSize();
+    return recvBuf_.WriteAddr();
+}
+
+void Connection::_RecvProduce(std::size_t bytes) {
+    if (scratch_)
+        scratch_->Produce(bytes);
+    else if (recvRing_)
+        recvRing_->Produce(bytes);
+    else
+        recvBuf_.Produce(bytes);
+}
+
+const char* Connection::_RecvReadAddr() const {
+    if (shm_ && recvBuf_.IsEmpty())
+        return shm_->Rx().ReadAddr();
+    if (scratch_)
+        return scratch_->ReadAddr();
+    if (recvRing_)
+        return recvRing_->ReadAddr();
+
+    return const_cast<Buffer&>(recvBuf_).ReadAddr();
+}
+
+std::size_t Connection::_RecvReadableSize() const {
+    if (shm_ && recvBuf_.IsEmpty())
+        return shm_->Rx().ReadableSize();
+    if (scratch_)
+        return scratch_->ReadableSize();
+
+    return recvRing_ ? recvRing_->ReadableSize() : recvBuf_.ReadableSize();
+}
+
+void Connection::_RecvConsume(std::size_t bytes) {
+    if (shm_ && recvBuf_.IsEmpty()) {
+        if (shm_->Rx().Consume(bytes))
+            shm_->NotifyPeer(); // writer is waiting for space
+    } else if (scratch_)
+        scratch_->Consume(bytes);
+    else if (recvRing_)
+        recvRing_->Consume(bytes);
+    else
+        recvBuf_.Consume(bytes);
+}
+
 
 int Connection::_Send(const void* data, size_t len) {
     if (len == 0)
         return 0;
 
+    if (shm_) {
+        iovec iov;
+        iov.iov_base = const_cast<void*>(data);
+        iov.iov_len = len;
+        return _ShmWrite(&iov, 1);
+    }
+
     int bytes = ::send(localSock_, data, len, 0);
     if (kError == bytes) {
         if (EAGAIN == errno || EWOULDBLOCK == errno)
@@ -185,13 +397,95 @@ int Connection::_Send(const void* data, size_t len) {
     return bytes;
 }
 
+bool Connection::_SendDirectly(const void* data, size_t len, size_t& sent) {
+    sent = 0;
+
+    auto bytes = _Send(data, len);
+    if (bytes == kError) {
+        Shutdown(ShutdownMode::eSM_Both);
+        state_ = State::eS_Error;
+        _Modify(eET_Write);
+        return false;
+    }
+
+    sent = static_cast<size_t>(bytes);
+    if (sent > 0)
+        lastWrite_ = loop_->timeoutWheel_.Now();
+    if (sent < len) {
+        ANANAS_WRN << localSock_
+                   << " want send "
+                   << len
+                   << " bytes, but only send "
+                   << bytes;
+        _Modify(_ReadEvents() | eET_Write);
+    } else {
+        if (callbacks_->onWriteComplete)
+            callbacks_->onWriteComplete(this);
+    }
+
+    return true;
+}
+
+template <typename... Args>
+bool Connection::_QueueIfPending(Args&&... args) {
+    if (!sendFiles_.empty()) {
+        sendFiles_.back().after.Append(std::forward<Args>(args)...);
+        return true;
+    }
+
+    if (!sendBuf_.Empty()) {
+        sendBuf_.Append(std::forward<Args>(args)...);
+        return true;
+    }
+
+    if (_IsBatching()) {
+        batchSendBuf_.Append(std::forward<Args>(args)...);
+        if (!processingRead_ && !dirty_) {
+            dirty_ = true;
+            loop_->_AddDirty(std::static_pointer_cast<Connection>(shared_from_this()));
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+bool Connection::_IsBatching() const {
+    return (processingRead_ && batchSend_) || loop_->IsWriteCoalescing();
+}
+
+void Connection::_FlushBatch() {
+    ANANAS_DEFER {
+        _CheckWaterMarks();
+    };
+
+    dirty_ = false;
+    if (batchSendBuf_.Empty())
+        return;
+
+    BufferChain data(std::move(batchSendBuf_));
+    if (state_ != State::eS_Connected &&
+        state_ != State::eS_CloseWaitWrite)
+        return;
+
+    if (!sendFiles_.empty())
+        sendFiles_.back().after.Append(std::move(data));
+    else if (!sendBuf_.Empty())
+        sendBuf_.Append(std::move(data));
+    else
+        _SendChain(std::move(data));
+}
+
 namespace {
 int WriteV(int , const std::vector<iovec>& );
-void ConsumeBufferVectors(BufferVector& , size_t );
-void CollectBuffer(const std::vector<iovec>& , size_t , BufferVector& );
+void CollectBuffer(const std::vector<iovec>& , size_t , BufferChain& );
 }
 
 bool Connection::HandleWriteEvent() {
+    ANANAS_DEFER {
+        _CheckWaterMarks();
+    };
 
     if (state_ != State::eS_Connected &&
         state_ != State::eS_CloseWaitWrite) {
@@ -201,160 +495,1139 @@ bool Connection::HandleWriteEvent() {
 
     // it's connected or half-close, whatever, we can send.
 
-    size_t expectSend = 0;
-    std::vector<iovec> iovecs;
-    for (auto& e : sendBuf_) {
-        assert (!e.IsEmpty());
+    while (true) {
+        if (!sendBuf_.Empty()) {
+            size_t expectSend = sendBuf_.TotalBytes();
+            int ret = _WriteChain(sendBuf_);
+            if (ret == kError) {
+                ANANAS_ERR << localSock_ << " HandleWriteEvent ERROR ";
+                Shutdown(ShutdownMode::eSM_Both);
+                state_ = State::eS_Error;
+                return false;
+            }
 
-        iovec ivc;
-        ivc.iov_base = (void*)(e.ReadAddr());
-        ivc.iov_len = e.ReadableSize();
+            assert (ret >= 0);
 
-        iovecs.push_back(ivc);
-        expectSend += e.ReadableSize();
+            if (static_cast<size_t>(ret) < expectSend)
+                return true; // kernel buffer is full
+        }
+
+        if (sendFiles_.empty())
+            break;
+
+        if (!_SendFileSegment()) {
+            ANANAS_ERR << localSock_ << " HandleWriteEvent sendfile ERROR ";
+            Shutdown(ShutdownMode::eSM_Both);
+            state_ = State::eS_Error;
+            return false;
+        }
+
+        if (sendFiles_.front().len > 0 || !sendFiles_.front().passFds.empty())
+            return true; // kernel buffer is full
+
+        // the file is done, bytes after it are the next
+        if (sendFiles_.front().fd != kInvalid)
+            ::close(sendFiles_.front().fd);
+        sendBuf_ = std::move(sendFiles_.front().after);
+        sendFiles_.pop_front();
     }
 
-    int ret = WriteV(localSock_, iovecs);
-    if (ret == kError) {
-        ANANAS_ERR << localSock_ << " HandleWriteEvent ERROR ";
-        Shutdown(ShutdownMode::eSM_Both);
-        state_ = State::eS_Error;
+    // all sent, flush the last partial frame
+    _SetCork(false);
+    _Modify(_ReadEvents());
+
+    if (callbacks_->onWriteComplete)
+        callbacks_->onWriteComplete(this);
+
+    if (state_ == State::eS_CloseWaitWrite) {
+        state_ = State::eS_PassiveClose;
         return false;
     }
 
-    assert (ret >= 0);
+    return true;
+}
 
-    size_t alreadySent = static_cast<size_t>(ret);
-    ConsumeBufferVectors(sendBuf_, alreadySent);
+void Connection::_SetCork(bool enable) {
+    // Set once for all the queued files, not for every write event
+    if (corked_ == enable || peer_.IsUnix())
+        return;
+
+    corked_ = enable;
+    SetCork(localSock_, enable);
+}
 
-    if (alreadySent == expectSend) {
-        loop_->Modify(eET_Read, shared_from_this());
+bool Connection::_SendFileSegment() {
+    auto& f = sendFiles_.front();
+    if (!f.passFds.empty())
+        return _SendFdSegment();
+    const size_t kMaxChunk = 4 * 1024 * 1024;
+
+    while (f.len > 0) {
+        const size_t want = std::min(f.len, kMaxChunk);
+        ssize_t bytes;
+        if (shm_) {
+            // read the file into ring, one copy like sendfile
+            bytes = _ShmReadFile(f.fd, f.offset, want);
+            if (bytes > 0)
+                f.offset += bytes;
+        } else {
+#if defined(__linux__)
+            bytes = ::sendfile(localSock_, f.fd, &f.offset, want);
+#else
+            char buf[64 * 1024];
+            bytes = ::pread(f.fd, buf, std::min(want, sizeof buf), f.offset);
+            if (bytes > 0) {
+                bytes = ::send(localSock_, buf, static_cast<size_t>(bytes), 0);
+                if (bytes > 0)
+                    f.offset += bytes;
+            }
+#endif
+        }
+        if (bytes == kError) {
+            if (EINTR == errno)
+                continue;
+
+            if (EAGAIN == errno || EWOULDBLOCK == errno)
+                return true;
 
-        if (onWriteComplete_)
-            onWriteComplete_(this);
+            return false;
+        }
 
-        if (state_ == State::eS_CloseWaitWrite) {
-            state_ = State::eS_PassiveClose;
+        if (bytes == 0) {
+            // file is truncated, can't fill the promised length
+            ANANAS_ERR << localSock_ << " sendfile EOF, left " << f.len;
             return false;
         }
+
+        f.len -= static_cast<size_t>(bytes);
+        lastWrite_ = loop_->timeoutWheel_.Now();
     }
 
     return true;
 }
 
-void  Connection::HandleErrorEvent() {
-    ANANAS_ERR << localSock_ << " HandleErrorEvent " << state_;
+bool Connection::_SendFdSegment() {
+    auto& f = sendFiles_.front();
+    assert (!f.after.Empty());
 
-    switch (state_) {
-    case State::eS_PassiveClose:
-    case State::eS_ActiveClose:
-    case State::eS_Error:
-        break;
+    // fds are attached to the bytes of first block
+    const auto& block = *f.after.begin();
+    iovec iov;
+    iov.iov_base = const_cast<void*>(block.data);
+    iov.iov_len = block.len;
 
-    case State::eS_None:
-    case State::eS_Connected: // should not happen
-    case State::eS_CloseWaitWrite:
-    case State::eS_Closed: // should not happen
-    default:
-        return;
-    }
+    const std::size_t fdBytes = f.passFds.size() * sizeof(int);
+    std::vector<char> control(CMSG_SPACE(fdBytes));
 
-    state_ = State::eS_Closed;
+    msghdr msg {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = &control[0];
+    msg.msg_controllen = control.size();
 
-    if (onDisconnect_)
-        onDisconnect_(this);
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(fdBytes);
+    memcpy(CMSG_DATA(cmsg), &f.passFds[0], fdBytes);
 
-    loop_->Unregister(eET_Read | eET_Write, shared_from_this());
+    while (true) {
+        int bytes = static_cast<int>(::sendmsg(localSock_, &msg, 0));
+        if (bytes == kError) {
+            if (EINTR == errno)
+                continue;
+
+            if (EAGAIN == errno || EWOULDBLOCK == errno)
+                return true;
+
+            return false;
+        }
+
+        // peer got the fds, close our copies
+        for (int fd : f.passFds)
+            ::close(fd);
+        f.passFds.clear();
+
+        f.after.Consume(static_cast<size_t>(bytes));
+        lastWrite_ = loop_->timeoutWheel_.Now();
+        return true;
+    }
 }
 
-bool Connection::SafeSend(const void* data, std::size_t size) {
-    if (loop_->InThisLoop())
-        return this->SendPacket(data, size);
-    else
-        return SafeSend(std::string((const char*)data, size));
+int Connection::_Recv(char* buf, std::size_t len) {
+    if (!fdPassing_)
+        return ::recv(localSock_, buf, len, 0);
+
+    const std::size_t kMaxFds = 64;
+    char control[CMSG_SPACE(kMaxFds * sizeof(int))];
+
+    iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len = len;
+
+    msghdr msg {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+
+    int flags = 0;
+#if defined(MSG_CMSG_CLOEXEC)
+    flags |= MSG_CMSG_CLOEXEC;
+#endif
+    int bytes = static_cast<int>(::recvmsg(localSock_, &msg, flags));
+    if (bytes == kError)
+        return bytes;
+
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        const std::size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        if (!recvFds_)
+            recvFds_.reset(new std::vector<int>);
+
+        const int* fds = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+        for (std::size_t i = 0; i < n; ++ i) {
+            int fd;
+            memcpy(&fd, fds + i, sizeof fd);
+            recvFds_->push_back(fd);
+        }
+    }
+
+    if (msg.msg_flags & MSG_CTRUNC)
+        ANANAS_WRN << localSock_ << " received too many fds, some are dropped";
+
+    return bytes;
 }
 
-bool Connection::SafeSend(const std::string& data) {
-    if (loop_->InThisLoop())
-        return this->SendPacket(data);
-    else
-        loop_->Execute([this, data]() {
-                          this->SendPacket(data);
-                       });
+std::vector<int> Connection::TakeReceivedFds() {
+    std::vector<int> fds;
+    if (recvFds_)
+        fds.swap(*recvFds_);
 
-    return true;
+    return fds;
 }
 
-bool Connection::SendPacket(const void* data, std::size_t size) {
+bool Connection::ConnectShm(std::size_t ringSize) {
     assert (loop_->InThisLoop());
 
-    if (size == 0)
+    if (shm_)
         return true;
 
-    if (state_ != State::eS_Connected &&
-        state_ != State::eS_CloseWaitWrite)
+    if (!peer_.IsUnix() || state_ != State::eS_Connected ||
+        _HasPendingSend() || !batchSendBuf_.Empty()) {
+        ANANAS_ERR << localSock_ << " ConnectShm needs a unix connection sent nothing";
         return false;
-
-    if (!sendBuf_.Empty()) {
-        sendBuf_.Push(data, size);
-        return true;
     }
 
-    if (processingRead_ && batchSend_) {
-        batchSendBuf_.PushData(data, size);
-        return true;
+    std::unique_ptr<internal::ShmTransport> shm(new internal::ShmTransport);
+    if (!shm->Create(ringSize ? ringSize : internal::ShmTransport::kDefaultRingSize)) {
+        ANANAS_ERR << localSock_ << " ConnectShm create region failed " << errno;
+        return false;
     }
 
-    auto bytes = _Send(data, size);
-    if (bytes == kError) {
-        Shutdown(ShutdownMode::eSM_Both);
-        state_ = State::eS_Error;
-        loop_->Modify(eET_Write, shared_from_this());
+    int fds[internal::ShmTransport::kPassFds];
+    shm->GetPassFds(fds);
+    char hello[internal::ShmTransport::kHelloSize];
+    shm->MakeHello(hello);
+
+    if (!SendFds(fds, internal::ShmTransport::kPassFds, hello, sizeof hello))
         return false;
-    }
 
-    if (bytes < static_cast<int>(size)) {
-        ANANAS_WRN << localSock_
-                   << " want send "
-                   << size
-                   << " bytes, but only send "
-                   << bytes;
-        sendBuf_.Push((char*)data + bytes, size - static_cast<std::size_t>(bytes));
-        loop_->Modify(eET_Read | eET_Write, shared_from_this());
-    } else {
-        if (onWriteComplete_)
-            onWriteComplete_(this);
+    if (_HasPendingSend()) {
+        // hello must not be sent after bytes in ring
+        ANANAS_ERR << localSock_ << " ConnectShm can't send hello at once";
+        _ForceClose();
+        return false;
     }
 
-    return true;
+    shm->CloseMemFd(); // server has its copy
+    shm_ = std::move(shm);
+    return _StartShm();
 }
 
-bool Connection::SendPacket(const std::string& data) {
-    return SendPacket(data.data(), data.size());
+void Connection::AcceptShm() {
+    fdPassing_ = true;
+    shmAccept_ = true;
 }
 
-bool Connection::SendPacket(const Buffer& data) {
-    return SendPacket(const_cast<Buffer&>(data).ReadAddr(), data.ReadableSize());
+int Connection::_AcceptShm() {
+    if (_RecvReadableSize() < internal::ShmTransport::kHelloSize)
+        return 0;
+
+    std::unique_ptr<internal::ShmTransport> shm(new internal::ShmTransport);
+    const bool ok = shm->Attach(_RecvReadAddr(), TakeReceivedFds());
+    _RecvConsume(internal::ShmTransport::kHelloSize);
+
+    // peer writes nothing to socket after hello
+    if (!ok || _RecvReadableSize() > 0) {
+        ANANAS_ERR << localSock_ << " AcceptShm failed";
+        return -1;
+    }
+
+    shmAccept_ = false;
+    fdPassing_ = false;
+    shm_ = std::move(shm);
+    return _StartShm() ? 1 : -1;
 }
 
-// iovec for writev
-namespace {
+bool Connection::_StartShm() {
+    // receive buffers are for the message larger than ring only
+    recvRing_.reset();
+    sharedRecv_ = false;
+
+    std::weak_ptr<Connection> wself = std::static_pointer_cast<Connection>(shared_from_this());
+    if (!shm_->Register(loop_, [wself]() {
+        if (auto self = wself.lock())
+            self->_OnShmDoorbell();
+    })) {
+        ANANAS_ERR << localSock_ << " register doorbell failed";
+        _ForceClose();
+        return false;
+    }
 
-int WriteV(int sock, const std::vector<iovec>& buffers) {
-    const int kIOVecCount = 64; // be care of IOV_MAX
+    return true;
+}
 
-    size_t sentVecs = 0;
-    size_t sentBytes = 0;
-    while (sentVecs < buffers.size()) {
-        const int vc = std::min<int>(buffers.size() - sentVecs, kIOVecCount);
+void Connection::_Modify(int events) {
+    // socket is always writable but useless for shm, doorbell tells space of ring
+    if (shm_ && (state_ == State::eS_Connected || state_ == State::eS_CloseWaitWrite))
+        events &= ~eET_Write;
 
-        int expectBytes = 0;
-        for (size_t i = sentVecs; i < sentVecs + vc; ++ i) {
-            expectBytes += static_cast<int>(buffers[i].iov_len);
-        }
+    loop_->Modify(events, shared_from_this());
+}
+
+int Connection::_ShmWrite(const iovec* iov, std::size_t count) {
+    auto& tx = shm_->Tx();
+
+    std::size_t sent = 0;
+    std::size_t i = 0;
+    std::size_t offset = 0; // in iov[i]
+    while (i < count) {
+        const std::size_t writable = tx.WritableSize();
+        if (writable == 0) {
+            // let peer consume, it rings me when space is freed
+            if (tx.Publish())
+                shm_->NotifyPeer();
+            if (tx.WaitSpace())
+                continue;
+
+            break;
+        }
+
+        const std::size_t bytes = std::min(writable, iov[i].iov_len - offset);
+        memcpy(tx.WriteAddr(), static_cast<const char*>(iov[i].iov_base) + offset, bytes);
+        tx.Produce(bytes);
+        sent += bytes;
+
+        offset += bytes;
+        if (offset == iov[i].iov_len) {
+            ++ i;
+            offset = 0;
+        }
+    }
+
+    if (tx.Corrupted()) {
+        ANANAS_ERR << localSock_ << " shm ring is corrupted by peer";
+        errno = EPROTO;
+        return kError;
+    }
+
+    if (tx.Publish())
+        shm_->NotifyPeer();
+
+    return static_cast<int>(sent);
+}
+
+ssize_t Connection::_ShmReadFile(int fd, off_t offset, std::size_t len) {
+    auto& tx = shm_->Tx();
+    if (tx.WritableSize() == 0) {
+        if (tx.Publish())
+            shm_->NotifyPeer();
+        if (!tx.WaitSpace()) {
+            if (tx.Corrupted()) {
+                ANANAS_ERR << localSock_ << " shm ring is corrupted by peer";
+                errno = EPROTO;
+            } else {
+                errno = EAGAIN;
+            }
+
+            return kError;
+        }
+    }
+
+    ssize_t bytes = ::pread(fd, tx.WriteAddr(), std::min(len, tx.WritableSize()), offset);
+    if (bytes > 0) {
+        tx.Produce(static_cast<std::size_t>(bytes));
+        if (tx.Publish())
+            shm_->NotifyPeer();
+    }
+
+    return bytes;
+}
+
+bool Connection::_HandleShmReadEvent() {
+    _ProcessShmRing();
+    if (state_ != State::eS_Connected || readPauses_ > 0)
+        return true;
+
+    // peer writes nothing to socket, it's readable only when closed
+    while (true) {
+        char ch;
+        int bytes = ::recv(localSock_, &ch, 1, 0);
+        if (bytes == 0)
+            break;
+
+        if (bytes == kError) {
+            if (EINTR == errno)
+                continue;
+
+            if (EAGAIN == errno || EWOULDBLOCK == errno)
+                return true;
+        }
+
+        ANANAS_ERR << localSock_ << " HandleReadEvent shm socket error " << errno;
+        Shutdown(ShutdownMode::eSM_Both);
+        state_ = State::eS_Error;
+        return false;
+    }
+
+    ANANAS_WRN << localSock_ << " HandleReadEvent EOF ";
+
+    // bytes published before peer closed
+    _ProcessShmRing();
+
+    // nobody consumes ring after peer closed, drop the pending bytes
+    if (state_ == State::eS_Connected) {
+        Shutdown(ShutdownMode::eSM_Both);
+        state_ = State::eS_PassiveClose;
+    }
+
+    return false;
+}
+
+void Connection::_ProcessShmRing() {
+    auto& rx = shm_->Rx();
+
+    processingRead_ = true;
+    ANANAS_DEFER {
+        processingRead_ = false;
+        if (!dirty_)
+            _FlushBatch();
+    };
+
+    while (readPauses_ == 0 && state_ == State::eS_Connected) {
+        if (rx.ReadableSize() > 0)
+            lastRead_ = loop_->timeoutWheel_.Now();
+
+        _ProcessRecvBuffer(kNoLimit);
+        if (readPauses_ > 0 || state_ != State::eS_Connected)
+            break;
+
+        // Gather the message larger than ring: the ring is full and writer
+        // waits for space, or the message is partly gathered already
+        const std::size_t left = rx.ReadableSize();
+        if (left > 0 && (left == rx.Capacity() || !recvBuf_.IsEmpty())) {
+            recvBuf_.PushData(rx.ReadAddr(), left);
+            if (rx.Consume(left))
+                shm_->NotifyPeer();
+
+            continue;
+        }
+
+        if (!rx.WaitData(left))
+            break; // sleep until the doorbell
+    }
+
+    if (rx.Corrupted() && state_ == State::eS_Connected) {
+        ANANAS_ERR << localSock_ << " shm ring is corrupted by peer";
+        _ForceClose();
+    }
+
+    if (recvBuf_.IsEmpty())
+        recvBuf_.Shrink();
+}
+
+void Connection::_OnShmDoorbell() {
+    if ((state_ == State::eS_Connected || state_ == State::eS_CloseWaitWrite) &&
+        _HasPendingSend()) {
+        // peer freed space of ring
+        if (!HandleWriteEvent()) {
+            HandleErrorEvent();
+            return;
+        }
+    }
+
+    if (state_ == State::eS_Connected)
+        _ProcessShmRing();
+}
+
+int Connection::_ReadEvents() const {
+    return readPauses_ > 0 ? 0 : eET_Read;
+}
+
+void Connection::_PauseRead() {
+    if (readPauses_ ++ == 0 && state_ == State::eS_Connected)
+        _Modify(_HasPendingSend() ? eET_Write : 0);
+}
+
+void Connection::_ResumeRead() {
+    assert (readPauses_ > 0);
+    if (-- readPauses_ > 0 || state_ != State::eS_Connected)
+        return;
+
+    _Modify(_HasPendingSend() ? eET_Read | eET_Write : eET_Read);
+
+    // Resumed in onMessage of this, the outer loop goes on with the rest
+    if (processingRead_)
+        return;
+
+    // The buffered bytes may never be followed by new data, serve them from
+    // the ready list, never inline: we may be in a callback of this.
+    // Ring of shm must be processed to rearm the doorbell.
+    if (_RecvReadableSize() > 0 || shm_) {
+        if (!shm_)
+            messagesLeft_ = true;
+
+        readMore_ = true;
+        if (!readyQueued_) {
+            readyQueued_ = true;
+            loop_->_AddReady(std::static_pointer_cast<Connection>(shared_from_this()));
+        }
+    }
+}
+
+void Connection::PauseRead() {
+    assert (loop_->InThisLoop());
+    if (!userPaused_) {
+        userPaused_ = true;
+        _PauseRead();
+    }
+}
+
+void Connection::ResumeRead() {
+    assert (loop_->InThisLoop());
+    if (recvFullPaused_) {
+        recvFullPaused_ = false;
+        _ResumeRead();
+    }
+
+    if (userPaused_) {
+        userPaused_ = false;
+        _ResumeRead();
+    }
+}
+
+bool Connection::IsReadPaused() const {
+    return readPauses_ > 0;
+}
+
+void Connection::SetMaxRecvBufferSize(std::size_t size) {
+    maxRecvBuf_ = size;
+
+    const bool full = maxRecvBuf_ > 0 && _RecvReadableSize() >= maxRecvBuf_;
+    if (full && !recvFullPaused_) {
+        // lowered below the buffered bytes
+        recvFullPaused_ = true;
+        _PauseRead();
+    } else if (!full && recvFullPaused_) {
+        recvFullPaused_ = false;
+        _ResumeRead();
+    }
+}
+
+void Connection::_CheckWaterMarks() {
+    const std::size_t pending = PendingSendBytes();
+    if (pending > 0 && reportedPending_ == 0 && writeTimeout_ > 0) {
+        // write stall is timed from now, the wheel may be stopped
+        loop_->timeoutWheel_.UpdateNow();
+        lastWrite_ = loop_->timeoutWheel_.Now();
+        _ArmTimeouts();
+    }
+
+    if (pending != reportedPending_) {
+        s_pendingSendBytes += pending - reportedPending_; // unsigned wrap is ok
+        reportedPending_ = pending;
+    }
+
+    if (highWaterMark_ == 0)
+        return;
+
+    if (!aboveHighWater_ && pending >= highWaterMark_) {
+        aboveHighWater_ = true;
+        ANANAS_WRN << localSock_ << " send buffer reach high water mark, pending " << pending;
+
+        if (callbacks_->onHighWaterMark)
+            callbacks_->onHighWaterMark(this, pending);
+
+        switch (highWaterPolicy_) {
+        case HighWaterPolicy::ePauseUpstream:
+            _ForEachUpstream(&Connection::_PauseRead);
+            break;
+
+        case HighWaterPolicy::eClose:
+            // slow peer, drop the data and close, don't wait
+            _ForceClose();
+            break;
+
+        default:
+            break;
+        }
+    } else if (aboveHighWater_ && pending <= lowWaterMark_) {
+        aboveHighWater_ = false;
+
+        if (callbacks_->onLowWaterMark)
+            callbacks_->onLowWaterMark(this);
+
+        if (highWaterPolicy_ == HighWaterPolicy::ePauseUpstream)
+            _ForEachUpstream(&Connection::_ResumeRead);
+    }
+}
+
+void Connection::_ForEachUpstream(void (Connection::*f)()) {
+    for (const auto& w : upstreams_) {
+        auto up = w.lock();
+        if (!up)
+            continue;
+
+        if (up->GetLoop()->InThisLoop())
+            (up.get()->*f)();
+        else
+            up->GetLoop()->Execute([up, f]() { (up.get()->*f)(); });
+    }
+}
+
+void Connection::_ReleaseUpstreams() {
+    // No low water mark will come, don't leave them paused forever
+    if (aboveHighWater_ && highWaterPolicy_ == HighWaterPolicy::ePauseUpstream)
+        _ForEachUpstream(&Connection::_ResumeRead);
+
+    upstreams_.clear();
+}
+
+void Connection::_ForceClose() {
+    _ReleaseUpstreams();
+
+    if (state_ == State::eS_Connected || state_ == State::eS_CloseWaitWrite) {
+        Shutdown(ShutdownMode::eSM_Both);
+        state_ = State::eS_Error;
+        _Modify(eET_Write); // close in HandleWriteEvent
+    }
+}
+
+void Connection::SetIdleTimeout(std::chrono::milliseconds timeout) {
+    idleTimeout_ = internal::TimeoutWheel::ToTicks(timeout);
+    _ArmTimeouts(true);
+}
+
+void Connection::SetReadTimeout(std::chrono::milliseconds timeout) {
+    readTimeout_ = internal::TimeoutWheel::ToTicks(timeout);
+    _ArmTimeouts(true);
+}
+
+void Connection::SetWriteTimeout(std::chrono::milliseconds timeout) {
+    writeTimeout_ = internal::TimeoutWheel::ToTicks(timeout);
+    _ArmTimeouts(true);
+}
+
+void Connection::SetOnTimeout(std::function<void (Connection* , TimeoutType )> cb) {
+    _MutableCallbacks().onTimeout = std::move(cb);
+}
+
+void Connection::_ArmTimeouts(bool restart) {
+    assert (loop_->InThisLoop());
+
+    auto& wheel = loop_->timeoutWheel_;
+    if (restart) {
+        // stamps are stale if the wheel is not running
+        wheel.UpdateNow();
+        lastRead_ = lastWrite_ = wheel.Now();
+    }
+
+    auto deadline = _NextTimeout();
+    if (deadline != 0)
+        loop_->_AddTimeout(std::static_pointer_cast<Connection>(shared_from_this()), deadline);
+}
+
+internal::TimeoutWheel::Tick Connection::_NextTimeout() const {
+    internal::TimeoutWheel::Tick deadline = 0;
+    auto earlier = [&deadline](internal::TimeoutWheel::Tick t) {
+        if (deadline == 0 || t < deadline)
+            deadline = t;
+    };
+
+    if (idleTimeout_ > 0)
+        earlier(std::max(lastRead_, lastWrite_) + idleTimeout_);
+    if (readTimeout_ > 0)
+        earlier(lastRead_ + readTimeout_);
+    if (writeTimeout_ > 0 && _HasPendingSend())
+        earlier(lastWrite_ + writeTimeout_);
+
+    return deadline;
+}
+
+internal::TimeoutWheel::Tick Connection::_CheckTimeouts(internal::TimeoutWheel::Tick now) {
+    if (state_ != State::eS_Connected && state_ != State::eS_CloseWaitWrite)
+        return 0;
+
+    // one shot, set it again to rearm
+    TimeoutType type;
+    if (writeTimeout_ > 0 && _HasPendingSend() && lastWrite_ + writeTimeout_ <= now) {
+        type = TimeoutType::eWrite;
+        writeTimeout_ = 0;
+    } else if (readTimeout_ > 0 && lastRead_ + readTimeout_ <= now) {
+        type = TimeoutType::eRead;
+        readTimeout_ = 0;
+    } else if (idleTimeout_ > 0 && std::max(lastRead_, lastWrite_) + idleTimeout_ <= now) {
+        type = TimeoutType::eIdle;
+        idleTimeout_ = 0;
+    } else {
+        return _NextTimeout();
+    }
+
+    if (callbacks_->onTimeout) {
+        callbacks_->onTimeout(this, type);
+    } else {
+        ANANAS_WRN << localSock_ << " timeout " << static_cast<int>(type) << ", close it";
+        if (type == TimeoutType::eWrite || _HasPendingSend())
+            _ForceClose();
+        else
+            ActiveClose();
+    }
+
+    if (state_ != State::eS_Connected && state_ != State::eS_CloseWaitWrite)
+        return 0;
+
+    return _NextTimeout();
+}
+
+bool Connection::_HasPendingSend() const {
+    return !sendBuf_.Empty() || !sendFiles_.empty();
+}
+
+void Connection::_ClearPendingSend() {
+    sendBuf_.Clear();
+    for (auto& f : sendFiles_) {
+        if (f.fd != kInvalid)
+            ::close(f.fd);
+        for (int fd : f.passFds)
+            ::close(fd);
+    }
+
+    sendFiles_.clear();
+}
+
+int Connection::_WriteChain(BufferChain& chain) {
+    std::vector<iovec> iovecs;
+    iovecs.reserve(chain.SegmentCount());
+    for (const auto& e : chain) {
+        assert (e.len > 0);
+
+        iovec ivc;
+        ivc.iov_base = const_cast<void*>(e.data);
+        ivc.iov_len = e.len;
+        iovecs.push_back(ivc);
+    }
+
+#if defined(__linux__) && defined(MSG_ZEROCOPY)
+    if (zeroCopyThreshold_ && !shm_ && chain.TotalBytes() >= zeroCopyThreshold_) {
+        const size_t kIOVecCount = 64; // be care of IOV_MAX
+
+        size_t sentVecs = 0;
+        size_t sentBytes = 0;
+        while (sentVecs < iovecs.size()) {
+            const size_t vc = std::min(iovecs.size() - sentVecs, kIOVecCount);
+
+            size_t expectBytes = 0;
+            for (size_t i = sentVecs; i < sentVecs + vc; ++ i)
+                expectBytes += iovecs[i].iov_len;
+
+            msghdr msg {};
+            msg.msg_iov = &iovecs[sentVecs];
+            msg.msg_iovlen = vc;
+
+            int flags = MSG_ZEROCOPY;
+            if (sentVecs + vc < iovecs.size())
+                flags |= MSG_MORE;
+
+            int bytes = static_cast<int>(::sendmsg(localSock_, &msg, flags));
+            if (bytes == kError) {
+                if (EINTR == errno)
+                    continue;
+
+                if (EAGAIN == errno || EWOULDBLOCK == errno)
+                    break;
+
+                if (ENOBUFS == errno) {
+                    // out of optmem for pinning, copy the rest this time
+                    int ret = WriteV(localSock_, std::vector<iovec>(iovecs.begin() + sentVecs, iovecs.end()));
+                    if (ret == kError)
+                        return kError;
+
+                    chain.Consume(static_cast<size_t>(ret));
+                    sentBytes += static_cast<size_t>(ret);
+                    break;
+                }
+
+                return kError;
+            }
+
+            // hold the sent blocks until completion
+            zeroCopySends_.push_back(ZeroCopySend {zeroCopyId_ ++, false, chain.Split(bytes)});
+            sentBytes += static_cast<size_t>(bytes);
+            if (static_cast<size_t>(bytes) < expectBytes)
+                break;
+
+            sentVecs += vc;
+        }
+
+        if (sentBytes > 0)
+            lastWrite_ = loop_->timeoutWheel_.Now();
+
+        return static_cast<int>(sentBytes);
+    }
+#endif
+
+    int ret = _WriteV(iovecs);
+    if (ret > 0) {
+        chain.Consume(static_cast<size_t>(ret));
+        lastWrite_ = loop_->timeoutWheel_.Now();
+    }
+
+    return ret;
+}
+
+int Connection::_WriteV(const std::vector<iovec>& iovecs) {
+    if (shm_)
+        return _ShmWrite(iovecs.data(), iovecs.size());
+
+    return WriteV(localSock_, iovecs);
+}
+
+bool Connection::_ReapZeroCopy(int sock, std::list<ZeroCopySend>& sends) {
+#if defined(__linux__) && defined(MSG_ZEROCOPY)
+    if (sends.empty())
+        return false;
+
+    bool reaped = false;
+    while (true) {
+        char control[128];
+        msghdr msg {};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof control;
+
+        if (::recvmsg(sock, &msg, MSG_ERRQUEUE) == kError) {
+            if (EINTR == errno)
+                continue;
+
+            break; // EAGAIN: no more
+        }
+
+        for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+                continue;
+
+            auto serr = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(cm));
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+
+            // completed range [lo, hi], may be out of order
+            const uint32_t lo = serr->ee_info;
+            const uint32_t hi = serr->ee_data;
+            for (auto& e : sends) {
+                if (e.id - lo <= hi - lo) {
+                    e.done = true;
+                    e.data.Clear();
+                }
+            }
+
+            reaped = true;
+        }
+    }
+
+    while (!sends.empty() && sends.front().done)
+        sends.pop_front();
+
+    return reaped;
+#else
+    return false;
+#endif
+}
+
+void Connection::_LingerZeroCopy() {
+    // Kernel may still read the pinned blocks, even for retransmission
+    // after close. Freeing them lets the pool reuse them, then the peer
+    // may get garbage, so hold them with the socket until completed.
+    struct Linger {
+        int sock;
+        std::list<ZeroCopySend> sends;
+        TimerId timer;
+        int ticks {0};
+
+        ~Linger() {
+            CloseSocket(sock); // before sends are freed
+        }
+    };
+
+    const std::chrono::milliseconds kPeriod(10);
+    // Give up if the peer doesn't ack for long, the pages are pinned by
+    // kernel, so it's memory safe, just the risk of garbage above
+    const int kMaxTicks = 60 * 1000 / kPeriod.count();
+
+    auto linger = std::make_shared<Linger>();
+    linger->sock = localSock_;
+    linger->sends = std::move(zeroCopySends_);
+    localSock_ = kInvalid;
+
+    auto loop = loop_;
+    loop->Execute([loop, linger, kPeriod, kMaxTicks]() {
+        linger->timer = loop->ScheduleAfterWithRepeat<kForever>(kPeriod, [loop, linger, kMaxTicks]() {
+            _ReapZeroCopy(linger->sock, linger->sends);
+            if (linger->sends.empty() || ++ linger->ticks >= kMaxTicks)
+                loop->Cancel(linger->timer);
+        });
+    });
+}
+
+void  Connection::HandleErrorEvent() {
+    // zero copy completions are reported as error event
+    if (_ReapZeroCopy(localSock_, zeroCopySends_) &&
+        (state_ == State::eS_Connected || state_ == State::eS_CloseWaitWrite))
+        return;
+
+    ANANAS_ERR << localSock_ << " HandleErrorEvent " << state_;
+
+    switch (state_) {
+    case State::eS_PassiveClose:
+    case State::eS_ActiveClose:
+    case State::eS_Error:
+        break;
+
+    case State::eS_None:
+    case State::eS_Connected: // should not happen
+    case State::eS_CloseWaitWrite:
+    case State::eS_Closed: // should not happen
+    default:
+        return;
+    }
+
+    state_ = State::eS_Closed;
+    _ReleaseUpstreams();
+
+    if (callbacks_->onDisconnect)
+        callbacks_->onDisconnect(this);
+
+    if (shm_)
+        shm_->Unregister(loop_);
+
+    loop_->Unregister(eET_Read | eET_Write, shared_from_this());
+}
+
+bool Connection::SafeSend(const void* data, std::size_t size) {
+    if (loop_->InThisLoop())
+        return this->SendPacket(data, size);
+
+    BufferChain chain;
+    chain.Append(data, size);
+    return _PushOutbound(std::move(chain));
+}
+
+bool Connection::SafeSend(const std::string& data) {
+    return SafeSend(data.data(), data.size());
+}
+
+bool Connection::SafeSend(Buffer&& buf) {
+    if (loop_->InThisLoop())
+        return this->SendPacket(std::move(buf));
+
+    return _PushOutbound(BufferChain(std::move(buf)));
+}
+
+bool Connection::SafeSend(std::string&& data) {
+    if (loop_->InThisLoop())
+        return this->SendPacket(std::move(data));
+
+    BufferChain chain;
+    chain.Append(std::move(data));
+    return _PushOutbound(std::move(chain));
+}
+
+bool Connection::_PushOutbound(BufferChain&& chain) {
+    if (chain.Empty())
+        return true;
+
+    // created by the first sender
+    auto queue = outbound_.load(std::memory_order_acquire);
+    if (!queue) {
+        auto q = new MpscQueue<BufferChain>;
+        if (outbound_.compare_exchange_strong(queue, q, std::memory_order_acq_rel))
+            queue = q;
+        else
+            delete q;
+    }
+
+    queue->Push(std::move(chain));
+
+    // only the first sender wakes up the loop
+    if (!outboundScheduled_.exchange(true, std::memory_order_acq_rel)) {
+        auto self = std::static_pointer_cast<Connection>(shared_from_this());
+        loop_->Execute([self]() {
+            self->_FlushOutbound();
+        });
+    }
+
+    return true;
+}
+
+void Connection::_FlushOutbound() {
+    assert (loop_->InThisLoop());
+
+    // senders after this will schedule again
+    outboundScheduled_.exchange(false, std::memory_order_acq_rel);
+
+    auto queue = outbound_.load(std::memory_order_acquire);
+    BufferChain all;
+    BufferChain chain;
+    while (queue->Pop(chain))
+        all.Append(std::move(chain));
+
+    if (!all.Empty())
+        SendPacket(std::move(all)); // one writev
+}
+
+bool Connection::SendPacket(const void* data, std::size_t size) {
+    ANANAS_DEFER {
+        _CheckWaterMarks();
+    };
+
+    assert (loop_->InThisLoop());
+
+    if (size == 0)
+        return true;
+
+    if (state_ != State::eS_Connected &&
+        state_ != State::eS_CloseWaitWrite)
+        return false;
+
+    if (_QueueIfPending(data, size))
+        return true;
+
+    size_t sent = 0;
+    if (!_SendDirectly(data, size, sent))
+        return false;
+
+    if (sent < size)
+        sendBuf_.Append((const char*)data + sent, size - sent);
+
+    return true;
+}
+
+bool Connection::SendPacket(const std::string& data) {
+    return SendPacket(data.data(), data.size());
+}
+
+bool Connection::SendPacket(const Buffer& data) {
+    return SendPacket(const_cast<Buffer&>(data).ReadAddr(), data.ReadableSize());
+}
+
+bool Connection::SendPacket(Buffer&& buf) {
+    ANANAS_DEFER {
+        _CheckWaterMarks();
+    };
+
+    assert (loop_->InThisLoop());
+
+    if (buf.IsEmpty())
+        return true;
+
+    if (state_ != State::eS_Connected &&
+        state_ != State::eS_CloseWaitWrite)
+        return false;
+
+    if (_QueueIfPending(std::move(buf)))
+        return true;
+
+    if (zeroCopyThreshold_ && buf.ReadableSize() >= zeroCopyThreshold_)
+        return SendPacket(BufferChain(std::move(buf)));
+
+    size_t sent = 0;
+    if (!_SendDirectly(buf.ReadAddr(), buf.ReadableSize(), sent))
+        return false;
+
+    if (sent < buf.ReadableSize()) {
+        buf.Consume(sent);
+        sendBuf_.Append(std::move(buf));
+    }
+
+    return true;
+}
+
+bool Connection::SendPacket(std::string&& data) {
+    ANANAS_DEFER {
+        _CheckWaterMarks();
+    };
+
+    assert (loop_->InThisLoop());
+
+    if (data.empty())
+        return true;
+
+    if (state_ != State::eS_Connected &&
+        state_ != State::eS_CloseWaitWrite)
+        return false;
+
+    if (_QueueIfPending(std::move(data)))
+        return true;
+
+    if (zeroCopyThreshold_ && data.size() >= zeroCopyThreshold_) {
+        BufferChain chain;
+        chain.Append(std::move(data));
+        return SendPacket(std::move(chain));
+    }
+
+    size_t sent = 0;
+    if (!_SendDirectly(data.data(), data.size(), sent))
+        return false;
+
+    if (sent < data.size()) {
+        BufferChain left;
+        left.Append(std::move(data));
+        left.Consume(sent);
+        sendBuf_.Append(std::move(left));
+    }
+
+    return true;
+}
+
+// iovec for writev
+namespace {
+
+int WriteV(int sock, const std::vector<iovec>& buffers) {
+    const int kIOVecCount = 64; // be care of IOV_MAX
+
+    size_t sentVecs = 0;
+    size_t sentBytes = 0;
+    while (sentVecs < buffers.size()) {
+        const int vc = std::min<int>(buffers.size() - sentVecs, kIOVecCount);
+
+        int expectBytes = 0;
+        for (size_t i = sentVecs; i < sentVecs + vc; ++ i) {
+            expectBytes += static_cast<int>(buffers[i].iov_len);
+        }
 
         assert (expectBytes > 0);
+#if defined(MSG_MORE)
+        // more parts follow, don't push partial frame
+        msghdr msg {};
+        msg.msg_iov = const_cast<iovec*>(&buffers[sentVecs]);
+        msg.msg_iovlen = vc;
+        const int flags = (sentVecs + vc < buffers.size()) ? MSG_MORE : 0;
+        int bytes = static_cast<int>(::sendmsg(sock, &msg, flags));
+#else
         int bytes = static_cast<int>(::writev(sock, &buffers[sentVecs], vc));
+#endif
         assert (bytes != 0);
 
         if (kError == bytes) {
@@ -380,34 +1653,12 @@ int WriteV(int sock, const std::vector<iovec>& buffers) {
     return sentBytes;
 }
 
-void ConsumeBufferVectors(BufferVector& buffers, size_t toSkippedBytes) {
-    size_t skippedVecs = 0;
-    for (auto& e : buffers) {
-        assert (e.ReadableSize() > 0);
-
-        if (toSkippedBytes >= e.ReadableSize()) {
-            toSkippedBytes -= e.ReadableSize();
-            ++ skippedVecs;
-        } else {
-            if (toSkippedBytes > 0) {
-                e.Consume(toSkippedBytes);
-                buffers.totalBytes -= toSkippedBytes;
-            }
-
-            break;
-        }
-    }
-
-    while (skippedVecs-- > 0)
-        buffers.Pop();
-}
-
-void CollectBuffer(const std::vector<iovec>& buffers, size_t skipped, BufferVector& dst) {
+void CollectBuffer(const std::vector<iovec>& buffers, size_t skipped, BufferChain& dst) {
     for (auto e : buffers) {
         if (skipped >= e.iov_len) {
             skipped -= e.iov_len;
         } else {
-            dst.Push((char*)e.iov_base + skipped, e.iov_len - skipped);
+            dst.Append((char*)e.iov_base + skipped, e.iov_len - skipped);
 
             if (skipped != 0)
                 skipped = 0;
@@ -417,34 +1668,195 @@ void CollectBuffer(const std::vector<iovec>& buffers, size_t skipped, BufferVect
 
 } // end namespace
 
-bool Connection::SendPacket(const BufferVector& data) {
+bool Connection::SendFile(int fd, off_t offset, std::size_t len) {
+    ANANAS_DEFER {
+        _CheckWaterMarks();
+    };
+
+    assert (loop_->InThisLoop());
+
+    if (len == 0)
+        return true;
+
     if (state_ != State::eS_Connected &&
-            state_ != State::eS_CloseWaitWrite)
+        state_ != State::eS_CloseWaitWrite)
         return false;
 
-    SliceVector s;
-    for (const auto& d : data) {
-        s.PushBack(const_cast<Buffer&>(d).ReadAddr(), d.ReadableSize());
+    int dupfd = ::dup(fd);
+    if (dupfd == kInvalid) {
+        ANANAS_ERR << localSock_ << " SendFile dup failed " << errno;
+        return false;
     }
 
-    return SendPacket(s);
-}
+    // file must be sent after the batched packets
+    if (!batchSendBuf_.Empty()) {
+        if (!_HasPendingSend())
+            _Modify(_ReadEvents() | eET_Write);
 
-bool Connection::SendPacket(const SliceVector& slices) {
-    if (slices.Empty())
+        sendBuf_.Append(std::move(batchSendBuf_));
+    }
+
+    // bytes before file are corked, to be sent in full frames with file
+    _SetCork(true);
+
+    const bool pending = _HasPendingSend();
+    sendFiles_.push_back(FileSegment {dupfd, offset, len, BufferChain(), std::vector<int>()});
+    if (pending)
         return true;
 
-    if (!sendBuf_.Empty()) {
-        for (const auto& e : slices) {
-            sendBuf_.Push(e.data, e.len);
+    if (!_SendFileSegment()) {
+        Shutdown(ShutdownMode::eSM_Both);
+        state_ = State::eS_Error;
+        _Modify(eET_Write);
+        return false;
+    }
+
+    if (sendFiles_.front().len > 0) {
+        _Modify(_ReadEvents() | eET_Write);
+    } else {
+        ::close(dupfd);
+        sendFiles_.pop_front();
+        _SetCork(false);
+
+        if (callbacks_->onWriteComplete)
+            callbacks_->onWriteComplete(this);
+    }
+
+    return true;
+}
+
+bool Connection::SendFds(const int* fds, std::size_t count, const void* data, std::size_t len) {
+    ANANAS_DEFER {
+        _CheckWaterMarks();
+    };
+
+    assert (loop_->InThisLoop());
+
+    if (count == 0)
+        return SendPacket(data, len);
+
+    if (len == 0) {
+        ANANAS_ERR << localSock_ << " SendFds needs at least one byte";
+        return false;
+    }
+
+    if (shm_) {
+        ANANAS_ERR << localSock_ << " SendFds is not supported by shared memory";
+        return false;
+    }
+
+    if (state_ != State::eS_Connected &&
+        state_ != State::eS_CloseWaitWrite)
+        return false;
+
+    std::vector<int> dupfds;
+    dupfds.reserve(count);
+    for (std::size_t i = 0; i < count; ++ i) {
+        int dupfd = ::dup(fds[i]);
+        if (dupfd == kInvalid) {
+            ANANAS_ERR << localSock_ << " SendFds dup failed " << errno;
+            for (int fd : dupfds)
+                ::close(fd);
+            return false;
         }
 
+        dupfds.push_back(dupfd);
+    }
+
+    // fds must be sent after the batched packets
+    if (!batchSendBuf_.Empty()) {
+        if (!_HasPendingSend())
+            _Modify(_ReadEvents() | eET_Write);
+
+        sendBuf_.Append(std::move(batchSendBuf_));
+    }
+
+    const bool pending = _HasPendingSend();
+    sendFiles_.push_back(FileSegment {kInvalid, 0, 0, BufferChain(), std::move(dupfds)});
+    sendFiles_.back().after.Append(data, len);
+    if (pending)
+        return true;
+
+    if (!_SendFdSegment()) {
+        Shutdown(ShutdownMode::eSM_Both);
+        state_ = State::eS_Error;
+        _Modify(eET_Write);
+        return false;
+    }
+
+    if (!sendFiles_.front().passFds.empty()) {
+        _Modify(_ReadEvents() | eET_Write);
+        return true;
+    }
+
+    // the rest of data
+    sendBuf_ = std::move(sendFiles_.front().after);
+    sendFiles_.pop_front();
+    if (!sendBuf_.Empty())
+        _Modify(_ReadEvents() | eET_Write);
+    else if (callbacks_->onWriteComplete)
+        callbacks_->onWriteComplete(this);
+
+    return true;
+}
+
+bool Connection::SendPacket(const BufferChain& data) {
+    // only reference counts are copied
+    return SendPacket(BufferChain(data));
+}
+
+bool Connection::SendPacket(BufferChain&& chain) {
+    ANANAS_DEFER {
+        _CheckWaterMarks();
+    };
+
+    if (state_ != State::eS_Connected &&
+            state_ != State::eS_CloseWaitWrite)
+        return false;
+
+    if (chain.Empty())
+        return true;
+
+    // take the blocks whatever happens
+    BufferChain data(std::move(chain));
+    if (_QueueIfPending(std::move(data)))
         return true;
+
+    return _SendChain(std::move(data));
+}
+
+bool Connection::_SendChain(BufferChain&& data) {
+    int ret = _WriteChain(data);
+    if (ret == kError) {
+        Shutdown(ShutdownMode::eSM_Both);
+        state_ = State::eS_Error;
+        _Modify(eET_Write);
+        return false;
     }
 
-    if (processingRead_ && batchSend_) {
+    if (!data.Empty()) {
+        // keep the left blocks, no copy
+        sendBuf_.Append(std::move(data));
+        _Modify(_ReadEvents() | eET_Write);
+    } else {
+        if (callbacks_->onWriteComplete)
+            callbacks_->onWriteComplete(this);
+    }
+
+    return true;
+}
+
+bool Connection::SendPacket(const SliceVector& slices) {
+    ANANAS_DEFER {
+        _CheckWaterMarks();
+    };
+
+    if (slices.Empty())
+        return true;
+
+    if (_HasPendingSend() || _IsBatching()) {
         for (const auto& e : slices) {
-            batchSendBuf_.PushData(e.data, e.len);
+            _QueueIfPending(e.data, e.len);
         }
 
         return true;
@@ -464,11 +1876,11 @@ bool Connection::SendPacket(const SliceVector& slices) {
         expectSend += e.len;
     }
 
-    int ret = WriteV(localSock_, iovecs);
+    int ret = _WriteV(iovecs);
     if (ret == kError) {
         Shutdown(ShutdownMode::eSM_Both);
         state_ = State::eS_Error;
-        loop_->Modify(eET_Write, shared_from_this());
+        _Modify(eET_Write);
         return false;
     }
 
@@ -477,10 +1889,10 @@ bool Connection::SendPacket(const SliceVector& slices) {
     size_t alreadySent = static_cast<size_t>(ret);
     if (alreadySent < expectSend) {
         CollectBuffer(iovecs, alreadySent, sendBuf_);
-        loop_->Modify(eET_Read | eET_Write, shared_from_this());
+        _Modify(_ReadEvents() | eET_Write);
     } else {
-        if (onWriteComplete_)
-            onWriteComplete_(this);
+        if (callbacks_->onWriteComplete)
+            callbacks_->onWriteComplete(this);
     }
 
     return true;
@@ -490,28 +1902,122 @@ void Connection::SetBatchSend(bool batch) {
     batchSend_ = batch;
 }
 
+bool Connection::SetRingRecvBuffer(std::size_t capacity) {
+    assert (loop_->InThisLoop());
+
+    if (recvRing_)
+        return true;
+
+    std::unique_ptr<RingBuffer> ring(new RingBuffer);
+    if (!ring->Init(capacity))
+        return false;
+
+    // move the unconsumed bytes
+    if (!recvBuf_.IsEmpty()) {
+        if (ring->PushData(recvBuf_.ReadAddr(), recvBuf_.ReadableSize()) == 0)
+            return false;
+    }
+
+    Buffer().Swap(recvBuf_); // free memory
+    recvRing_ = std::move(ring);
+    return true;
+}
+
+void Connection::SetSharedRecvBuffer(bool shared) {
+    sharedRecv_ = shared;
+}
+
+void Connection::SetSendWaterMarks(std::size_t high, std::size_t low, HighWaterPolicy policy) {
+    assert (high == 0 || low < high);
+
+    highWaterMark_ = high;
+    lowWaterMark_ = low;
+    highWaterPolicy_ = policy;
+}
+
+void Connection::SetOnHighWaterMark(std::function<void (Connection* , std::size_t )> cb) {
+    _MutableCallbacks().onHighWaterMark = std::move(cb);
+}
+
+void Connection::SetOnLowWaterMark(std::function<void (Connection* )> cb) {
+    _MutableCallbacks().onLowWaterMark = std::move(cb);
+}
+
+void Connection::AddUpstream(const std::shared_ptr<Connection>& upstream) {
+    assert (upstream.get() != this);
+    upstreams_.push_back(upstream);
+}
+
+std::size_t Connection::TotalPendingSendBytes() {
+    return s_pendingSendBytes.load(std::memory_order_relaxed);
+}
+
+std::atomic<std::size_t> Connection::s_pendingSendBytes {0};
+
+bool Connection::SetZeroCopyThreshold(std::size_t bytes) {
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+    if (bytes > 0 && zeroCopyThreshold_ == 0) {
+        int on = 1;
+        if (::setsockopt(localSock_, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof on) != 0) {
+            ANANAS_WRN << localSock_ << " SO_ZEROCOPY not supported " << errno;
+            return false;
+        }
+    }
+
+    zeroCopyThreshold_ = bytes;
+    return true;
+#else
+    return bytes == 0;
+#endif
+}
+
+std::size_t Connection::ZeroCopyPendingBytes() const {
+    std::size_t bytes = 0;
+    for (const auto& e : zeroCopySends_)
+        bytes += e.data.TotalBytes();
+
+    return bytes;
+}
+
+std::shared_ptr<Connection> Connection::Create(EventLoop* loop) {
+    return std::allocate_shared<Connection>(PoolAllocator<Connection>(), loop);
+}
+
+void Connection::SetCallbacks(std::shared_ptr<ConnectionCallbacks> callbacks) {
+    assert (callbacks);
+    callbacks_ = std::move(callbacks);
+}
+
+ConnectionCallbacks& Connection::_MutableCallbacks() {
+    // copy on write, the table may be shared by connections
+    if (callbacks_.use_count() != 1)
+        callbacks_ = std::allocate_shared<ConnectionCallbacks>(PoolAllocator<ConnectionCallbacks>(), *callbacks_);
+
+    return *callbacks_;
+}
+
 void Connection::SetOnConnect(std::function<void (Connection* )> cb) {
-    onConnect_ = std::move(cb);
+    _MutableCallbacks().onConnect = std::move(cb);
 }
 
 void Connection::SetOnDisconnect(std::function<void (Connection* )> cb) {
-    onDisconnect_ = std::move(cb);
+    _MutableCallbacks().onDisconnect = std::move(cb);
 }
 
 void Connection::SetOnMessage(TcpMessageCallback cb) {
-    onMessage_ = std::move(cb);
+    _MutableCallbacks().onMessage = std::move(cb);
 }
 
 void Connection::_OnConnect() {
     if (state_ != State::eS_Connected)
         return;
 
-    if (onConnect_)
-        onConnect_(this);
+    if (callbacks_->onConnect)
+        callbacks_->onConnect(this);
 }
 
 void Connection::SetOnWriteComplete(TcpWriteCompleteCallback wccb) {
-    onWriteComplete_ = std::move(wccb);
+    _MutableCallbacks().onWriteComplete = std::move(wccb);
 }
 
 void Connection::SetMinPacketSize(size_t s) {
@@ -526,5 +2032,43 @@ size_t Connection::GetMinPacketSize() const {
     return minPacketSize_;
 }
 
+StringView Connection::PeekRecvBuffer() const {
+    if (_RecvReadableSize() == 0)
+        return StringView();
+
+    return StringView(_RecvReadAddr(), _RecvReadableSize());
+}
+
+void Connection::ConsumeRecvBuffer(std::size_t bytes) {
+    assert (bytes <= _RecvReadableSize());
+    if (bytes == 0)
+        return;
+
+    _RecvConsume(bytes);
+    if (!recvRing_ && !scratch_ && recvBuf_.IsEmpty()) {
+        if (sharedRecv_)
+            Buffer().Swap(recvBuf_);
+        else
+            recvBuf_.Shrink();
+    }
+    if (recvFullPaused_ && _RecvReadableSize() < maxRecvBuf_) {
+        recvFullPaused_ = false;
+        _ResumeRead();
+    }
+}
+
+std::size_t Connection::PendingSendBytes() const {
+    std::size_t bytes = sendBuf_.TotalBytes() + batchSendBuf_.TotalBytes();
+    for (const auto& f : sendFiles_)
+        bytes += f.len + f.after.TotalBytes();
+
+    return bytes;
+}
+
+bool Connection::IsWritable() const {
+    return state_ == State::eS_Connected ||
+           state_ == State::eS_CloseWaitWrite;
+}
+
 } // end namespace ananas
 
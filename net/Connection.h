@@ -3,12 +3,22 @@
 #define BERT_CONNECTION_H
 
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
 #include <string>
 
 #include "Socket.h"
 #include "Poller.h"
 #include "Typedefs.h"
+#include "TimeoutWheel.h"
 #include "ananas/util/Buffer.h"
+#include "ananas/util/MpscQueue.h"
+#include "ananas/util/RingBuffer.h"
+#include "ananas/util/StringView.h"
 
 ///@file Connection.h
 namespace ananas {
@@ -16,6 +26,7 @@ namespace ananas {
 namespace internal {
 class Acceptor;
 class Connector;
+class ShmTransport;
 }
 
 enum class ShutdownMode {
@@ -24,6 +35,33 @@ enum class ShutdownMode {
     eSM_Write,
 };
 
+///@brief What to do when send buffer reaches high water mark
+enum class HighWaterPolicy {
+    eNotify,         // only callbacks
+    ePauseUpstream,  // stop reading upstreams until low water mark
+    eClose,          // drop the data and close the slow peer
+};
+
+enum class TimeoutType {
+    eIdle,   // no read and no write
+    eRead,   // no read
+    eWrite,  // pending send bytes make no progress
+};
+
+///@brief Callbacks of connection
+///
+/// The table can be shared by all connections of a listener, see
+/// Connection::SetCallbacks. SetOnXXX copies it on write.
+struct ConnectionCallbacks {
+    std::function<void (Connection* )> onConnect;
+    std::function<void (Connection* )> onDisconnect;
+    TcpMessageCallback onMessage;
+    TcpWriteCompleteCallback onWriteComplete;
+    std::function<void (Connection* , std::size_t pending)> onHighWaterMark;
+    std::function<void (Connection* )> onLowWaterMark;
+    std::function<void (Connection* , TimeoutType )> onTimeout;
+};
+
 ///@brief Abstract for stream socket
 class Connection : public internal::Channel {
 public:
@@ -75,10 +113,24 @@ public:
     ///
     /// NOT thread-safe
     bool SendPacket(const Buffer& buf);
-    ///@brief Send vector bytes to network
+    ///@brief Send bytes to network, take the memory of buf
+    ///
+    /// If can't be sent at once, buf is adopted to send queue without copy.
+    /// NOT thread-safe
+    bool SendPacket(Buffer&& buf);
+    ///@brief Send bytes to network, take the memory of data
+    ///
+    /// NOT thread-safe
+    bool SendPacket(std::string&& data);
+    ///@brief Send buffer chain to network
+    ///
+    /// The blocks are shared, not copied, if can't be sent at once.
+    /// NOT thread-safe
+    bool SendPacket(const BufferChain& datum);
+    ///@brief Send buffer chain to network, take its blocks
     ///
     /// NOT thread-safe
-    bool SendPacket(const BufferVector& datum);
+    bool SendPacket(BufferChain&& datum);
     ///@brief Send vector bytes to network
     ///
     /// NOT thread-safe
@@ -86,9 +138,70 @@ public:
 
     ///@brief Send bytes to network
     ///
-    /// Thread-safe
+    /// Thread-safe, bytes from other threads are pushed to a lock-free queue,
+    /// the first push schedules the loop to send all of them by one writev.
     bool SafeSend(const void* data, std::size_t len);
     bool SafeSend(const std::string& data);
+    ///@brief Send bytes to network, take the memory of buf
+    ///
+    /// Thread-safe, buf is moved to the loop of this connection without copy
+    bool SafeSend(Buffer&& buf);
+    bool SafeSend(std::string&& data);
+
+    ///@brief Send file content to network by sendfile, no copy to user space
+    ///
+    /// The file segment is queued with other packets in order, fd is dup-ed,
+    /// so caller can close fd after return.
+    /// NOT thread-safe
+    bool SendFile(int fd, off_t offset, std::size_t len);
+
+    ///@brief Pass file descriptors to peer by SCM_RIGHTS, unix socket only
+    ///
+    /// fds are dup-ed and sent with the first byte of data, so data must not
+    /// be empty. Queued with other packets in order.
+    /// NOT thread-safe
+    bool SendFds(const int* fds, std::size_t count, const void* data, std::size_t len);
+    ///@brief Receive file descriptors by recvmsg, unix socket only
+    ///
+    /// Should be enabled before data arrives, eg. in new connection callback.
+    void SetFdPassing(bool enable) {
+        fdPassing_ = enable;
+    }
+    ///@brief Take the received fds in arrival order, caller owns them
+    ///
+    /// fds arrive with the bytes they were sent with, so take them in
+    /// message callback. fds not taken are closed with the connection.
+    std::vector<int> TakeReceivedFds();
+
+    ///@brief Move the byte stream to shared memory rings, unix socket only
+    ///
+    /// Client side, call it in onConnect before sending anything, the peer
+    /// must call AcceptShm. The memfd and eventfds are passed over the socket,
+    /// then bytes go through the rings without syscall when both sides are
+    /// busy. onMessage_ sees the bytes in the ring without copy, unless the
+    /// message is larger than the ring. The socket only detects close.
+    /// 0 ringSize means ShmTransport::kDefaultRingSize.
+    bool ConnectShm(std::size_t ringSize = 0);
+    ///@brief Wait for the rings from peer's ConnectShm, server side
+    ///
+    /// Should be called before data arrives, eg. in new connection callback.
+    void AcceptShm();
+    ///@brief Is the byte stream in shared memory
+    bool IsShm() const {
+        return shm_ != nullptr;
+    }
+
+    ///@brief Use MSG_ZEROCOPY for owned data not less than bytes
+    ///
+    ///    Buffer&&, std::string&&, BufferChain and queued data are sent
+    ///    without copy to kernel, the memory is held until the completion
+    ///    arrives at socket error queue, even after the connection is
+    ///    destroyed, see `_LingerZeroCopy`. Only worth for large payloads,
+    ///    because page pinning and notification are not free.
+    ///    0 disables it. Return false if the system doesn't support it.
+    bool SetZeroCopyThreshold(std::size_t bytes);
+    ///@brief Bytes sent by MSG_ZEROCOPY but not completed yet
+    std::size_t ZeroCopyPendingBytes() const;
 
     ///@brief Something internal.
     ///
@@ -101,6 +214,46 @@ public:
     ///    one time, you should call SetBatchSend(false)
     void SetBatchSend(bool batch);
 
+    ///@brief Receive into a mirrored ring buffer instead of Buffer
+    ///
+    ///    Buffer memmoves unread bytes to front when tail space runs out,
+    ///    which is costly for large pipelined stream. RingBuffer never moves
+    ///    data, and onMessage_ still sees continuous bytes.
+    ///    Should be called in loop thread, usually in onConnect callback.
+    ///    Return false if the system doesn't support it, Buffer is still used.
+    bool SetRingRecvBuffer(std::size_t capacity = RingBuffer::kDefaultSize);
+
+    ///@brief Receive into the scratch buffer of loop
+    ///
+    ///    Only the bytes not consumed by onMessage_, usually a partial packet,
+    ///    are copied to the buffer of this connection, so idle connections
+    ///    hold no receive buffer. Good for huge number of idle connections.
+    ///    Ignored if ring receive buffer is set.
+    void SetSharedRecvBuffer(bool shared);
+
+    ///@brief Stop reading from socket, no more onMessage_ until ResumeRead
+    ///
+    ///    Should be called in loop thread.
+    void PauseRead();
+    ///@brief Resume reading, the buffered bytes are delivered again
+    ///
+    ///    Also resumes reading paused by full receive buffer.
+    void ResumeRead();
+    ///@brief Paused by user, full receive buffer or send water mark of downstream
+    bool IsReadPaused() const;
+    ///@brief Bound the receive buffer, 0 means no limit
+    ///
+    ///    When onMessage_ can't consume the full buffer, reading is paused
+    ///    until ResumeRead or ConsumeRecvBuffer, so the peer is throttled by TCP.
+    void SetMaxRecvBufferSize(std::size_t size);
+
+    ///@brief Create connection from the pool of this thread, it's recycled
+    static std::shared_ptr<Connection> Create(EventLoop* loop);
+
+    ///@brief Share the callback table, saves memory of many connections
+    ///
+    ///    Do not call it in the callbacks.
+    void SetCallbacks(std::shared_ptr<ConnectionCallbacks> callbacks);
     ///@brief Callback when connection established.
     void SetOnConnect(std::function<void (Connection* )> cb);
     ///@brief Callback when connection disconnected, usually for recycle resourse
@@ -110,6 +263,32 @@ public:
     ///@brief Callback when send data without EAGAIN, kernel sendbuffer is enough
     void SetOnWriteComplete(TcpWriteCompleteCallback wccb);
 
+    ///@brief Bound the pending send bytes of slow peer
+    ///
+    ///    onHighWaterMark is called when pending bytes reach high, then
+    ///    policy is applied, onLowWaterMark is called when they drop to low.
+    ///    high 0 disables it.
+    void SetSendWaterMarks(std::size_t high, std::size_t low,
+                           HighWaterPolicy policy = HighWaterPolicy::eNotify);
+    void SetOnHighWaterMark(std::function<void (Connection* , std::size_t pending)> cb);
+    void SetOnLowWaterMark(std::function<void (Connection* )> cb);
+    ///@brief The connection which produces data for this connection, eg. proxy
+    ///
+    /// Reading of upstream is paused by ePauseUpstream policy.
+    void AddUpstream(const std::shared_ptr<Connection>& upstream);
+    ///@brief Pending send bytes of all connections, for monitor
+    static std::size_t TotalPendingSendBytes();
+
+    ///@brief Timeouts checked by the wheel of loop, 0 disables it
+    ///
+    ///    The resolution is TimeoutWheel::kTickPeriod, activity only stores
+    ///    a tick. Each timeout fires once: onTimeout is called if set, else
+    ///    the connection is closed. Should be called in loop thread.
+    void SetIdleTimeout(std::chrono::milliseconds timeout);
+    void SetReadTimeout(std::chrono::milliseconds timeout);
+    void SetWriteTimeout(std::chrono::milliseconds timeout);
+    void SetOnTimeout(std::function<void (Connection* , TimeoutType )> cb);
+
     ///@brief Set user's context pointer
     void SetUserData(std::shared_ptr<void> user);
 
@@ -124,6 +303,19 @@ public:
     ///@brief Get the min size of your business packet
     size_t GetMinPacketSize() const;
 
+    ///@brief Pull style read, eg. for coroutine
+    ///
+    /// Return the received bytes which are not consumed yet, without copy.
+    /// The view is valid until next read event or ConsumeRecvBuffer.
+    /// Bytes are kept in buffer when onMessage_ returns 0.
+    StringView PeekRecvBuffer() const;
+    ///@brief Discard bytes from the head of receive buffer
+    void ConsumeRecvBuffer(std::size_t bytes);
+    ///@brief Bytes buffered in this connection, not sent to kernel yet
+    std::size_t PendingSendBytes() const;
+    ///@brief Can we still send data
+    bool IsWritable() const;
+
 private:
     enum State {
         eS_None,
@@ -137,8 +329,74 @@ private:
 
     friend class internal::Acceptor;
     friend class internal::Connector;
+    friend class EventLoop;
+    friend class internal::TimeoutWheel;
     void _OnConnect();
+    ConnectionCallbacks& _MutableCallbacks();
     int _Send(const void* data, size_t len);
+    // Return false if error, sent is the bytes sent
+    bool _SendDirectly(const void* data, size_t len, size_t& sent);
+    // Return true if data is queued after pending bytes or batched
+    template <typename... Args>
+    bool _QueueIfPending(Args&&... args);
+    bool _IsBatching() const;
+    // Send batched packets
+    void _FlushBatch();
+    bool _SendChain(BufferChain&& data);
+    // SafeSend from other threads
+    bool _PushOutbound(BufferChain&& chain);
+    void _FlushOutbound();
+
+    // Return true if there are bytes or files not sent to kernel
+    bool _HasPendingSend() const;
+    void _ClearPendingSend();
+    // Return false if error
+    bool _SendFileSegment();
+    // Send fds with the first bytes after them
+    bool _SendFdSegment();
+    // TCP_CORK while files are queued, no-op for unix socket
+    void _SetCork(bool enable);
+    // recv, or recvmsg if fd passing
+    int _Recv(char* buf, std::size_t len);
+    // Send and consume chain, return bytes sent or kError
+    int _WriteChain(BufferChain& chain);
+
+    // Shared memory transport
+    void _Modify(int events);
+    int _WriteV(const std::vector<iovec>& iovecs);
+    int _ShmWrite(const iovec* iov, std::size_t count);
+    ssize_t _ShmReadFile(int fd, off_t offset, std::size_t len);
+    // Return -1 if bad hello, 0 if hello is not complete
+    int _AcceptShm();
+    bool _StartShm();
+    bool _HandleShmReadEvent();
+    void _ProcessShmRing();
+    void _OnShmDoorbell();
+
+    // Flow control
+    int _ReadEvents() const;
+    void _PauseRead();
+    void _ResumeRead();
+    void _CheckWaterMarks();
+    void _ForEachUpstream(void (Connection::*f)());
+    // Resume upstreams paused by me and forget them, when I'm closing
+    void _ReleaseUpstreams();
+    // Shutdown without waiting pending data
+    void _ForceClose();
+
+    // Timeouts, return next deadline or 0
+    void _ArmTimeouts(bool restart = false);
+    internal::TimeoutWheel::Tick _NextTimeout() const;
+    internal::TimeoutWheel::Tick _CheckTimeouts(internal::TimeoutWheel::Tick now);
+
+    // Receive buffer, Buffer or RingBuffer
+    char* _RecvWriteAddr(std::size_t& writable);
+    void _RecvProduce(std::size_t bytes);
+    const char* _RecvReadAddr() const;
+    std::size_t _RecvReadableSize() const;
+    void _RecvConsume(std::size_t bytes);
+    // Return count of consumed messages
+    std::size_t _ProcessRecvBuffer(std::size_t maxMessages);
 
     EventLoop* const loop_;
     State state_ = State::eS_None;
@@ -146,19 +404,81 @@ private:
     size_t minPacketSize_;
 
     Buffer recvBuf_;
-    BufferVector sendBuf_;
+    std::unique_ptr<RingBuffer> recvRing_; // if not null, recvBuf_ is unused
+    bool sharedRecv_ {false};
+    Buffer* scratch_ {nullptr}; // loop's buffer, only valid when processing read
+    BufferChain sendBuf_;
+
+    // File to send after sendBuf_, and the bytes after the file.
+    // Or fds to pass with the first bytes of after, then fd is kInvalid
+    struct FileSegment {
+        int fd;
+        off_t offset;
+        std::size_t len;
+        BufferChain after;
+        std::vector<int> passFds;
+    };
+    std::list<FileSegment> sendFiles_; // list allocates nothing when empty
+    bool corked_ {false};
+
+    // MSG_ZEROCOPY, data is held until completed
+    struct ZeroCopySend {
+        uint32_t id;
+        bool done;
+        BufferChain data;
+    };
+    std::size_t zeroCopyThreshold_ {0};
+    uint32_t zeroCopyId_ {0}; // kernel counts every zero copy send
+    std::list<ZeroCopySend> zeroCopySends_;
+    // Return true if got zero copy completions
+    static bool _ReapZeroCopy(int sock, std::list<ZeroCopySend>& sends);
+    // Keep socket and data until completed, called by destructor
+    void _LingerZeroCopy();
 
     bool processingRead_{false};
     bool batchSend_{true};
-    Buffer batchSendBuf_;
+    bool dirty_{false}; // in loop's dirty list
+    bool readyQueued_{false}; // in loop's ready list
+    bool readMore_{false}; // out of read budget last time
+    std::uint64_t readIteration_{0}; // loop iteration of last read
+    bool messagesLeft_{false}; // buffered messages not delivered for budget
+    BufferChain batchSendBuf_;
+
+    // SafeSend from other threads, created on demand
+    std::atomic<MpscQueue<BufferChain>* > outbound_ {nullptr};
+    std::atomic<bool> outboundScheduled_ {false};
+
+    // Flow control
+    int readPauses_ {0}; // read interest is off if positive
+    bool userPaused_ {false};
+    bool recvFullPaused_ {false};
+    std::size_t maxRecvBuf_ {0};
+    std::size_t highWaterMark_ {0};
+    std::size_t lowWaterMark_ {0};
+    HighWaterPolicy highWaterPolicy_ {HighWaterPolicy::eNotify};
+    bool aboveHighWater_ {false};
+    std::vector<std::weak_ptr<Connection>> upstreams_;
+    std::size_t reportedPending_ {0}; // counted in s_pendingSendBytes
+    static std::atomic<std::size_t> s_pendingSendBytes;
+
+    // Timeouts in ticks of wheel
+    internal::TimeoutWheel::Tick idleTimeout_ {0};
+    internal::TimeoutWheel::Tick readTimeout_ {0};
+    internal::TimeoutWheel::Tick writeTimeout_ {0};
+    internal::TimeoutWheel::Tick lastRead_ {0};
+    internal::TimeoutWheel::Tick lastWrite_ {0};
+    internal::TimeoutWheel::Tick wheelVisit_ {0}; // 0 if not in wheel
 
     SocketAddr peer_;
 
-    std::function<void (Connection* )> onConnect_;
-    std::function<void (Connection* )> onDisconnect_;
+    bool fdPassing_ {false};
+    bool shmAccept_ {false}; // waiting for hello of ConnectShm
+    std::unique_ptr<std::vector<int>> recvFds_; // created on demand
+    // if not null, bytes are in its rings, recvBuf_ holds only a message
+    // larger than the ring
+    std::unique_ptr<internal::ShmTransport> shm_;
 
-    TcpMessageCallback onMessage_;
-    TcpWriteCompleteCallback onWriteComplete_;
+    std::shared_ptr<ConnectionCallbacks> callbacks_; // never null
 
     std::shared_ptr<void> userData_;
 };
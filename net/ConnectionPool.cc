@@ -0,0 +1,284 @@
+#include <cassert>
+#include <stdexcept>
+#include <vector>
+
+#include "ConnectionPool.h"
+#include "Application.h"
+#include "Connection.h"
+#include "EventLoop.h"
+#include "AnanasDebug.h"
+
+namespace ananas {
+
+const DurationMs ConnectionPool::kTickPeriod(200);
+
+ConnectionPool::ConnectionPool(EventLoop* loop, const ConnectionPoolOptions& options) :
+    loop_(loop),
+    options_(options) {
+    assert (options_.maxConns > 0 && options_.minIdle <= options_.maxConns);
+    tickTimer_ = loop_->ScheduleAfterWithRepeat<kForever>(kTickPeriod, [this]() {
+        this->_OnTick();
+    });
+}
+
+ConnectionPool::~ConnectionPool() {
+    loop_->Cancel(tickTimer_);
+
+    // channels are already unregistered if loops are stopped
+    const bool running = !Application::Instance().IsExit();
+    for (auto& kv : peers_) {
+        for (auto& e : kv.second.idle) {
+            if (running && e.conn->IsWritable())
+                e.conn->ActiveClose();
+        }
+
+        for (auto& w : kv.second.waiters)
+            w.promise.SetException(std::make_exception_ptr(std::runtime_error("ConnectionPool destroyed")));
+    }
+}
+
+void ConnectionPool::Prewarm(const SocketAddr& addr) {
+    assert (loop_->InThisLoop());
+
+    auto& peer = peers_[addr];
+    peer.warm = true;
+    _Grow(addr, peer);
+}
+
+Future<Connection* > ConnectionPool::Checkout(const SocketAddr& addr) {
+    assert (loop_->InThisLoop());
+
+    auto& peer = peers_[addr];
+    while (!peer.idle.empty()) {
+        // the most recently used is warm in cache and less likely closed by peer
+        auto conn = std::move(peer.idle.back().conn);
+        peer.idle.pop_back();
+
+        // Checkin may be called in onMessage, before the bytes are consumed
+        if (!_IsHealthy(conn.get()) || !conn->PeekRecvBuffer().Empty()) {
+            if (conn->IsWritable())
+                conn->ActiveClose();
+            continue;
+        }
+
+        Connection* c = conn.get();
+        peer.busy[c] = std::move(conn);
+        return MakeReadyFuture(c);
+    }
+
+    Promise<Connection* > promise;
+    auto fut = promise.GetFuture();
+    peer.waiters.push_back(Waiter {std::move(promise), Clock::now()});
+
+    _Grow(addr, peer);
+    return fut;
+}
+
+void ConnectionPool::Checkin(Connection* conn) {
+    assert (loop_->InThisLoop());
+
+    auto it = peers_.find(conn->Peer());
+    if (it == peers_.end() || !it->second.busy.count(conn)) {
+        ANANAS_WRN << "Checkin connection not from pool " << conn->Peer().ToString();
+        return;
+    }
+
+    auto& peer = it->second;
+    auto sp = std::move(peer.busy[conn]);
+    peer.busy.erase(conn);
+
+    if (!_IsHealthy(conn)) {
+        ANANAS_WRN << "Checkin unhealthy connection, close it " << conn->Peer().ToString();
+        if (conn->IsWritable())
+            conn->ActiveClose();
+
+        _Grow(it->first, peer);
+        return;
+    }
+
+    _Give(peer, std::move(sp));
+}
+
+void ConnectionPool::SetOnDisconnect(std::function<void (Connection* )> cb) {
+    onDisconnect_ = std::move(cb);
+}
+
+std::size_t ConnectionPool::IdleCount(const SocketAddr& addr) const {
+    auto it = peers_.find(addr);
+    return it == peers_.end() ? 0 : it->second.idle.size();
+}
+
+std::size_t ConnectionPool::BusyCount(const SocketAddr& addr) const {
+    auto it = peers_.find(addr);
+    return it == peers_.end() ? 0 : it->second.busy.size();
+}
+
+void ConnectionPool::_Grow(const SocketAddr& addr, Peer& peer) {
+    while (peer.idle.size() + peer.busy.size() + peer.connecting < options_.maxConns) {
+        std::size_t need = peer.waiters.size();
+        if (peer.warm && peer.idle.size() < options_.minIdle)
+            need += options_.minIdle - peer.idle.size();
+
+        if (peer.connecting >= need)
+            break;
+
+        ++ peer.connecting;
+
+        // the fail callback may be called in Connect, or not at all if it
+        // returns false, report failure exactly once
+        auto pending = std::make_shared<bool>(true);
+        std::weak_ptr<ConnectionPool> wself(shared_from_this());
+        bool ok = loop_->Connect(addr,
+                                 [wself, pending](Connection* conn) {
+                                     *pending = false;
+                                     auto self = wself.lock();
+                                     if (self)
+                                         self->_OnNewConnection(conn);
+                                     else
+                                         conn->ActiveClose();
+                                 },
+                                 [wself, pending](EventLoop* , const SocketAddr& peer) {
+                                     if (!*pending)
+                                         return;
+
+                                     *pending = false;
+                                     if (auto self = wself.lock())
+                                         self->_OnConnectFail(peer);
+                                 },
+                                 options_.connectTimeout,
+                                 loop_);
+
+        if (!ok) {
+            if (*pending) {
+                *pending = false;
+                _OnConnectFail(addr);
+            }
+
+            return; // retry in next tick, don't loop forever
+        }
+    }
+}
+
+void ConnectionPool::_OnNewConnection(Connection* conn) {
+    assert (loop_->InThisLoop());
+
+    auto& peer = peers_[conn->Peer()];
+    assert (peer.connecting > 0);
+    -- peer.connecting;
+
+    std::weak_ptr<ConnectionPool> wself(shared_from_this());
+    conn->SetOnDisconnect([wself](Connection* c) {
+        if (auto self = wself.lock())
+            self->_OnDisconnect(c);
+    });
+
+    _Give(peer, std::static_pointer_cast<Connection>(conn->shared_from_this()));
+}
+
+void ConnectionPool::_OnConnectFail(const SocketAddr& addr) {
+    assert (loop_->InThisLoop());
+
+    auto& peer = peers_[addr];
+    assert (peer.connecting > 0);
+    -- peer.connecting;
+
+    // peer is likely down, waiters not covered by other attempts fail at once
+    while (peer.waiters.size() > peer.connecting) {
+        auto promise = std::move(peer.waiters.front().promise);
+        peer.waiters.pop_front();
+        promise.SetException(std::make_exception_ptr(std::runtime_error("Connect failed " + addr.ToString())));
+    }
+}
+
+void ConnectionPool::_OnDisconnect(Connection* conn) {
+    auto it = peers_.find(conn->Peer());
+    if (it == peers_.end())
+        return;
+
+    auto& peer = it->second;
+    for (auto e = peer.idle.begin(); e != peer.idle.end(); ++ e) {
+        if (e->conn.get() == conn) {
+            peer.idle.erase(e);
+            return;
+        }
+    }
+
+    auto b = peer.busy.find(conn);
+    if (b != peer.busy.end()) {
+        // keep it alive in callback
+        auto sp = std::move(b->second);
+        peer.busy.erase(b);
+
+        if (onDisconnect_)
+            onDisconnect_(conn);
+    }
+}
+
+void ConnectionPool::_Give(Peer& peer, std::shared_ptr<Connection>&& conn) {
+    // bytes from peer when idle means the protocol is broken
+    conn->SetOnMessage([](Connection* c, const char* , size_t len) {
+        ANANAS_WRN << "Idle pooled connection got data, close it " << c->Peer().ToString();
+        c->ActiveClose();
+        return len;
+    });
+
+    if (peer.waiters.empty()) {
+        peer.idle.push_back(IdleConn {std::move(conn), Clock::now()});
+        return;
+    }
+
+    auto promise = std::move(peer.waiters.front().promise);
+    peer.waiters.pop_front();
+
+    Connection* c = conn.get();
+    peer.busy[c] = std::move(conn);
+    promise.SetValue(c);
+}
+
+void ConnectionPool::_OnTick() {
+    const auto now = Clock::now();
+
+    // callbacks of promises may checkout new address, don't hold iterator
+    std::vector<SocketAddr> addrs;
+    addrs.reserve(peers_.size());
+    for (const auto& kv : peers_)
+        addrs.push_back(kv.first);
+
+    for (const auto& addr : addrs) {
+        auto& peer = peers_[addr];
+
+        while (!peer.waiters.empty() &&
+               now - peer.waiters.front().since >= options_.checkoutTimeout) {
+            auto promise = std::move(peer.waiters.front().promise);
+            peer.waiters.pop_front();
+            promise.SetException(std::make_exception_ptr(std::runtime_error("Checkout timeout " + addr.ToString())));
+        }
+
+        // the front is the least recently used
+        const std::size_t keep = peer.warm ? options_.minIdle : 0;
+        while (options_.idleTimeout.count() > 0 &&
+               peer.idle.size() > keep &&
+               now - peer.idle.front().since >= options_.idleTimeout) {
+            auto conn = std::move(peer.idle.front().conn);
+            peer.idle.pop_front();
+            if (conn->IsWritable())
+                conn->ActiveClose();
+        }
+
+        // refill the prewarmed, retry failed connects
+        _Grow(addr, peer);
+
+        if (!peer.warm && peer.idle.empty() && peer.busy.empty() &&
+            peer.waiters.empty() && peer.connecting == 0)
+            peers_.erase(addr);
+    }
+}
+
+bool ConnectionPool::_IsHealthy(Connection* conn) {
+    return conn->IsWritable() &&
+           !conn->IsReadPaused() &&
+           conn->PendingSendBytes() == 0;
+}
+
+} // end namespace ananas
+
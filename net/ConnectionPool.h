@@ -0,0 +1,116 @@
+#ifndef BERT_CONNECTIONPOOL_H
+#define BERT_CONNECTIONPOOL_H
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+#include "Socket.h"
+#include "Typedefs.h"
+#include "ananas/util/Timer.h"
+#include "ananas/future/Future.h"
+
+///@file ConnectionPool.h
+namespace ananas {
+
+struct ConnectionPoolOptions {
+    // idle connections kept for a prewarmed address
+    std::size_t minIdle {0};
+    // idle, busy and connecting connections of an address
+    std::size_t maxConns {16};
+    // idle connections above minIdle are closed after it, 0 never
+    DurationMs idleTimeout {DurationMs(60 * 1000)};
+    DurationMs connectTimeout {DurationMs(3000)};
+    // checkout fails if no connection is available after it
+    DurationMs checkoutTimeout {DurationMs(3000)};
+};
+
+///@brief Client connections of one EventLoop, keyed by peer address
+///
+/// Checkout returns an idle connection, or waits for a new one or a
+/// checked in one. Concurrent checkouts share the connect attempts in
+/// flight, and all fail at once if the peer refuses. Connections are
+/// checked for health when checked in and out, idle ones are closed
+/// after idleTimeout, and prewarmed addresses keep minIdle open.
+///
+/// All methods must be called in the loop thread. Must be created by
+/// std::make_shared, callbacks of connections hold it weakly.
+/// Do not set onDisconnect of pooled connections, see SetOnDisconnect.
+class ConnectionPool : public std::enable_shared_from_this<ConnectionPool> {
+public:
+    explicit
+    ConnectionPool(EventLoop* loop, const ConnectionPoolOptions& options = ConnectionPoolOptions());
+    ~ConnectionPool();
+
+    ConnectionPool(const ConnectionPool& ) = delete;
+    void operator= (const ConnectionPool& ) = delete;
+
+    ///@brief Open minIdle connections to addr now and keep them, eg. at startup
+    void Prewarm(const SocketAddr& addr);
+
+    ///@brief Get a connection to addr for exclusive use
+    ///
+    /// The future is ready at once if there is an idle connection.
+    /// Set onMessage of it, then Checkin when the exchange is done.
+    Future<Connection* > Checkout(const SocketAddr& addr);
+    ///@brief Give back the connection from Checkout
+    ///
+    /// It's closed instead of reused if it's broken or has pending send
+    /// bytes, or at next checkout if received bytes are left unconsumed.
+    /// May be called in onMessage of it.
+    void Checkin(Connection* conn);
+
+    ///@brief Called when a checked out connection is closed
+    void SetOnDisconnect(std::function<void (Connection* )> cb);
+
+    std::size_t IdleCount(const SocketAddr& addr) const;
+    std::size_t BusyCount(const SocketAddr& addr) const;
+
+    ///@brief Period of idle eviction, waiter timeout and prewarm retry
+    static const DurationMs kTickPeriod;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct IdleConn {
+        std::shared_ptr<Connection> conn;
+        Clock::time_point since;
+    };
+
+    struct Waiter {
+        Promise<Connection* > promise;
+        Clock::time_point since;
+    };
+
+    struct Peer {
+        std::deque<IdleConn> idle; // the back is the most recently used
+        std::unordered_map<Connection*, std::shared_ptr<Connection>> busy;
+        std::deque<Waiter> waiters;
+        std::size_t connecting {0};
+        bool warm {false};
+    };
+
+    // Connect for waiters and the idle floor, bounded by maxConns
+    void _Grow(const SocketAddr& addr, Peer& peer);
+    void _OnNewConnection(Connection* conn);
+    void _OnConnectFail(const SocketAddr& addr);
+    void _OnDisconnect(Connection* conn);
+    // Hand it to the first waiter, or keep it idle
+    void _Give(Peer& peer, std::shared_ptr<Connection>&& conn);
+    void _OnTick();
+
+    static bool _IsHealthy(Connection* conn);
+
+    EventLoop* const loop_;
+    const ConnectionPoolOptions options_;
+    TimerId tickTimer_;
+    std::unordered_map<SocketAddr, Peer> peers_;
+    std::function<void (Connection* )> onDisconnect_;
+};
+
+} // end namespace ananas
+
+#endif
+
@@ -42,7 +42,7 @@ bool Connector::Connect(const SocketAddr& addr, DurationMs timeout, EventLoop* d
     if (!addr.IsValid())
         return false;
 
-    if (addr.GetIP() == "0.0.0.0") {
+    if (!addr.IsUnix() && addr.GetIP() == "0.0.0.0") {
         ANANAS_ERR << "Why connect to 0.0.0.0";
         return false;
     }
@@ -55,19 +55,28 @@ bool Connector::Connect(const SocketAddr& addr, DurationMs timeout, EventLoop* d
 
     assert (localSock_ == kInvalid);
 
+    sockaddr_storage dst;
+    socklen_t len = addr.ToSockaddr(dst);
+    if (len == 0) {
+        ANANAS_ERR << "Bad address " << addr.ToString();
+        return false;
+    }
+
     peer_ = addr;
-    localSock_ = CreateTCPSocket();
+    localSock_ = addr.IsUnix() ? CreateUnixSocket() : CreateTCPSocket();
     if (localSock_ == kInvalid)
         return false;
 
     dstLoop_ = dstLoop;
 
     SetNonBlock(localSock_);
-    SetNodelay(localSock_);
+    if (!addr.IsUnix())
+        SetNodelay(localSock_);
     SetRcvBuf(localSock_);
     SetSndBuf(localSock_);
 
-    int ret = ::connect(localSock_, (struct sockaddr*)&peer_, sizeof peer_);
+    // unix socket never returns EINPROGRESS, but EAGAIN if backlog is full
+    int ret = ::connect(localSock_, (struct sockaddr*)&dst, len);
     if (ret == 0) {
         _OnSuccess();
         return true;
@@ -155,7 +164,7 @@ void Connector::_OnSuccess() {
     auto func = [loop, connfd, peer, newCb]() {
         assert (loop->InThisLoop());
         // create new conn
-        auto c = std::make_shared<Connection>(loop);
+        auto c = Connection::Create(loop);
         c->Init(connfd, peer);
 
         // register new conn
@@ -1,12 +1,46 @@
 #include <errno.h>
+#include <algorithm>
+#include <cstring>
 #include <memory>
 
 #include "DatagramSocket.h"
 #include "EventLoop.h"
 #include "AnanasDebug.h"
+#include "util/Util.h"
+
+#if defined(__linux__)
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#endif
 
 namespace ananas {
 
+namespace {
+
+#if defined(__linux__)
+// Linux limits of one GSO super-packet
+const std::size_t kMaxGSOSegments = 64;
+const std::size_t kMaxUDPPayload = 65507;
+
+// GRO packet may be as big as 64K, so fewer slots
+const std::size_t kGROSlotSize = 65535;
+const std::size_t kGROSlots = 8;
+
+// Big enough for both UDP_SEGMENT(uint16_t) and UDP_GRO(int)
+const std::size_t kCmsgSpace = CMSG_SPACE(sizeof(int));
+#endif
+
+} // end namespace
+
+const std::size_t DatagramSocket::kBatchSize;
+
 DatagramSocket::DatagramSocket(EventLoop* loop) :
     loop_(loop),
     localSock_(kInvalid),
@@ -32,6 +66,11 @@ bool DatagramSocket::Bind(const SocketAddr* addr) {
 
     SetNonBlock(localSock_);
     SetReuseAddr(localSock_);
+    if (reusePort_ && !ananas::SetReusePort(localSock_)) {
+        ANANAS_ERR << "UDP socket set reuseport failed, errno = " << errno;
+        CloseSocket(localSock_);
+        return false;
+    }
 
     const bool isServer = (addr && addr->IsValid());
     if (isServer) {
@@ -43,6 +82,11 @@ bool DatagramSocket::Bind(const SocketAddr* addr) {
             ANANAS_ERR << "cannot bind udp port " << port;
             return false;
         }
+
+        // same program for the whole group, fallback to kernel hash if failed
+        if (reusePort_ && flowGroups_ > 1 &&
+            !AttachReusePortFlowHash(localSock_, static_cast<uint32_t>(flowGroups_)))
+            ANANAS_WRN << "UDP port " << port << " attach flow hash failed, errno = " << errno;
     } else {
         ; // nothing to do: client UDP
     }
@@ -59,50 +103,231 @@ bool DatagramSocket::Bind(const SocketAddr* addr) {
     return true;
 }
 
+void DatagramSocket::SetMaxPacketSize(std::size_t s) {
+    maxPacketSize_ = s; // arena is rebuilt by next read
+}
+
+bool DatagramSocket::EnableGSO(bool on) {
+#if defined(__linux__)
+    if (!on) {
+        gso_ = false;
+        return true;
+    }
+
+    // probe kernel support, segment size is given by each sendmsg
+    int size = 0;
+    socklen_t len = sizeof size;
+    if (::getsockopt(localSock_, SOL_UDP, UDP_SEGMENT, &size, &len) != 0) {
+        ANANAS_WRN << "UDP fd " << localSock_ << " GSO not supported, errno = " << errno;
+        return false;
+    }
+
+    gso_ = true;
+    return true;
+#else
+    return !on;
+#endif
+}
+
+bool DatagramSocket::EnableGRO(bool on) {
+#if defined(__linux__)
+    int val = on ? 1 : 0;
+    if (::setsockopt(localSock_, SOL_UDP, UDP_GRO, &val, sizeof val) != 0) {
+        ANANAS_WRN << "UDP fd " << localSock_ << " GRO not supported, errno = " << errno;
+        return !on;
+    }
+
+    gro_ = on;
+    return true;
+#else
+    return !on;
+#endif
+}
+
 int DatagramSocket::Identifier() const {
     return localSock_;
 }
 
 
 bool DatagramSocket::HandleReadEvent() {
-    std::unique_ptr<char []> recvbuf(new char[maxPacketSize_]);
+    _PrepareRecv();
+
+    processingRead_ = true;
+    ANANAS_DEFER {
+        processingRead_ = false;
+        if (sendCount_ > 0)
+            _FlushSendQueue();
+    };
+
     while (true) {
-        socklen_t len = sizeof srcAddr_;
+        std::size_t count = 0;
+        if (!_RecvBatch(count))
+            return true;
+
+        if (count == 0)
+            return true; // EAGAIN
+
+        _Deliver();
+
+        if (count < arenaSlots_)
+            return true; // drained
+    }
+
+    return  true;
+}
+
+void DatagramSocket::_PrepareRecv() {
+    std::size_t slotSize = maxPacketSize_;
+    std::size_t slots = kBatchSize;
+#if defined(__linux__)
+    if (gro_) {
+        slotSize = std::max(slotSize, kGROSlotSize);
+        slots = kGROSlots;
+    }
+#endif
+
+    if (recvArena_ && arenaPacketSize_ == slotSize && arenaSlots_ == slots)
+        return;
+
+    arenaPacketSize_ = slotSize;
+    arenaSlots_ = slots;
+    recvArena_.reset(new char[slots * slotSize]);
+    peers_.resize(slots);
+}
+
+bool DatagramSocket::_RecvBatch(std::size_t& count) {
+    count = 0;
+    packets_.clear();
+
+#if defined(__linux__)
+    msgs_.resize(std::max(arenaSlots_, kBatchSize));
+    iovecs_.resize(std::max(arenaSlots_, kBatchSize));
+    cmsgs_.resize(kBatchSize * kCmsgSpace);
+    for (std::size_t i = 0; i < arenaSlots_; ++ i) {
+        iovecs_[i].iov_base = &recvArena_[i * arenaPacketSize_];
+        iovecs_[i].iov_len = arenaPacketSize_;
+
+        auto& hdr = msgs_[i].msg_hdr;
+        hdr = msghdr();
+        hdr.msg_name = &peers_[i];
+        hdr.msg_namelen = sizeof peers_[i];
+        hdr.msg_iov = &iovecs_[i];
+        hdr.msg_iovlen = 1;
+        if (gro_) {
+            hdr.msg_control = &cmsgs_[i * kCmsgSpace];
+            hdr.msg_controllen = kCmsgSpace;
+        }
+    }
+
+    int n;
+    do {
+        n = ::recvmmsg(localSock_, &msgs_[0], arenaSlots_, 0, nullptr);
+    } while (n == kError && EINTR == errno);
+
+    if (n == kError) {
+        if (EAGAIN == errno || EWOULDBLOCK == errno)
+            return true;
+
+        ANANAS_ERR << "UDP fd " << localSock_
+                   << ", HandleRead error, errno = " << errno;
+        return false;
+    }
+
+    for (int i = 0; i < n; ++ i) {
+        const char* data = &recvArena_[i * arenaPacketSize_];
+        std::size_t len = msgs_[i].msg_len;
+
+        // split GRO super-packet
+        std::size_t segment = len;
+        if (gro_) {
+            auto& hdr = msgs_[i].msg_hdr;
+            for (cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+                if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                    int size;
+                    memcpy(&size, CMSG_DATA(cmsg), sizeof size);
+                    if (size > 0)
+                        segment = static_cast<std::size_t>(size);
+                    break;
+                }
+            }
+        }
+
+        do {
+            std::size_t bytes = std::min(segment, len);
+            packets_.push_back(UDPPacket {data, bytes, SocketAddr(peers_[i])});
+            data += bytes;
+            len -= bytes;
+        } while (len > 0);
+    }
+
+    count = static_cast<std::size_t>(n);
+#else
+    for (; count < arenaSlots_; ++ count) {
+        char* data = &recvArena_[count * arenaPacketSize_];
+        socklen_t len = sizeof peers_[count];
         int bytes = ::recvfrom(localSock_,
-                               &recvbuf[0], maxPacketSize_,
+                               data, arenaPacketSize_,
                                0,
-                               (struct sockaddr*)&srcAddr_, &len);
+                               (struct sockaddr*)&peers_[count], &len);
 
         if (kError == bytes && (EAGAIN == errno || EWOULDBLOCK == errno))
-            return true;
+            break;
 
-        if (bytes <= 0) {
+        if (bytes < 0) {
             ANANAS_ERR << "UDP fd " << localSock_
                        << ", HandleRead error : " << bytes
                        << ", errno = " << errno;
-            return true;
+            return count > 0;
         }
 
-        // onMessage_ is void
-        onMessage_(this, &recvbuf[0], bytes);
+        packets_.push_back(UDPPacket {data, static_cast<std::size_t>(bytes), SocketAddr(peers_[count])});
     }
+#endif
 
-    return  true;
+    return true;
+}
+
+void DatagramSocket::_Deliver() {
+    if (packets_.empty())
+        return;
+
+    if (onBatch_) {
+        onBatch_(this, &packets_[0], packets_.size());
+        return;
+    }
+
+    for (const auto& pkt : packets_) {
+        // for reply by SendPacket without dst
+        srcAddr_ = pkt.peer;
+
+        // onMessage_ is void
+        if (onMessage_)
+            onMessage_(this, pkt.data, pkt.len);
+    }
 }
 
 void DatagramSocket::_PutSendBuf(const void* data, size_t size, const SocketAddr* dst) {
-    Package pkg;
+    if (sendCount_ == sendRing_.size()) {
+        // full, grow and make it continuous
+        std::vector<Package> ring(std::max<std::size_t>(kBatchSize, 2 * sendRing_.size()));
+        for (std::size_t i = 0; i < sendCount_; ++ i)
+            ring[i] = std::move(sendRing_[(sendHead_ + i) % sendRing_.size()]);
+
+        sendRing_.swap(ring);
+        sendHead_ = 0;
+    }
+
+    auto& pkg = sendRing_[(sendHead_ + sendCount_) % sendRing_.size()];
     pkg.dst = *dst;
     pkg.data.assign(reinterpret_cast<const char* >(data), size);
-
-    sendList_.emplace_back(std::move(pkg));
+    ++ sendCount_;
 }
 
 int DatagramSocket::_Send(const void* data, size_t size, const SocketAddr& dst) {
     int bytes = ::sendto(localSock_,
                          data, size,
                          0,
-                         (const struct sockaddr*)&dst, sizeof dst);
+                         (const struct sockaddr*)&dst.GetAddr(), sizeof(sockaddr_in));
 
     if (bytes == kError && (EAGAIN == errno || EWOULDBLOCK == errno)) {
         ANANAS_WRN << "send wouldblock";
@@ -119,7 +344,8 @@ bool DatagramSocket::SendPacket(const void* data, size_t size, const SocketAddr*
     if (!dst)
         dst = &srcAddr_;
 
-    if (!sendList_.empty()) {
+    // keep order, or batch the replies
+    if (sendCount_ > 0 || processingRead_) {
         _PutSendBuf(data, size, dst);
         return true;
     }
@@ -127,6 +353,7 @@ bool DatagramSocket::SendPacket(const void* data, size_t size, const SocketAddr*
     int bytes = _Send(data, size, *dst);
     if (bytes == 0) {
         _PutSendBuf(data, size, dst);
+        writing_ = true;
         loop_->Modify(internal::eET_Read | internal::eET_Write, shared_from_this());
         return true;
     } else if (bytes < 0) {
@@ -139,26 +366,133 @@ bool DatagramSocket::SendPacket(const void* data, size_t size, const SocketAddr*
     return true;
 }
 
-bool DatagramSocket::HandleWriteEvent() {
-    while (!sendList_.empty()) {
-        const auto& pkg = sendList_.front();
+void DatagramSocket::_FlushSendQueue() {
+    while (sendCount_ > 0) {
+        const std::size_t cap = sendRing_.size();
+        int sent = 0;
+        std::size_t packets = 1; // of the head message
+
+#if defined(__linux__)
+        // group packets into messages
+        msgPackets_.clear();
+        std::size_t total = 0;
+        while (msgPackets_.size() < kBatchSize && total < sendCount_) {
+            const auto& first = sendRing_[(sendHead_ + total) % cap];
+            const std::size_t segment = first.data.size();
+            std::size_t n = 1;
+            std::size_t bytes = segment;
+            while (gso_ && total + n < sendCount_ && n < kMaxGSOSegments) {
+                const auto& next = sendRing_[(sendHead_ + total + n) % cap];
+                if (next.dst != first.dst ||
+                    next.data.size() > segment ||
+                    bytes + next.data.size() > kMaxUDPPayload)
+                    break;
+
+                ++ n;
+                bytes += next.data.size();
+                if (next.data.size() < segment)
+                    break; // only the last one can be shorter
+            }
+
+            msgPackets_.push_back(n);
+            total += n;
+        }
 
-        int bytes = _Send(pkg.data.data(), pkg.data.size(), pkg.dst);
-        if (bytes == 0) {
-            return true;
-        } else if (bytes > 0) {
-            sendList_.pop_front();
+        msgs_.resize(std::max(msgs_.size(), kBatchSize));
+        iovecs_.resize(std::max(iovecs_.size(), total));
+        cmsgs_.resize(kBatchSize * kCmsgSpace);
+
+        std::size_t idx = 0;
+        for (std::size_t m = 0; m < msgPackets_.size(); ++ m) {
+            auto& first = sendRing_[(sendHead_ + idx) % cap];
+            for (std::size_t i = 0; i < msgPackets_[m]; ++ i) {
+                auto& pkg = sendRing_[(sendHead_ + idx + i) % cap];
+                iovecs_[idx + i].iov_base = &pkg.data[0];
+                iovecs_[idx + i].iov_len = pkg.data.size();
+            }
+
+            auto& hdr = msgs_[m].msg_hdr;
+            hdr = msghdr();
+            hdr.msg_name = const_cast<sockaddr_in*>(&first.dst.GetAddr());
+            hdr.msg_namelen = sizeof(sockaddr_in);
+            hdr.msg_iov = &iovecs_[idx];
+            hdr.msg_iovlen = msgPackets_[m];
+
+            if (msgPackets_[m] > 1) {
+                hdr.msg_control = &cmsgs_[m * kCmsgSpace];
+                hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+
+                cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t segment = static_cast<uint16_t>(first.data.size());
+                memcpy(CMSG_DATA(cmsg), &segment, sizeof segment);
+            }
+
+            idx += msgPackets_[m];
+        }
+
+        sent = ::sendmmsg(localSock_, &msgs_[0], msgPackets_.size(), 0);
+        if (sent == kError) {
+            if (EINTR == errno)
+                continue;
+
+            if (EAGAIN == errno || EWOULDBLOCK == errno) {
+                sent = 0;
+            } else if (msgPackets_[0] > 1) {
+                // eg. EIO if device can not do checksum offload
+                ANANAS_WRN << "UDP fd " << localSock_
+                           << " GSO send failed, disable it, errno = " << errno;
+                gso_ = false;
+                continue;
+            }
+        }
+
+        if (sent > 0) {
+            packets = 0;
+            for (int m = 0; m < sent; ++ m)
+                packets += msgPackets_[m];
         } else {
+            packets = msgPackets_[0];
+        }
+#else
+        const auto& pkg = sendRing_[sendHead_];
+        int bytes = _Send(pkg.data.data(), pkg.data.size(), pkg.dst);
+        sent = bytes < 0 ? kError : (bytes == 0 ? 0 : 1);
+#endif
+
+        if (sent == 0) {
+            // kernel buffer is full
+            if (!writing_) {
+                writing_ = true;
+                loop_->Modify(internal::eET_Read | internal::eET_Write, shared_from_this());
+            }
+            return;
+        }
+
+        if (sent == kError) {
+            const auto& pkg = sendRing_[sendHead_];
             ANANAS_ERR << "Fatal error when send udp to "
                        << pkg.dst.ToString()
                        << ", must skip it";
-            sendList_.pop_front();
         }
+
+        for (std::size_t i = 0; i < packets; ++ i)
+            sendRing_[(sendHead_ + i) % cap].data.clear();
+
+        sendHead_ = (sendHead_ + packets) % cap;
+        sendCount_ -= packets;
     }
 
-    if (sendList_.empty())
+    if (writing_) {
+        writing_ = false;
         loop_->Modify(internal::eET_Read, shared_from_this());
+    }
+}
 
+bool DatagramSocket::HandleWriteEvent() {
+    _FlushSendQueue();
     return true;
 }
 
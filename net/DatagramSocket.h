@@ -2,17 +2,33 @@
 #ifndef BERT_DATAGRAMSOCKET_H
 #define BERT_DATAGRAMSOCKET_H
 
-#include <list>
+#include <memory>
+#include <string>
+#include <vector>
 #include "Socket.h"
 #include "Typedefs.h"
 #include "Poller.h"
 
+#if defined(__linux__)
+#include <sys/socket.h>
+#endif
+
 namespace ananas {
 
 class EventLoop;
 
+///@brief Received datagram, valid only in the callback
+struct UDPPacket {
+    const char* data;
+    std::size_t len;
+    SocketAddr peer;
+};
+
 class DatagramSocket : public internal::Channel {
 public:
+    ///@brief Max packets of one recvmmsg/sendmmsg
+    static const std::size_t kBatchSize = 32;
+
     explicit
     DatagramSocket(EventLoop* loop);
     ~DatagramSocket();
@@ -22,6 +38,12 @@ public:
 
     void SetMaxPacketSize(std::size_t s);
     std::size_t GetMaxPacketSize() const { return maxPacketSize_; }
+    ///@brief Share address with other sockets by SO_REUSEPORT, before Bind
+    ///@param flowGroups If > 1, steer peers by flow hash among so many sockets
+    void SetReusePort(bool on, std::size_t flowGroups = 0) {
+        reusePort_ = on;
+        flowGroups_ = flowGroups;
+    }
     bool Bind(const SocketAddr* addr);
 
     int Identifier() const override;
@@ -29,8 +51,25 @@ public:
     bool HandleWriteEvent() override;
     void HandleErrorEvent() override;
 
+    ///@brief Send datagram
+    ///
+    /// Packets sent in message callbacks are queued, and sent by sendmmsg
+    /// after the received batch is handled.
     bool SendPacket(const void*, size_t, const SocketAddr* = nullptr);
 
+    ///@brief UDP_SEGMENT on send, Linux only
+    ///
+    /// Queued packets to the same peer with the same size(the last one may
+    /// be shorter) are sent as one super-packet, kernel splits it.
+    ///@return false if not supported
+    bool EnableGSO(bool on);
+    ///@brief UDP_GRO on receive, Linux only
+    ///
+    /// Coalesced super-packets are split before callbacks, so the callbacks
+    /// always see the original datagrams.
+    ///@return false if not supported
+    bool EnableGRO(bool on);
+
     const SocketAddr& PeerAddr() const {
         return srcAddr_;
     }
@@ -38,6 +77,10 @@ public:
     void SetMessageCallback(UDPMessageCallback mcb) {
         onMessage_ = std::move(mcb);
     }
+    ///@brief Receive the packets of one recvmmsg at once, instead of onMessage_
+    void SetBatchCallback(UDPBatchCallback bcb) {
+        onBatch_ = std::move(bcb);
+    }
     void SetCreateCallback(UDPCreateCallback ccb) {
         onCreate_ = std::move(ccb);
     }
@@ -45,19 +88,53 @@ public:
 private:
     void _PutSendBuf(const void* data, size_t size, const SocketAddr* dst);
     int _Send(const void* data, size_t size, const SocketAddr& dst);
+    // Receive buffers for kBatchSize packets
+    void _PrepareRecv();
+    // Fill packets_, count is the number of received messages.
+    // Return false if fatal error
+    bool _RecvBatch(std::size_t& count);
+    void _Deliver();
+    // Send queued packets, by sendmmsg if possible
+    void _FlushSendQueue();
 
     EventLoop* const loop_;
     int localSock_;
     std::size_t maxPacketSize_;
     SocketAddr srcAddr_;
 
+    bool reusePort_ {false};
+    std::size_t flowGroups_ {0};
+
+    // Receive arena, reused by every read
+    std::unique_ptr<char []> recvArena_;
+    std::size_t arenaPacketSize_ {0};
+    std::size_t arenaSlots_ {0};
+    std::vector<sockaddr_in> peers_;
+    std::vector<UDPPacket> packets_;
+    bool processingRead_ {false};
+
+    // Ring of send slots, the strings keep their capacity for reuse
     struct Package {
         SocketAddr dst;
         std::string data;
     };
-    std::list<Package> sendList_;
+    std::vector<Package> sendRing_;
+    std::size_t sendHead_ {0};
+    std::size_t sendCount_ {0};
+    bool writing_ {false}; // write event is on
+
+    bool gso_ {false};
+    bool gro_ {false};
+
+#if defined(__linux__)
+    std::vector<mmsghdr> msgs_;
+    std::vector<iovec> iovecs_;
+    std::vector<char> cmsgs_;
+    std::vector<std::size_t> msgPackets_; // packets of each sent message
+#endif
 
     UDPMessageCallback onMessage_;
+    UDPBatchCallback onBatch_;
     UDPCreateCallback onCreate_;
 };
 
@@ -66,10 +66,17 @@ bool EventLoop::Listen(const char* ip,
 
 bool EventLoop::Listen(const SocketAddr& listenAddr,
                        NewTcpConnCallback newConnCallback) {
+    return Listen(listenAddr, nullptr, std::move(newConnCallback));
+}
+
+bool EventLoop::Listen(const SocketAddr& listenAddr,
+                       std::shared_ptr<ConnectionCallbacks> callbacks,
+                       NewTcpConnCallback newConnCallback) {
     using internal::Acceptor;
 
     auto s = std::make_shared<Acceptor>(this);
     s->SetNewConnCallback(std::move(newConnCallback));
+    s->SetCallbacks(std::move(callbacks));
     if (!s->Bind(listenAddr))
         return false;
 
@@ -97,6 +104,19 @@ bool EventLoop::ListenUDP(const char* ip, uint16_t hostPort,
     return ListenUDP(addr, mcb, ccb);
 }
 
+bool EventLoop::ListenUDPShard(const SocketAddr& listenAddr,
+                               UDPMessageCallback mcb,
+                               UDPCreateCallback ccb,
+                               std::size_t flowGroups) {
+    auto s = std::make_shared<DatagramSocket>(this);
+    s->SetMessageCallback(mcb);
+    s->SetCreateCallback(ccb);
+    s->SetReusePort(true, flowGroups);
+    if (!s->Bind(&listenAddr))
+        return false;
+
+    return true;
+}
 
 bool EventLoop::CreateClientUDP(UDPMessageCallback mcb,
                                 UDPCreateCallback ccb) {
@@ -213,6 +233,8 @@ void EventLoop::Run() {
     while (!Application::Instance().IsExit()) {
         auto timeout = std::min(kDefaultPollTime, timers_.NearestTimer());
         timeout = std::max(kMinPollTime, timeout);
+        if (hasPendingWork_ || !readyConns_.empty())
+            timeout = DurationMs(0);
 
         _Loop(timeout);
     }
@@ -227,6 +249,8 @@ void EventLoop::Run() {
 }
 
 bool EventLoop::_Loop(DurationMs timeout) {
+    ++ iteration_;
+
     ANANAS_DEFER {
         timers_.Update();
 
@@ -240,6 +264,18 @@ bool EventLoop::_Loop(DurationMs timeout) {
             for (const auto& f : funcs)
                 f();
         }
+
+        _FlushDirty();
+
+        hasPendingWork_ = false;
+        for (size_t i = 0; i < iterationHooks_.size(); ++ i) {
+            if (iterationHooks_[i]())
+                hasPendingWork_ = true;
+        }
+
+        // hooks may send too, callbacks of flush may have work to do
+        if (_FlushDirty())
+            hasPendingWork_ = true;
     };
 
     if (channelSet_.empty()) {
@@ -274,14 +310,83 @@ bool EventLoop::_Loop(DurationMs timeout) {
         }
 
         if (fired[i].events & internal::eET_Error) {
-            ANANAS_ERR << "eET_Error for " << src->Identifier();
+            // channels log it themselves, zero copy completion is not an error
             src->HandleErrorEvent();
         }
     }
 
+    _ServeReady();
+
     return ready >= 0;
 }
 
+void EventLoop::_AddTimeout(const std::shared_ptr<Connection>& conn,
+                            internal::TimeoutWheel::Tick deadline) {
+    if (!timeoutTimer_) {
+        timeoutTimer_ = ScheduleAfterWithRepeat<kForever>(internal::TimeoutWheel::kTickPeriod, [this]() {
+            timeoutWheel_.Advance();
+
+            // don't wake up for nothing, rearmed by next _AddTimeout
+            if (timeoutWheel_.Size() == 0) {
+                Cancel(timeoutTimer_);
+                timeoutTimer_.reset();
+            }
+        });
+    }
+
+    timeoutWheel_.Add(conn, deadline);
+}
+
+void EventLoop::_AddReady(std::shared_ptr<Connection> conn) {
+    readyConns_.emplace_back(std::move(conn));
+}
+
+void EventLoop::_ServeReady() {
+    if (readyConns_.empty())
+        return;
+
+    // Requeued ones are served in next iteration
+    decltype(readyConns_) conns;
+    conns.swap(readyConns_);
+    for (const auto& c : conns) {
+        if (!c->readMore_ || c->state_ != Connection::State::eS_Connected) {
+            c->readyQueued_ = false;
+            continue;
+        }
+
+        // Served by read event in this iteration, it's level triggered
+        if (c->readIteration_ == iteration_) {
+            readyConns_.push_back(c);
+            continue;
+        }
+
+        c->readyQueued_ = false;
+        if (!c->HandleReadEvent())
+            c->HandleErrorEvent();
+    }
+}
+
+void EventLoop::_AddDirty(std::shared_ptr<Connection> conn) {
+    dirtyConns_.emplace_back(std::move(conn));
+}
+
+bool EventLoop::_FlushDirty() {
+    if (dirtyConns_.empty())
+        return false;
+
+    decltype(dirtyConns_) conns;
+    conns.swap(dirtyConns_);
+    for (const auto& c : conns)
+        c->_FlushBatch();
+
+    return true;
+}
+
+void EventLoop::AddIterationHook(std::function<bool ()> hook) {
+    assert (InThisLoop());
+    iterationHooks_.emplace_back(std::move(hook));
+}
+
 bool EventLoop::InThisLoop() const {
     return this == g_thisLoop;
 }
@@ -312,6 +417,9 @@ void EventLoop::Reset() {
         functors_.clear();
     }
 
+    // hooks are bound once per thread by their owners, keep them for next Run
+    hasPendingWork_ = false;
+
 #if defined(__APPLE__)
     poller_.reset(new internal::Kqueue);
 #elif defined(__gnu_linux__)
@@ -2,6 +2,7 @@
 #ifndef BERT_EVENTLOOP_H
 #define BERT_EVENTLOOP_H
 
+#include <cstdint>
 #include <map>
 #include <memory>
 #include <sys/resource.h>
@@ -9,6 +10,8 @@
 #include "Poller.h"
 #include "PipeChannel.h"
 #include "Typedefs.h"
+#include "TimeoutWheel.h"
+#include "ananas/util/Buffer.h"
 #include "ananas/util/Timer.h"
 #include "ananas/util/Scheduler.h"
 #include "ananas/future/Future.h"
@@ -39,6 +42,10 @@ public:
     // listener
     bool Listen(const SocketAddr& addr, NewTcpConnCallback cb);
     bool Listen(const char* ip, uint16_t hostPort, NewTcpConnCallback cb);
+    ///@brief Accepted connections share callbacks, cb may be null
+    bool Listen(const SocketAddr& addr,
+                std::shared_ptr<ConnectionCallbacks> callbacks,
+                NewTcpConnCallback cb);
     bool ListenUDP(const SocketAddr& listenAddr,
                    UDPMessageCallback mcb,
                    UDPCreateCallback ccb);
@@ -47,6 +54,12 @@ public:
                    UDPMessageCallback mcb,
                    UDPCreateCallback ccb);
 
+    // one of the SO_REUSEPORT udp sockets bound to listenAddr
+    bool ListenUDPShard(const SocketAddr& listenAddr,
+                        UDPMessageCallback mcb,
+                        UDPCreateCallback ccb,
+                        std::size_t flowGroups = 0);
+
     // udp client
     bool CreateClientUDP(UDPMessageCallback mcb,
                          UDPCreateCallback ccb);
@@ -118,10 +131,50 @@ public:
     /// It's a infinite loop, until Application stopped
     void Run();
 
+    ///@brief Hook executed at the end of every loop iteration
+    ///
+    /// NOT thread-safe, and do not add hook in a hook.
+    /// If hook returns true, it still has work to do, so
+    /// the next poll will not block. Hooks are kept by Reset.
+    /// Usage: resume the ready coroutines, see `CoroutineScheduler`
+    void AddIterationHook(std::function<bool ()> hook);
+
     bool Register(int events, std::shared_ptr<internal::Channel> src);
     bool Modify(int events, std::shared_ptr<internal::Channel> src);
     void Unregister(int events, std::shared_ptr<internal::Channel> src);
 
+    ///@brief Coalesce writes of connections in this loop
+    ///
+    /// If enabled, packets sent outside read event, eg. from timers, Execute
+    /// functors or other connections, are buffered, and each dirty connection
+    /// is flushed by one writev at the end of loop iteration.
+    /// Good for pub/sub fan-out, or responses completed in thread pool.
+    /// NOT thread-safe, should be called before connections are created.
+    void SetWriteCoalescing(bool enable) {
+        writeCoalescing_ = enable;
+    }
+    bool IsWriteCoalescing() const {
+        return writeCoalescing_;
+    }
+
+    ///@brief Limit the work of one read event of a connection, 0 means no limit
+    ///
+    /// A connection exceeding the bytes or messages budget yields to others,
+    /// it's queued to the ready list and served round-robin in next iteration.
+    /// Good for a few heavy clients among many light ones.
+    /// NOT thread-safe, should be called before connections are created.
+    void SetReadBudget(std::size_t maxBytes, std::size_t maxMessages) {
+        readBudgetBytes_ = maxBytes;
+        readBudgetMessages_ = maxMessages;
+    }
+
+    ///@brief Receive buffer shared by connections of this loop
+    ///
+    /// See Connection::SetSharedRecvBuffer, NOT thread-safe
+    Buffer& RecvScratch() {
+        return recvScratch_;
+    }
+
     ///@brief Connection size
     std::size_t Size() const {
         return channelSet_.size();
@@ -153,7 +206,18 @@ public:
     void Reset();
 
 private:
+    friend class Connection;
+
     bool _Loop(DurationMs timeout);
+    // Connection has buffered packets to flush
+    void _AddDirty(std::shared_ptr<Connection> conn);
+    bool _FlushDirty();
+    // Connection is out of read budget
+    void _AddReady(std::shared_ptr<Connection> conn);
+    void _ServeReady();
+    // Connection has timeouts
+    void _AddTimeout(const std::shared_ptr<Connection>& conn,
+                     internal::TimeoutWheel::Tick deadline);
 
     std::unique_ptr<internal::Poller> poller_;
 
@@ -167,6 +231,22 @@ private:
     std::mutex fctrMutex_;
     std::vector<std::function<void ()> > functors_;
 
+    std::vector<std::function<bool ()> > iterationHooks_;
+    bool hasPendingWork_ {false};
+
+    Buffer recvScratch_;
+
+    bool writeCoalescing_ {false};
+    std::vector<std::shared_ptr<Connection>> dirtyConns_;
+
+    std::size_t readBudgetBytes_ {0};
+    std::size_t readBudgetMessages_ {0};
+    std::vector<std::shared_ptr<Connection>> readyConns_;
+    std::uint64_t iteration_ {0};
+
+    internal::TimeoutWheel timeoutWheel_;
+    TimerId timeoutTimer_;
+
     int id_;
     static std::atomic<int> s_evId;
 
@@ -3,7 +3,6 @@
 
 #include <vector>
 #include <memory>
-#include <stdio.h>
 
 namespace ananas {
 ///@brief namespace internal, not exposed to user.
@@ -19,14 +18,8 @@ enum EventType {
 ///@brief Event source base class.
 class Channel : public std::enable_shared_from_this<Channel> {
 public:
-    ///@brief Constructor, printf is for debug, you can comment it
-    Channel() {
-        printf("New channel %p\n", (void*)this);
-    }
-    ///@brief Destructor, printf is for debug, you can comment it
-    virtual ~Channel() {
-        printf("Delete channel %p\n", (void*)this);
-    }
+    Channel() = default;
+    virtual ~Channel() = default;
 
     Channel(const Channel& ) = delete;
     void operator=(const Channel& ) = delete;
@@ -0,0 +1,385 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+
+#include <cassert>
+#include <cstring>
+#include <new>
+
+#include "EventLoop.h"
+#include "ShmTransport.h"
+#include "AnanasDebug.h"
+
+namespace ananas {
+
+namespace internal {
+
+void ShmRing::Attach(Header* header, char* data, std::size_t capacity) {
+    header_ = header;
+    data_ = data;
+    capacity_ = capacity;
+    head_ = header_->head.load(std::memory_order_acquire);
+    tail_ = published_ = header_->tail.load(std::memory_order_acquire);
+    if (!_InRange(head_, tail_))
+        corrupted_ = true;
+}
+
+bool ShmRing::_InRange(std::uint64_t head, std::uint64_t tail) const {
+    return head <= tail && tail - head <= capacity_;
+}
+
+std::size_t ShmRing::WritableSize() const {
+    // head is written by peer, never trust it
+    const auto head = header_->head.load(std::memory_order_acquire);
+    if (corrupted_ || !_InRange(head, tail_)) {
+        corrupted_ = true;
+        return 0;
+    }
+
+    return capacity_ - static_cast<std::size_t>(tail_ - head);
+}
+
+void ShmRing::Produce(std::size_t bytes) {
+    assert (bytes <= WritableSize());
+    tail_ += bytes;
+}
+
+bool ShmRing::Publish() {
+    if (published_ == tail_)
+        return false;
+
+    published_ = tail_;
+    header_->tail.store(tail_, std::memory_order_release);
+
+    // pairs with the fence in WaitData: reader sees the tail or I see its flag
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return header_->readerWaiting.load(std::memory_order_relaxed) != 0 &&
+           header_->readerWaiting.exchange(0, std::memory_order_acq_rel) != 0;
+}
+
+bool ShmRing::WaitSpace() {
+    header_->writerWaiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return WritableSize() > 0;
+}
+
+std::size_t ShmRing::ReadableSize() const {
+    // tail is written by peer, never trust it
+    const auto tail = header_->tail.load(std::memory_order_acquire);
+    if (corrupted_ || !_InRange(head_, tail)) {
+        corrupted_ = true;
+        return 0;
+    }
+
+    return static_cast<std::size_t>(tail - head_);
+}
+
+bool ShmRing::Consume(std::size_t bytes) {
+    assert (bytes <= ReadableSize());
+    head_ += bytes;
+    header_->head.store(head_, std::memory_order_release);
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return header_->writerWaiting.load(std::memory_order_relaxed) != 0 &&
+           header_->writerWaiting.exchange(0, std::memory_order_acq_rel) != 0;
+}
+
+bool ShmRing::WaitData(std::size_t seen) {
+    header_->readerWaiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return ReadableSize() > seen;
+}
+
+
+namespace {
+
+const char kMagic[4] = {'A', 'S', 'H', 'M'};
+const std::uint32_t kVersion = 1;
+
+std::size_t PageSize() {
+    return static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+}
+
+std::size_t RoundUpPage(std::size_t size) {
+    const std::size_t page = PageSize();
+    if (size == 0)
+        size = page;
+
+    return (size + page - 1) / page * page;
+}
+
+int CreateEventFd() {
+#if defined(__linux__)
+    return ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
+    return -1;
+#endif
+}
+
+int CreateMemFile() {
+#if defined(__linux__) && defined(SYS_memfd_create)
+    return static_cast<int>(::syscall(SYS_memfd_create, "ananas_shm",
+                                      0x0001U | 0x0002U)); // MFD_CLOEXEC | MFD_ALLOW_SEALING
+#else
+    return -1;
+#endif
+}
+
+// Size is fixed, the peer can't truncate it under our mappings (SIGBUS)
+#if defined(F_ADD_SEALS)
+const int kMemFileSeals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+#endif
+
+bool SealMemFile(int fd) {
+#if defined(F_ADD_SEALS)
+    return ::fcntl(fd, F_ADD_SEALS, kMemFileSeals) == 0;
+#else
+    return false;
+#endif
+}
+
+bool IsMemFileSealed(int fd) {
+#if defined(F_GET_SEALS)
+    const int seals = ::fcntl(fd, F_GET_SEALS);
+    return seals != -1 && (seals & kMemFileSeals) == kMemFileSeals;
+#else
+    return false;
+#endif
+}
+
+// Map the ring data of file twice, back to back
+char* MapMirror(int fd, off_t offset, std::size_t size) {
+    void* area = ::mmap(nullptr, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (area == MAP_FAILED)
+        return nullptr;
+
+    char* base = static_cast<char*>(area);
+    void* first = ::mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, offset);
+    void* second = ::mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, offset);
+    if (first != base || second != base + size) {
+        ::munmap(base, 2 * size);
+        return nullptr;
+    }
+
+    return base;
+}
+
+} // end namespace
+
+
+class ShmTransport::Doorbell : public Channel {
+public:
+    explicit
+    Doorbell(int fd) : fd_(fd) {
+    }
+
+    ~Doorbell() {
+        if (fd_ != -1)
+            ::close(fd_);
+    }
+
+    int Identifier() const override {
+        return fd_;
+    }
+
+    bool HandleReadEvent() override {
+        // eventfd counter is reset by one read
+        std::uint64_t count;
+        if (::read(fd_, &count, sizeof count) < 0 && errno != EAGAIN)
+            return false;
+
+        if (onDoorbell_)
+            onDoorbell_();
+
+        return true;
+    }
+
+    bool HandleWriteEvent() override {
+        assert (false);
+        return false;
+    }
+
+    void HandleErrorEvent() override {
+    }
+
+    int fd_;
+    std::function<void ()> onDoorbell_;
+};
+
+
+const std::size_t ShmTransport::kDefaultRingSize = 4 * 1024 * 1024;
+const std::size_t ShmTransport::kHelloSize;
+const std::size_t ShmTransport::kPassFds;
+
+ShmTransport::ShmTransport() :
+    peerBell_(-1),
+    memFd_(-1) {
+}
+
+ShmTransport::~ShmTransport() {
+    CloseMemFd();
+    if (peerBell_ != -1)
+        ::close(peerBell_);
+
+    for (char* base : ringBase_) {
+        if (base)
+            ::munmap(base, 2 * ringSize_);
+    }
+
+    if (header_)
+        ::munmap(header_, headerSize_);
+}
+
+bool ShmTransport::Create(std::size_t ringSize) {
+    assert (!header_);
+
+    ringSize = RoundUpPage(ringSize);
+    memFd_ = CreateMemFile();
+    if (memFd_ == -1)
+        return false;
+
+    const off_t fileSize = static_cast<off_t>(RoundUpPage(2 * sizeof(ShmRing::Header)) + 2 * ringSize);
+    if (::ftruncate(memFd_, fileSize) != 0 || !SealMemFile(memFd_))
+        return false;
+
+    doorbell_ = std::make_shared<Doorbell>(CreateEventFd());
+    peerBell_ = CreateEventFd();
+    if (doorbell_->fd_ == -1 || peerBell_ == -1)
+        return false;
+
+    if (!_Map(memFd_, ringSize, true))
+        return false;
+
+    // the first bytes of either side must ring the doorbell
+    auto headers = reinterpret_cast<ShmRing::Header*>(header_);
+    for (int i = 0; i < 2; ++ i) {
+        headers[i].readerWaiting.store(1, std::memory_order_relaxed);
+        headers[i].writerWaiting.store(0, std::memory_order_relaxed);
+    }
+
+    std::atomic_thread_fence(std::memory_order_release);
+    return true;
+}
+
+void ShmTransport::GetPassFds(int (&fds)[kPassFds]) const {
+    fds[0] = memFd_;
+    fds[1] = doorbell_->fd_;
+    fds[2] = peerBell_;
+}
+
+void ShmTransport::MakeHello(char (&hello)[kHelloSize]) const {
+    const std::uint64_t ringSize = ringSize_;
+    memcpy(hello, kMagic, sizeof kMagic);
+    memcpy(hello + 4, &kVersion, sizeof kVersion);
+    memcpy(hello + 8, &ringSize, sizeof ringSize);
+}
+
+void ShmTransport::CloseMemFd() {
+    if (memFd_ != -1) {
+        ::close(memFd_);
+        memFd_ = -1;
+    }
+}
+
+bool ShmTransport::Attach(const char* hello, std::vector<int> fds) {
+    assert (!header_);
+
+    // take the fds whatever happens
+    if (fds.size() >= 1)
+        memFd_ = fds[0];
+    if (fds.size() >= 2)
+        peerBell_ = fds[1];
+    if (fds.size() >= 3)
+        doorbell_ = std::make_shared<Doorbell>(fds[2]);
+    for (std::size_t i = kPassFds; i < fds.size(); ++ i)
+        ::close(fds[i]);
+
+    if (fds.size() != kPassFds || memcmp(hello, kMagic, sizeof kMagic) != 0) {
+        ANANAS_ERR << "ShmTransport bad hello, fds " << fds.size();
+        return false;
+    }
+
+    std::uint32_t version;
+    std::uint64_t ringSize;
+    memcpy(&version, hello + 4, sizeof version);
+    memcpy(&ringSize, hello + 8, sizeof ringSize);
+
+    // don't trust the size in hello, the file must hold it, and keep it
+    struct stat st;
+    if (version != kVersion ||
+        ringSize == 0 || ringSize % PageSize() != 0 ||
+        !IsMemFileSealed(memFd_) ||
+        ::fstat(memFd_, &st) != 0 ||
+        static_cast<std::uint64_t>(st.st_size) != RoundUpPage(2 * sizeof(ShmRing::Header)) + 2 * ringSize) {
+        ANANAS_ERR << "ShmTransport bad region, version " << version << ", ring size " << ringSize;
+        return false;
+    }
+
+    if (!_Map(memFd_, static_cast<std::size_t>(ringSize), false))
+        return false;
+
+    CloseMemFd();
+    return true;
+}
+
+bool ShmTransport::_Map(int memfd, std::size_t ringSize, bool client) {
+    headerSize_ = RoundUpPage(2 * sizeof(ShmRing::Header));
+    ringSize_ = ringSize;
+
+    void* header = ::mmap(nullptr, headerSize_, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (header == MAP_FAILED)
+        return false;
+
+    header_ = static_cast<char*>(header);
+    for (int i = 0; i < 2; ++ i) {
+        ringBase_[i] = MapMirror(memfd, static_cast<off_t>(headerSize_ + i * ringSize), ringSize);
+        if (!ringBase_[i])
+            return false;
+    }
+
+    // ring 0 is client to server
+    auto headers = reinterpret_cast<ShmRing::Header*>(header_);
+    const int txIndex = client ? 0 : 1;
+    tx_.Attach(&headers[txIndex], ringBase_[txIndex], ringSize);
+    rx_.Attach(&headers[1 - txIndex], ringBase_[1 - txIndex], ringSize);
+    if (tx_.Corrupted() || rx_.Corrupted()) {
+        ANANAS_ERR << "Bad positions of shm ring";
+        return false;
+    }
+
+    return true;
+}
+
+void ShmTransport::NotifyPeer() {
+    std::uint64_t one = 1;
+    if (::write(peerBell_, &one, sizeof one) < 0 && errno != EAGAIN)
+        ANANAS_WRN << "ShmTransport notify peer failed " << errno;
+}
+
+bool ShmTransport::Register(EventLoop* loop, std::function<void ()> onDoorbell) {
+    assert (doorbell_ && !registered_);
+
+    doorbell_->onDoorbell_ = std::move(onDoorbell);
+    registered_ = loop->Register(eET_Read, doorbell_);
+    return registered_;
+}
+
+void ShmTransport::Unregister(EventLoop* loop) {
+    if (!registered_)
+        return;
+
+    registered_ = false;
+    doorbell_->onDoorbell_ = nullptr;
+    loop->Unregister(eET_Read, doorbell_);
+}
+
+} // end namespace internal
+
+} // end namespace ananas
+
@@ -0,0 +1,149 @@
+#ifndef BERT_SHMTRANSPORT_H
+#define BERT_SHMTRANSPORT_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+///@file ShmTransport.h
+namespace ananas {
+
+class EventLoop;
+
+namespace internal {
+
+///@brief Single producer single consumer byte ring in shared memory
+///
+/// Data is mapped twice back to back like RingBuffer, so both readable and
+/// writable bytes are continuous. Only head and tail are shared, each side
+/// keeps its own copy of the position it owns.
+class ShmRing {
+public:
+    // In shared memory, positions are total bytes, never wrap
+    struct Header {
+        alignas(64) std::atomic<std::uint64_t> head; // consumed, by reader
+        alignas(64) std::atomic<std::uint64_t> tail; // produced, by writer
+        alignas(64) std::atomic<std::uint32_t> readerWaiting;
+        alignas(64) std::atomic<std::uint32_t> writerWaiting;
+    };
+
+    void Attach(Header* header, char* data, std::size_t capacity);
+
+    std::size_t Capacity() const {
+        return capacity_;
+    }
+
+    ///@brief Peer broke the positions, sizes are 0 since then
+    ///
+    /// The peer process can write the header, a position out of range is
+    /// a protocol error, the connection should be closed.
+    bool Corrupted() const {
+        return corrupted_;
+    }
+
+    // writer side
+    std::size_t WritableSize() const;
+    char* WriteAddr() const {
+        return data_ + tail_ % capacity_;
+    }
+    // Not visible to reader until Publish
+    void Produce(std::size_t bytes);
+    // Return true if reader is sleeping and should be notified
+    bool Publish();
+    // Arm writerWaiting, return true if space is already available
+    bool WaitSpace();
+
+    // reader side
+    std::size_t ReadableSize() const;
+    const char* ReadAddr() const {
+        return data_ + head_ % capacity_;
+    }
+    // Return true if writer is waiting for space and should be notified
+    bool Consume(std::size_t bytes);
+    // Arm readerWaiting, return true if more than seen bytes already arrived
+    bool WaitData(std::size_t seen);
+
+private:
+    bool _InRange(std::uint64_t head, std::uint64_t tail) const;
+
+    Header* header_ {nullptr};
+    char* data_ {nullptr};
+    std::size_t capacity_ {0};
+    std::uint64_t head_ {0}; // reader's
+    std::uint64_t tail_ {0}; // writer's
+    std::uint64_t published_ {0};
+    mutable bool corrupted_ {false};
+};
+
+///@brief Two rings in a memfd and two eventfd doorbells, per connection
+///
+/// The client creates the region, passes memfd and eventfds to the server
+/// over the unix socket, then both sides exchange bytes through the rings.
+/// The doorbell of this side is registered in EventLoop, the peer writes it
+/// only if this side is sleeping, so busy streams make no syscall.
+class ShmTransport {
+public:
+    static const std::size_t kDefaultRingSize;
+    static const std::size_t kHelloSize = 16;
+    static const std::size_t kPassFds = 3;
+
+    ShmTransport();
+    ~ShmTransport();
+
+    ShmTransport(const ShmTransport& ) = delete;
+    void operator= (const ShmTransport& ) = delete;
+
+    ///@brief Client side, create the region
+    bool Create(std::size_t ringSize);
+    ///@brief The fds and hello bytes to pass to server
+    ///
+    /// memfd, doorbell of client, doorbell of server
+    void GetPassFds(int (&fds)[kPassFds]) const;
+    void MakeHello(char (&hello)[kHelloSize]) const;
+    ///@brief Close memfd after it's passed, the mappings hold the memory
+    void CloseMemFd();
+
+    ///@brief Server side, map the region of client, take the fds anyway
+    bool Attach(const char* hello, std::vector<int> fds);
+
+    ShmRing& Tx() {
+        return tx_;
+    }
+    ShmRing& Rx() {
+        return rx_;
+    }
+
+    ///@brief Wake up the peer
+    void NotifyPeer();
+
+    ///@brief Watch the doorbell of this side
+    bool Register(EventLoop* loop, std::function<void ()> onDoorbell);
+    void Unregister(EventLoop* loop);
+
+private:
+    bool _Map(int memfd, std::size_t ringSize, bool client);
+
+    class Doorbell;
+    std::shared_ptr<Doorbell> doorbell_;
+    bool registered_ {false};
+    int peerBell_;
+    int memFd_;
+
+    char* header_ {nullptr};
+    char* ringBase_[2] {nullptr, nullptr};
+    std::size_t headerSize_ {0};
+    std::size_t ringSize_ {0};
+
+    ShmRing tx_;
+    ShmRing rx_;
+};
+
+} // end namespace internal
+
+} // end namespace ananas
+
+#endif
+
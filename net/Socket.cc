@@ -5,6 +5,11 @@
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <net/if.h>
+#include <sys/un.h>
+#include <cstddef>
+#if defined(__linux__)
+#include <linux/filter.h>
+#endif
 
 #include "Socket.h"
 
@@ -20,6 +25,10 @@ int CreateUDPSocket() {
     return ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
 }
 
+int CreateUnixSocket() {
+    return ::socket(AF_UNIX, SOCK_STREAM, 0);
+}
+
 int CreateTCPSocket() {
     return ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
 }
@@ -58,6 +67,15 @@ void SetNodelay(int sock, bool enable) {
     ::setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(int));
 }
 
+void SetCork(int sock, bool enable) {
+    int cork = enable ? 1 : 0;
+#if defined(TCP_CORK)
+    ::setsockopt(sock, IPPROTO_TCP, TCP_CORK, (const char*)&cork, sizeof(int));
+#elif defined(TCP_NOPUSH)
+    ::setsockopt(sock, IPPROTO_TCP, TCP_NOPUSH, (const char*)&cork, sizeof(int));
+#endif
+}
+
 void SetSndBuf(int sock, socklen_t winsize) {
     ::setsockopt(sock, SOL_SOCKET, SO_SNDBUF, (const char*)&winsize, sizeof(winsize));
 }
@@ -71,6 +89,78 @@ void SetReuseAddr(int sock) {
     ::setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
 }
 
+void SocketAddr::Init(const sockaddr_storage& addr, socklen_t len) {
+    if (addr.ss_family == AF_UNIX) {
+        const auto& un = reinterpret_cast<const sockaddr_un&>(addr);
+        const socklen_t offset = offsetof(sockaddr_un, sun_path);
+        std::string path;
+        if (len > offset)
+            path.assign(un.sun_path, strnlen(un.sun_path, len - offset));
+
+        InitUnix(path);
+    } else if (addr.ss_family == AF_INET) {
+        Init(reinterpret_cast<const sockaddr_in&>(addr));
+    } else {
+        Clear();
+    }
+}
+
+socklen_t SocketAddr::ToSockaddr(sockaddr_storage& addr) const {
+    memset(&addr, 0, sizeof addr);
+    if (!IsUnix()) {
+        memcpy(&addr, &addr_, sizeof addr_);
+        return sizeof addr_;
+    }
+
+    auto& un = reinterpret_cast<sockaddr_un&>(addr);
+    if (path_.size() >= sizeof un.sun_path)
+        return 0;
+
+    un.sun_family = AF_UNIX;
+    memcpy(un.sun_path, path_.data(), path_.size());
+    return static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + path_.size() + 1);
+}
+
+bool SetReusePort(int sock) {
+#if defined(SO_REUSEPORT)
+    int reuse = 1;
+    return 0 == ::setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (const char*)&reuse, sizeof(reuse));
+#else
+    return false;
+#endif
+}
+
+bool AttachReusePortFlowHash(int sock, uint32_t groups) {
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+    if (groups == 0)
+        return false;
+
+    // skb data is udp payload, ip header is at SKF_NET_OFF
+    struct sock_filter code[] = {
+        // A = src ip
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t)(SKF_NET_OFF + 12) },
+        // X = A
+        { BPF_MISC | BPF_TAX, 0, 0, 0 },
+        // A = src port, no ip options
+        { BPF_LD | BPF_H | BPF_ABS, 0, 0, (uint32_t)(SKF_NET_OFF + 20) },
+        // A ^= X
+        { BPF_ALU | BPF_XOR | BPF_X, 0, 0, 0 },
+        // A %= groups
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, groups },
+        // return A as socket index
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+
+    struct sock_fprog prog;
+    prog.len = sizeof code / sizeof code[0];
+    prog.filter = code;
+
+    return 0 == ::setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof prog);
+#else
+    return false;
+#endif
+}
+
 bool GetLocalAddr(int sock, SocketAddr& addr) {
     sockaddr_in localAddr;
     socklen_t   len = sizeof(localAddr);
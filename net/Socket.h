@@ -4,6 +4,7 @@
 
 #include <arpa/inet.h>
 #include <sys/resource.h>
+#include <sys/socket.h>
 #include <string.h>
 #include <string>
 #include <memory>
@@ -14,7 +15,7 @@ namespace ananas {
 
 std::string ConvertIp(const char* ip);
 
-///@brief Encapsulation for ipv4 address
+///@brief Encapsulation for ipv4 address, or unix domain socket path
 struct SocketAddr {
     static const uint16_t kInvalidPort = -1;
 
@@ -48,16 +49,29 @@ struct SocketAddr {
     }
 
     ///@brief Constructor
-    ///@param ipport ipv4 address format like "127.0.0.1:8000"
+    ///@param ipport ipv4 address format like "127.0.0.1:8000",
+    /// or unix socket like "unix:/tmp/ananas.sock"
     SocketAddr(const std::string& ipport) {
         Init(ipport);
     }
 
     void Init(const sockaddr_in& addr) {
         memcpy(&addr_, &addr, sizeof(addr));
+        path_.clear();
+    }
+
+    ///@brief Init from address returned by accept etc.
+    void Init(const sockaddr_storage& addr, socklen_t len);
+
+    ///@brief Unix domain socket, path may be empty for unnamed peer
+    void InitUnix(const std::string& path) {
+        Clear();
+        addr_.sin_family = AF_UNIX;
+        path_ = path;
     }
 
     void Init(uint32_t netip, uint16_t netport) {
+        path_.clear();
         addr_.sin_family = AF_INET;
         addr_.sin_addr.s_addr = netip;
         addr_.sin_port   = netport;
@@ -65,13 +79,19 @@ struct SocketAddr {
 
     void Init(const char* ip, uint16_t hostport) {
         std::string sip = ConvertIp(ip);
+        path_.clear();
         addr_.sin_family = AF_INET;
         addr_.sin_addr.s_addr = ::inet_addr(sip.data());
         addr_.sin_port = htons(hostport);
     }
 
-    // ip port format:  127.0.0.1:6379
+    // ip port format:  127.0.0.1:6379, or unix:/path
     void Init(const std::string& ipport) {
+        if (ipport.compare(0, 5, "unix:") == 0) {
+            InitUnix(ipport.substr(5));
+            return;
+        }
+
         std::string::size_type p = ipport.find_first_of(':');
         std::string ip = ipport.substr(0, p);
         std::string port = ipport.substr(p + 1);
@@ -83,9 +103,26 @@ struct SocketAddr {
         return addr_;
     }
 
+    ///@brief Fill address for bind or connect
+    ///@return Length of address, 0 if unix path is too long
+    socklen_t ToSockaddr(sockaddr_storage& addr) const;
+
+    ///@brief Is unix domain socket
+    bool IsUnix() const {
+        return addr_.sin_family == AF_UNIX;
+    }
+
+    ///@brief Return unix socket path
+    const std::string& GetPath() const {
+        return path_;
+    }
+
     ///@brief Return ip string
     ///@return like "127.0.0.1"
     std::string GetIP() const {
+        if (IsUnix())
+            return std::string();
+
         char tmp[32];
         const char* res = inet_ntop(AF_INET, &addr_.sin_addr,
                                     tmp, (socklen_t)(sizeof tmp));
@@ -100,6 +137,9 @@ struct SocketAddr {
 
     ///@brief Address string format like 127.0.0.1:6379
     std::string ToString() const {
+        if (IsUnix())
+            return "unix:" + path_;
+
         char tmp[32];
         const char* res = inet_ntop(AF_INET, &addr_.sin_addr, tmp, (socklen_t)(sizeof tmp));
 
@@ -114,12 +154,14 @@ struct SocketAddr {
     ///@brief Reset to zeros
     void Clear() {
         memset(&addr_, 0, sizeof addr_);
+        path_.clear();
     }
 
     inline friend bool operator== (const SocketAddr& a, const SocketAddr& b) {
         return a.addr_.sin_family      ==  b.addr_.sin_family &&
                a.addr_.sin_addr.s_addr ==  b.addr_.sin_addr.s_addr &&
-               a.addr_.sin_port        ==  b.addr_.sin_port ;
+               a.addr_.sin_port        ==  b.addr_.sin_port &&
+               a.path_ == b.path_;
     }
 
     inline friend bool operator!= (const SocketAddr& a, const SocketAddr& b) {
@@ -128,6 +170,7 @@ struct SocketAddr {
 
 private:
     sockaddr_in  addr_;
+    std::string  path_; // only for AF_UNIX
 };
 
 extern const int kInvalid;
@@ -140,6 +183,8 @@ extern const int kEof;
 int CreateTCPSocket();
 ///@brief Create udp socket
 int CreateUDPSocket();
+///@brief Create unix domain stream socket
+int CreateUnixSocket();
 bool CreateSocketPair(int& readSock, int& writeSock);
 ///@brief Close socket
 void CloseSocket(int &sock);
@@ -147,9 +192,19 @@ void CloseSocket(int &sock);
 void SetNonBlock(int sock, bool nonBlock = true);
 ///@brief Set no delay for socket
 void SetNodelay(int sock, bool enable = true);
+///@brief Hold partial frames until uncorked, TCP_CORK or TCP_NOPUSH
+void SetCork(int sock, bool enable);
 void SetSndBuf(int sock, socklen_t size = 64 * 1024);
 void SetRcvBuf(int sock, socklen_t size = 64 * 1024);
 void SetReuseAddr(int sock);
+///@brief SO_REUSEPORT, sockets bound to the same address share the load
+bool SetReusePort(int sock);
+///@brief Steer datagrams of a reuseport group by flow hash, Linux only
+///
+/// Index of socket in group is hash(src ip, src port) % groups, so a peer
+/// always hits the same socket while the group is unchanged.
+/// Assume IPv4 without options.
+bool AttachReusePortFlowHash(int sock, uint32_t groups);
 ///@brief Get local address for socket
 bool GetLocalAddr(int sock, SocketAddr& );
 ///@brief Get remote address for socket
@@ -176,6 +231,8 @@ struct hash<ananas::SocketAddr> {
         result_type h2 = std::hash<unsigned short> {}(s.GetAddr().sin_port);
         result_type h3 = std::hash<unsigned int> {}(s.GetAddr().sin_addr.s_addr);
         result_type tmp = h1 ^ (h2 << 1);
+        if (s.IsUnix())
+            h3 ^= std::hash<std::string> {}(s.GetPath());
         return h3 ^ (tmp << 1);
     }
 };
@@ -0,0 +1,85 @@
+
+#include <cassert>
+
+#include "TimeoutWheel.h"
+#include "Connection.h"
+
+namespace ananas {
+
+namespace internal {
+
+constexpr std::chrono::milliseconds TimeoutWheel::kTickPeriod;
+const std::size_t TimeoutWheel::kSlots;
+
+TimeoutWheel::TimeoutWheel() :
+    start_(std::chrono::steady_clock::now()),
+    slots_(kSlots) {
+    now_ = _ClockTicks();
+}
+
+TimeoutWheel::Tick TimeoutWheel::ToTicks(std::chrono::milliseconds duration) {
+    if (duration.count() <= 0)
+        return 0;
+
+    return static_cast<Tick>((duration.count() + kTickPeriod.count() - 1) / kTickPeriod.count());
+}
+
+TimeoutWheel::Tick TimeoutWheel::_ClockTicks() const {
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_);
+    return static_cast<Tick>(elapsed.count() / kTickPeriod.count()) + 1; // 0 is reserved
+}
+
+void TimeoutWheel::Add(const std::shared_ptr<Connection>& conn, Tick deadline) {
+    if (deadline <= now_)
+        deadline = now_ + 1;
+    else if (deadline - now_ >= kSlots)
+        deadline = now_ + kSlots - 1; // visit and requeue
+
+    // visits are not removed, the earlier one will requeue it
+    if (conn->wheelVisit_ != 0 && conn->wheelVisit_ <= deadline)
+        return;
+
+    conn->wheelVisit_ = deadline;
+    slots_[deadline % kSlots].push_back(conn);
+    ++ size_;
+}
+
+void TimeoutWheel::Advance() {
+    const Tick target = _ClockTicks();
+    while (now_ != target) {
+        if (size_ == 0) {
+            now_ = target;
+            break;
+        }
+
+        ++ now_;
+        auto& slot = slots_[now_ % kSlots];
+        if (slot.empty())
+            continue;
+
+        std::vector<std::weak_ptr<Connection>> conns;
+        conns.swap(slot);
+        size_ -= conns.size();
+
+        for (const auto& w : conns) {
+            auto conn = w.lock();
+            if (!conn || conn->wheelVisit_ != now_)
+                continue; // closed, or stale visit
+
+            conn->wheelVisit_ = 0;
+            Tick next = conn->_CheckTimeouts(now_);
+            if (next != 0)
+                Add(conn, next);
+        }
+    }
+}
+
+void TimeoutWheel::UpdateNow() {
+    if (size_ == 0)
+        now_ = _ClockTicks();
+}
+
+} // end namespace internal
+
+} // end namespace ananas
+
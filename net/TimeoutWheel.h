@@ -0,0 +1,70 @@
+#ifndef BERT_TIMEOUTWHEEL_H
+#define BERT_TIMEOUTWHEEL_H
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace ananas {
+
+class Connection;
+
+namespace internal {
+
+///@brief Bucketed timing wheel for connection timeouts
+///
+/// Connections store the tick of their last activity, the wheel only
+/// visits a connection at its earliest possible deadline, then asks it
+/// for the next one. So activity costs a store, not a timer reschedule.
+/// Deadlines beyond the wheel are visited at the last slot, then requeued.
+/// NOT thread-safe, owned by EventLoop.
+class TimeoutWheel {
+public:
+    using Tick = std::uint32_t;
+
+    static constexpr std::chrono::milliseconds kTickPeriod {100};
+    static const std::size_t kSlots = 512;
+
+    TimeoutWheel();
+
+    TimeoutWheel(const TimeoutWheel& ) = delete;
+    void operator= (const TimeoutWheel& ) = delete;
+
+    ///@brief Current tick, updated by Advance
+    Tick Now() const {
+        return now_;
+    }
+
+    ///@brief Ticks of duration, round up
+    static Tick ToTicks(std::chrono::milliseconds duration);
+
+    ///@brief Visit conn at deadline, earlier visit is kept
+    void Add(const std::shared_ptr<Connection>& conn, Tick deadline);
+
+    ///@brief Catch up with clock, visit the expired slots
+    void Advance();
+
+    ///@brief Sync Now with clock without visiting
+    void UpdateNow();
+
+    std::size_t Size() const {
+        return size_;
+    }
+
+private:
+    Tick _ClockTicks() const;
+
+    const std::chrono::steady_clock::time_point start_;
+    Tick now_ {0};
+
+    std::vector<std::vector<std::weak_ptr<Connection>>> slots_;
+    std::size_t size_ {0};
+};
+
+} // end namespace internal
+
+} // end namespace ananas
+
+#endif
+
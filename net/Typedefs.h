@@ -7,7 +7,9 @@ namespace ananas {
 
 struct SocketAddr;
 class Connection;
+struct ConnectionCallbacks;
 class DatagramSocket;
+struct UDPPacket;
 class EventLoop;
 
 using NewTcpConnCallback = std::function<void (Connection* )>;
@@ -18,6 +20,7 @@ using BindCallback = std::function<void (bool succ, const SocketAddr& )>;
 
 using UDPMessageCallback = std::function<void (DatagramSocket*, const char* data, size_t len)>;
 using UDPCreateCallback = std::function<void (DatagramSocket* )>;
+using UDPBatchCallback = std::function<void (DatagramSocket*, const UDPPacket* packets, size_t count)>;
 }
 
 #endif
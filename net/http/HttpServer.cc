@@ -15,6 +15,14 @@ static std::unique_ptr<HttpResponse> Handle404(const HttpRequest&, std::shared_p
 
 HttpServer::Handler HttpServer::default_ = Handle404;
 
+HttpServer::HttpServer() : callbacks_(std::make_shared<ConnectionCallbacks>()) {
+  callbacks_->onMessage = [](Connection* conn, const char* data, size_t len) {
+    auto ctx = conn->GetUserData<HttpContext>();
+    return static_cast<size_t>(ctx->Parse(conn, data, static_cast<int>(len)));
+  };
+  callbacks_->onDisconnect = std::bind(&HttpServer::OnDisconnect, this, std::placeholders::_1);
+}
+
 const HttpServer::Handler& HttpServer::GetHandler(const std::string& url) const {
   auto it = handlers_.find(url);
   if (it != handlers_.end()) {
@@ -32,9 +40,10 @@ void HttpServer::OnNewConnection(Connection* conn) {
   auto ctx = std::make_shared<HttpContext>(HTTP_REQUEST, _, this);
 
   conn->SetUserData(ctx);
-  conn->SetOnMessage(
-      std::bind(&HttpContext::Parse, ctx.get(), std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
-  conn->SetOnDisconnect(std::bind(&HttpServer::OnDisconnect, this, std::placeholders::_1));
+  conn->SetCallbacks(callbacks_);
+  if (idle_timeout_.count() > 0) {
+    conn->SetIdleTimeout(idle_timeout_);
+  }
 
   if (on_new_http_ctx_) {
     on_new_http_ctx_(ctx.get());
@@ -83,13 +92,9 @@ void HttpContext::SendResponse(const HttpResponse& rsp) {
     return;
   }
 
+  // the encoded response is moved to connection, no copy
   std::string rsp_data = rsp.Encode();
-  auto loop = conn->GetLoop();
-  if (loop->InThisLoop()) {
-    conn->SendPacket(rsp_data.data(), rsp_data.size());
-  } else {
-    loop->Execute([conn, rsp_data]() { conn->SendPacket(rsp_data.data(), rsp_data.size()); });
-  }
+  conn->SafeSend(std::move(rsp_data));
 }
 
 }  // namespace proxy
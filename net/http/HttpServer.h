@@ -1,5 +1,6 @@
 #pragma once
 
+#include <chrono>
 #include <functional>
 #include <memory>
 #include <string>
@@ -10,6 +11,7 @@
 namespace ananas {
 class Connection;
 class HttpContext;
+struct ConnectionCallbacks;
 
 class HttpServer {
  public:
@@ -17,9 +19,13 @@ class HttpServer {
   using HandlerMap = std::unordered_map<std::string, Handler>;
   using OnNewClient = std::function<void(HttpContext*)>;
 
+  HttpServer();
+
   const Handler& GetHandler(const std::string& url) const;
   void HandleFunc(const std::string& url, Handler handle);
   void SetOnNewHttpContext(OnNewClient on_new_http);
+  // Close keep-alive connections without requests, 0 disables it
+  void SetIdleTimeout(std::chrono::milliseconds timeout) { idle_timeout_ = timeout; }
 
   void OnNewConnection(Connection* conn);
 
@@ -30,6 +36,9 @@ class HttpServer {
   HandlerMap handlers_;
 
   OnNewClient on_new_http_ctx_;
+  // shared by all connections
+  std::shared_ptr<ConnectionCallbacks> callbacks_;
+  std::chrono::milliseconds idle_timeout_{0};
 
   static Handler default_;
 };
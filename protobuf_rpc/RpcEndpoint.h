@@ -13,15 +13,53 @@ namespace rpc {
 ///@brief Convert endpoint to socket address
 inline
 SocketAddr EndpointToSocketAddr(const Endpoint& ep) {
+    if (ep.proto() == UNIX || ep.proto() == SHM) {
+        SocketAddr addr;
+        addr.InitUnix(ep.ip());
+        return addr;
+    }
+
     return SocketAddr(ep.ip().data(), ep.port());
 }
 
+///@brief Convert socket address to endpoint, TCP, UNIX or SHM
+inline
+Endpoint EndpointFromSocketAddr(const SocketAddr& addr, bool shm = false) {
+    Endpoint ep;
+    if (addr.IsUnix()) {
+        ep.set_proto(shm ? SHM : UNIX);
+        ep.set_ip(addr.GetPath());
+    } else {
+        ep.set_proto(TCP);
+        ep.set_ip(addr.GetIP());
+        ep.set_port(addr.GetPort());
+    }
+
+    return ep;
+}
+
 ///@brief Construct endpoint from string format:
-/// tcp://127.0.0.1:8000
+/// tcp://127.0.0.1:8000, unix:///tmp/ananas.sock or shm:///tmp/ananas.sock
 inline
 Endpoint EndpointFromString(const std::string& url) {
-    // len(tcp://1.1.1.1:1) = 15
     Endpoint ep;
+    if (url.compare(0, 7, "unix://") == 0) {
+        if (url.size() > 7) {
+            ep.set_proto(UNIX);
+            ep.set_ip(url.substr(7));
+        }
+        return ep;
+    }
+
+    if (url.compare(0, 6, "shm://") == 0) {
+        if (url.size() > 6) {
+            ep.set_proto(SHM);
+            ep.set_ip(url.substr(6));
+        }
+        return ep;
+    }
+
+    // len(tcp://1.1.1.1:1) = 15
     if (url.size() < 15)
         return ep;
 
@@ -50,9 +88,14 @@ Endpoint EndpointFromString(const std::string& url) {
 }
 
 ///@brief Convert endpoint to string format:
-/// tcp://127.0.0.1:8000
+/// tcp://127.0.0.1:8000, unix:///tmp/ananas.sock or shm:///tmp/ananas.sock
 inline
 std::string EndpointToString(const Endpoint& ep) {
+    if (ep.proto() == UNIX)
+        return "unix://" + ep.ip();
+    if (ep.proto() == SHM)
+        return "shm://" + ep.ip();
+
     std::string rep;
     if (ep.proto() == TCP)
         rep = "tcp://";
@@ -75,6 +118,9 @@ bool operator==(const Endpoint& a, const Endpoint& b) {
 ///@brief Check it whether valid endpoint
 inline
 bool IsValidEndpoint(const Endpoint& ep) {
+    if (ep.proto() == UNIX || ep.proto() == SHM)
+        return !ep.ip().empty();
+
     return !ep.ip().empty() && ep.port() > 0;
 }
 
@@ -36,7 +36,7 @@ bool Service::Start() {
         return false;
 
     auto& app = Application::Instance();
-    SocketAddr bindAddr(endpoint_.ip(), endpoint_.port());
+    SocketAddr bindAddr(EndpointToSocketAddr(endpoint_));
     app.Listen(bindAddr, std::bind(&Service::OnNewConnection,
                                    this,
                                    std::placeholders::_1));
@@ -48,6 +48,10 @@ const std::string& Service::FullName() const {
 }
 
 void Service::OnNewConnection(Connection* conn) {
+    // peer passes the rings before any request
+    if (endpoint_.proto() == SHM)
+        conn->AcceptShm();
+
     auto channel = std::make_shared<ServerChannel>(conn, this);
     conn->SetUserData(channel);
     conn->SetBatchSend(true);
@@ -254,13 +258,14 @@ void ServerChannel::_OnServDone(std::weak_ptr<ananas::Connection> wconn,
     bool succ = encoder_.m2fEncoder_(response.get(), frame);
     assert (succ);
 
-    // may be called from other thread, so use SafeSend
+    // may be called from other thread, so use SafeSend.
+    // bytes are moved to connection, never copied
     if (encoder_.f2bEncoder_) {
         Buffer bytes = encoder_.f2bEncoder_(frame);
-        conn->SafeSend(bytes.ReadAddr(), bytes.ReadableSize());
+        conn->SafeSend(std::move(bytes));
     } else {
-        const auto& bytes = rsp->serialized_response();
-        conn->SafeSend(bytes);
+        auto& bytes = *rsp->mutable_serialized_response();
+        conn->SafeSend(std::move(bytes));
     }
 }
 
@@ -278,10 +283,10 @@ void ServerChannel::_OnError(const std::exception& err, int code) {
 
     if (encoder_.f2bEncoder_) {
         Buffer bytes = encoder_.f2bEncoder_(frame);
-        conn_->SendPacket(bytes);
+        conn_->SendPacket(std::move(bytes));
     } else {
-        const auto& bytes = rsp->serialized_response();
-        conn_->SendPacket(bytes);
+        auto& bytes = *rsp->mutable_serialized_response();
+        conn_->SendPacket(std::move(bytes));
     }
 }
 
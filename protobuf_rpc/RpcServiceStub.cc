@@ -129,7 +129,8 @@ Future<ClientChannel* > ServiceStub::_Connect(EventLoop* loop, const Endpoint& e
         Application::Instance().Connect(dst,
                                         std::bind(&ServiceStub::_OnNewConnection,
                                                 this,
-                                                std::placeholders::_1),
+                                                std::placeholders::_1,
+                                                ep.proto() == SHM),
                                         std::bind(&ServiceStub::_OnConnFail,
                                                 this,
                                                 std::placeholders::_1,
@@ -158,18 +159,22 @@ void ServiceStub::SetOnCreateChannel(std::function<void (ClientChannel* )> cb) {
     onCreateChannel_ = std::move(cb);
 }
 
-void ServiceStub::_OnNewConnection(Connection* conn) {
+void ServiceStub::_OnNewConnection(Connection* conn, bool shm) {
     assert (conn->GetLoop()->InThisLoop());
 
+    if (shm && !conn->ConnectShm()) {
+        ANANAS_ERR << "ConnectShm failed " << conn->Peer().ToString();
+        _OnConnFail(conn->GetLoop(), conn->Peer());
+        conn->ActiveClose();
+        return;
+    }
+
     auto _ = std::static_pointer_cast<Connection>(conn->shared_from_this());
     auto channel = std::make_shared<ClientChannel>(std::move(_), this);
     conn->SetUserData(channel);
 
     {
-        Endpoint ep;
-        ep.set_proto(TCP);
-        ep.set_ip(conn->Peer().GetIP());
-        ep.set_port(conn->Peer().GetPort());
+        Endpoint ep = EndpointFromSocketAddr(conn->Peer(), conn->IsShm());
         auto& channelMap = channels_[conn->GetLoop()->Id()];
         bool succ = channelMap.insert({ep, channel}).second;
         assert (succ);
@@ -205,10 +210,7 @@ void ServiceStub::_OnConnect(Connection* conn) {
 }
 
 void ServiceStub::_OnDisconnect(Connection* conn) {
-    Endpoint ep;
-    ep.set_proto(TCP);
-    ep.set_ip(conn->Peer().GetIP());
-    ep.set_port(conn->Peer().GetPort());
+    Endpoint ep = EndpointFromSocketAddr(conn->Peer(), conn->IsShm());
 
     auto& channelMap = channels_[conn->GetLoop()->Id()];
     auto it = channelMap.find(ep);
@@ -75,7 +75,7 @@ public:
 private:
     Future<ClientChannel* > _Connect(EventLoop*, const Endpoint& ep);
 
-    void _OnNewConnection(Connection* );
+    void _OnNewConnection(Connection* , bool shm);
     void _OnConnect(Connection* );
     void _OnDisconnect(Connection* );
     void _OnConnFail(EventLoop* loop, const SocketAddr& peer);
@@ -242,7 +242,7 @@ Future<Try<RSP>> ClientChannel::_Invoke(const StringView& method,
 
     // encode and send request
     Buffer bytes = this->_MessageToBytesEncoder(std::move(methodStr), *request);
-    if (!sc->SendPacket(bytes)) {
+    if (!sc->SendPacket(std::move(bytes))) {
         using namespace std;
         string err("SendPacket failed: method [" +
                     method.ToString() +
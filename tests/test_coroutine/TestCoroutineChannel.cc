@@ -0,0 +1,168 @@
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include "coroutine/CoChannel.h"
+#include "coroutine/CoSync.h"
+#include "coroutine/CoroutineScheduler.h"
+#include "net/EventLoop.h"
+#include "net/Application.h"
+
+using std::cerr;
+using std::endl; // for test
+
+using namespace ananas;
+
+const int kProducers = 4;
+const int kConsumers = 4;
+const int kNumbers = 1000;
+
+CoChannel<int> channel(8);
+WaitGroup producersWg;
+WaitGroup consumersWg;
+
+// protected by mutex, consumers are in different loops
+CoMutex mutex;
+long sum = 0;
+long received = 0;
+
+// at most 2 consumers in critical section
+CoSemaphore sema(2);
+std::atomic<int> inSection {0};
+bool succ = false;
+
+// Ping pong across loops: the pinger parks by hand after each Acquire, only
+// the ponger resumes it, a stale post of the semaphore would wake it early.
+const int kPingPongs = 20000;
+CoSemaphore ping(0);
+WaitGroup pingWg;
+CoroutinePtr pinger;
+CoroutineScheduler* pingerSched = nullptr;
+std::atomic<bool> pingerReady {false};
+std::atomic<bool> pingerAcquiring {false};
+std::atomic<bool> pingerParked {false};
+std::atomic<bool> woken {false};
+std::atomic<int> spurious {0};
+
+void Producer(int id) {
+    for (int i = 1; i <= kNumbers; ++ i)
+        channel.Send(i);
+
+    producersWg.Done();
+}
+
+void Closer() {
+    producersWg.Wait();
+    channel.Close();
+}
+
+void Consumer() {
+    int v;
+    while (channel.Recv(v)) {
+        sema.Acquire();
+        int n = ++ inSection;
+        assert (n <= 2);
+        CoroutineScheduler::Self().Yield();
+        -- inSection;
+        sema.Release();
+
+        mutex.Lock();
+        sum += v;
+        ++ received;
+        mutex.Unlock();
+    }
+
+    consumersWg.Done();
+}
+
+void Pinger() {
+    pinger = Coroutine::Current();
+    pingerSched = &CoroutineScheduler::Self();
+    pingerReady = true;
+
+    for (int i = 0; i < kPingPongs; ++ i) {
+        pingerAcquiring = true;
+        ping.Acquire();
+
+        pingerParked = true;
+        Coroutine::Yield();
+        if (!woken.exchange(false))
+            ++ spurious;
+    }
+
+    pingWg.Done();
+}
+
+void Ponger() {
+    while (!pingerReady)
+        CoroutineScheduler::Self().Yield();
+
+    for (int i = 0; i < kPingPongs; ++ i) {
+        // spin, not yield: release while the pinger is going to park
+        while (!pingerAcquiring.exchange(false))
+            ;
+        ping.Release();
+
+        while (!pingerParked.exchange(false))
+            CoroutineScheduler::Self().Yield();
+
+        // give a stale post time to wake the pinger
+        const auto parked = std::chrono::steady_clock::now();
+        while (std::chrono::steady_clock::now() - parked < std::chrono::microseconds(20))
+            ;
+
+        woken = true;
+        pingerSched->Post(pinger);
+    }
+}
+
+void Checker() {
+    consumersWg.Wait();
+    pingWg.Wait();
+
+    const long expect = static_cast<long>(kProducers) * kNumbers * (kNumbers + 1) / 2;
+    cerr << "received " << received << ", sum " << sum << ", expect " << expect
+         << ", spurious wakeups " << spurious << endl;
+    succ = (sum == expect && received == kProducers * kNumbers && spurious == 0);
+    Application::Instance().Exit();
+}
+
+int main(int ac, char* av[]) {
+    auto& app = Application::Instance();
+    app.SetNumOfWorker(2);
+
+    producersWg.Add(kProducers);
+    consumersWg.Add(kConsumers);
+    pingWg.Add(1);
+
+    app.BaseLoop()->ScheduleAfter(std::chrono::milliseconds(100), [&app]() {
+        auto a = app.Next();
+        auto b = app.Next();
+        assert (a != b);
+
+        a->Execute([]() {
+            auto& sched = CoroutineScheduler::Self();
+            for (int i = 0; i < kProducers; ++ i)
+                sched.Spawn(Producer, i);
+            sched.Spawn(Closer);
+            for (int i = 0; i < kConsumers / 2; ++ i)
+                sched.Spawn(Consumer);
+            sched.Spawn(Pinger);
+        });
+
+        b->Execute([]() {
+            auto& sched = CoroutineScheduler::Self();
+            for (int i = 0; i < kConsumers / 2; ++ i)
+                sched.Spawn(Consumer);
+            sched.Spawn(Ponger);
+            sched.Spawn(Checker);
+        });
+    });
+
+    app.Run(ac, av);
+
+    cerr << (succ ? "BYE BYE\n" : "FAILED\n");
+    return succ ? 0 : -1;
+}
+
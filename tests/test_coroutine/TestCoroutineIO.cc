@@ -0,0 +1,113 @@
+
+#include <cassert>
+#include <string>
+#include <iostream>
+#include "coroutine/CoConnection.h"
+#include "coroutine/CoroutineScheduler.h"
+#include "net/Connection.h"
+#include "net/EventLoop.h"
+#include "net/Application.h"
+#include "util/Util.h"
+
+using std::cerr;
+using std::endl; // for test
+
+using namespace ananas;
+
+const uint16_t kPort = 9987;
+const int kLines = 100;
+
+bool succ = false;
+
+// Server: echo line by line
+void EchoSession(CoConnectionPtr stream) {
+    while (true) {
+        auto line = stream->ReadUntil("\r\n");
+        if (line.Empty())
+            break;
+
+        if (!stream->Write(line.Data(), line.Size()))
+            break;
+    }
+
+    cerr << "Server session closed" << endl;
+}
+
+// Client: sequential protocol code
+void ClientSession(CoConnectionPtr stream) {
+    auto& sched = CoroutineScheduler::Self();
+    ANANAS_DEFER {
+        stream->Close();
+        Application::Instance().Exit();
+    };
+
+    for (int i = 0; i < kLines; ++ i) {
+        std::string req = "hello " + std::to_string(i) + "\r\n";
+        if (!stream->Write(req))
+            return;
+
+        auto rsp = stream->ReadUntil("\r\n");
+        if (rsp.ToString() != req) {
+            cerr << "Wrong response " << rsp.ToString() << endl;
+            return;
+        }
+    }
+
+    // pipeline, and read by fixed size
+    stream->Write("abcd\r\nefgh\r\n");
+    auto s = stream->ReadExactly(3);
+    assert (s.ToString() == "abc");
+    s = stream->ReadExactly(9);
+    assert (s.ToString() == "d\r\nefgh\r\n");
+
+    auto start = std::chrono::steady_clock::now();
+    sched.Sleep(std::chrono::milliseconds(50));
+    assert (std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(50));
+
+    // Compute in other loop, and wait result
+    auto fut = Application::Instance().BaseLoop()->Execute([]() {
+        return 42;
+    });
+    auto res = sched.Await(std::move(fut));
+    if (res.HasException() || res.Value() != 42)
+        return;
+
+    // Satisfied at once in this loop, the coroutine never parks
+    res = sched.Await(sched.GetLoop()->Execute([]() {
+        return 43;
+    }));
+    if (res.HasException() || res.Value() != 43 || sched.ReadySize() != 0)
+        return;
+
+    succ = true;
+    cerr << "Client session succ" << endl;
+}
+
+int main(int ac, char* av[]) {
+    auto& app = Application::Instance();
+    app.SetNumOfWorker(2);
+
+    app.Listen("127.0.0.1", kPort, [](Connection* conn) {
+        conn->SetOnConnect([](Connection* c) {
+            CoroutineScheduler::Self().Spawn(EchoSession, CoConnection::Attach(c));
+        });
+    });
+
+    app.BaseLoop()->ScheduleAfter(std::chrono::milliseconds(100), [&app]() {
+        app.Connect("127.0.0.1", kPort, [](Connection* conn) {
+            conn->SetOnConnect([](Connection* c) {
+                CoroutineScheduler::Self().Spawn(ClientSession, CoConnection::Attach(c));
+            });
+        },
+        [&app](EventLoop* , const SocketAddr& peer) {
+            cerr << "Connect failed " << peer.ToString() << endl;
+            app.Exit();
+        });
+    });
+
+    app.Run(ac, av);
+
+    cerr << (succ ? "BYE BYE\n" : "FAILED\n");
+    return succ ? 0 : -1;
+}
+
@@ -0,0 +1,60 @@
+
+#include <atomic>
+#include <cassert>
+#include <iostream>
+#include "coroutine/CoroutineScheduler.h"
+#include "net/EventLoop.h"
+#include "net/Application.h"
+
+using std::cerr;
+using std::endl; // for test
+
+using namespace ananas;
+
+const int kWorkers = 4;
+const int kCoroutinesPerLoop = 100;
+const int kRounds = 10;
+
+std::atomic<int> finished {0};
+
+// Each coroutine gives up cpu several times, it'll be resumed
+// by the scheduler of its own EventLoop.
+void Worker(EventLoop* loop, int id) {
+    for (int i = 0; i < kRounds; ++ i) {
+        assert (loop->InThisLoop());
+        assert (Coroutine::InCoroutine());
+        CoroutineScheduler::Self().Yield();
+    }
+
+    if (++ finished == kWorkers * kCoroutinesPerLoop) {
+        cerr << "All coroutines finished, the last one is " << id << endl;
+        Application::Instance().Exit();
+    }
+}
+
+int main(int ac, char* av[]) {
+    auto& app = Application::Instance();
+    app.SetNumOfWorker(kWorkers);
+
+    app.BaseLoop()->ScheduleAfter(std::chrono::milliseconds(100), [&app]() {
+        for (int i = 0; i < kWorkers; ++ i) {
+            auto loop = app.Next();
+            loop->Execute([loop]() {
+                auto& sched = CoroutineScheduler::Self();
+                assert (sched.GetLoop() == loop);
+                for (int j = 0; j < kCoroutinesPerLoop; ++ j)
+                    sched.Spawn(Worker, loop, j);
+
+                cerr << "Loop " << loop->Id() << " spawned "
+                     << sched.ReadySize() << " coroutines" << endl;
+            });
+        }
+    });
+
+    app.Run(ac, av);
+
+    assert (finished == kWorkers * kCoroutinesPerLoop);
+    cerr << "BYE BYE\n";
+    return 0;
+}
+
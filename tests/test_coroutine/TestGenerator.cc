@@ -0,0 +1,114 @@
+
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include "coroutine/Generator.h"
+
+using std::cerr;
+using std::endl; // for test
+
+using namespace ananas;
+
+// count heap allocations
+std::atomic<long> g_allocs {0};
+
+void* operator new(std::size_t size) {
+    ++ g_allocs;
+    if (void* p = std::malloc(size))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t ) noexcept {
+    std::free(p);
+}
+
+// yield int, receive string, return total length
+std::size_t Accumulate(Generator<int, std::string, std::size_t>::Yielder& yielder, int count) {
+    std::size_t total = 0;
+    for (int i = 0; i < count; ++ i) {
+        std::string s = yielder.Yield(i);
+        total += s.size();
+    }
+
+    return total;
+}
+
+void Fib(Generator<long>::Yielder& yielder, int n) {
+    long a = 0, b = 1;
+    while (n -- > 0) {
+        yielder.Yield(a);
+        long c = a + b;
+        a = b;
+        b = c;
+    }
+}
+
+void Throw(Generator<int>::Yielder& yielder) {
+    yielder.Yield(1);
+    throw std::runtime_error("test exception");
+}
+
+int main() {
+    {
+        Generator<long> fib(Fib, 10);
+        long last = 0;
+        while (fib.Next())
+            last = fib.Value();
+
+        assert (last == 34);
+        assert (fib.IsFinished());
+    }
+
+    {
+        const int kRounds = 10000;
+        Generator<int, std::string, std::size_t> acc(Accumulate, kRounds);
+
+        bool yielded = acc.Next(); // prime
+        assert (yielded);
+        assert (acc.Value() == 0);
+
+        // short string, no heap in std::string
+        long before = g_allocs;
+        for (int i = 1; i < kRounds; ++ i) {
+            yielded = acc.Send(std::string("ab"));
+            assert (yielded);
+            int v = acc.Value();
+            assert (v == i);
+        }
+        long allocs = g_allocs - before;
+
+        yielded = acc.Send(std::string("ab"));
+        assert (!yielded);
+        assert (acc.Result() == 2 * kRounds);
+
+        cerr << "Allocations for " << kRounds << " resumes: " << allocs << endl;
+        assert (allocs == 0);
+    }
+
+    {
+        Generator<int> thrower(Throw);
+        bool yielded = thrower.Next();
+        assert (yielded);
+        bool caught = false;
+        try {
+            thrower.Next();
+        } catch (const std::runtime_error& e) {
+            caught = true;
+        }
+        assert (caught);
+        assert (thrower.IsFinished());
+    }
+
+    cerr << "BYE BYE\n";
+    return 0;
+}
+
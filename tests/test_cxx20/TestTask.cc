@@ -0,0 +1,133 @@
+
+#include <cassert>
+#include <string>
+#include <iostream>
+#include "coroutine/cxx20/Task.h"
+#include "coroutine/cxx20/Awaitable.h"
+#include "net/Connection.h"
+#include "net/EventLoop.h"
+#include "net/Application.h"
+
+using std::cerr;
+using std::endl; // for test
+
+using namespace ananas;
+using namespace ananas::cxx20;
+
+const uint16_t kPort = 9986;
+const int kLines = 100;
+
+bool succ = false;
+
+Task<int> Double(int v) {
+    co_await SleepFor(std::chrono::milliseconds(1));
+    co_return v * 2;
+}
+
+Task<void> Throw() {
+    co_await SleepFor(std::chrono::milliseconds(1));
+    throw std::runtime_error("test exception");
+}
+
+Task<void> EchoSession(AsyncConnectionPtr stream) {
+    while (true) {
+        auto line = co_await stream->ReadUntil("\r\n");
+        if (line.Empty())
+            break;
+
+        if (!co_await stream->Write(line.Data(), line.Size()))
+            break;
+    }
+
+    cerr << "Server session closed" << endl;
+}
+
+Task<bool> ClientSession(AsyncConnectionPtr stream) {
+    for (int i = 0; i < kLines; ++ i) {
+        std::string req = "hello " + std::to_string(i) + "\r\n";
+        if (!co_await stream->Write(req))
+            co_return false;
+
+        auto rsp = co_await stream->ReadUntil("\r\n");
+        if (rsp.ToString() != req) {
+            cerr << "Wrong response " << rsp.ToString() << endl;
+            co_return false;
+        }
+    }
+
+    co_await stream->Write("abcd\r\nefgh\r\n");
+    auto s = co_await stream->ReadExactly(3);
+    if (s.ToString() != "abc")
+        co_return false;
+    s = co_await stream->ReadExactly(9);
+    if (s.ToString() != "d\r\nefgh\r\n")
+        co_return false;
+
+    // nested task
+    int v = co_await Double(21);
+    if (v != 42)
+        co_return false;
+
+    bool caught = false;
+    try {
+        co_await Throw();
+    } catch (const std::exception& e) {
+        caught = true;
+    }
+    if (!caught)
+        co_return false;
+
+    // Compute in other loop, resume in this loop
+    auto loop = EventLoop::Self();
+    int r = co_await Application::Instance().BaseLoop()->Execute([]() {
+        return 42;
+    });
+    if (r != 42 || EventLoop::Self() != loop)
+        co_return false;
+
+    // Satisfied at once, must not nest stack frames
+    int sum = 0;
+    for (int i = 0; i < 1000000; ++ i)
+        sum += co_await loop->Execute([]() {
+            return 1;
+        });
+    if (sum != 1000000)
+        co_return false;
+
+    stream->Close();
+    co_return true;
+}
+
+int main(int ac, char* av[]) {
+    auto& app = Application::Instance();
+    app.SetNumOfWorker(2);
+
+    app.Listen("127.0.0.1", kPort, [](Connection* conn) {
+        conn->SetOnConnect([](Connection* c) {
+            Spawn(c->GetLoop(), EchoSession(AsyncConnection::Attach(c)));
+        });
+    });
+
+    app.BaseLoop()->ScheduleAfter(std::chrono::milliseconds(100), [&app]() {
+        app.Connect("127.0.0.1", kPort, [](Connection* conn) {
+            conn->SetOnConnect([](Connection* c) {
+                Spawn(c->GetLoop(), ClientSession(AsyncConnection::Attach(c)))
+                .Then([](bool ok) {
+                    succ = ok;
+                    cerr << "Client session " << (ok ? "succ" : "failed") << endl;
+                    Application::Instance().Exit();
+                });
+            });
+        },
+        [&app](EventLoop* , const SocketAddr& peer) {
+            cerr << "Connect failed " << peer.ToString() << endl;
+            app.Exit();
+        });
+    });
+
+    app.Run(ac, av);
+
+    cerr << (succ ? "BYE BYE\n" : "FAILED\n");
+    return succ ? 0 : -1;
+}
+
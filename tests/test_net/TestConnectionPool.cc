@@ -0,0 +1,115 @@
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "net/Connection.h"
+#include "net/ConnectionPool.h"
+#include "net/EventLoop.h"
+#include "net/Application.h"
+
+using std::cerr;
+using std::endl; // for test
+
+using namespace ananas;
+
+// Prewarm 2 connections to echo server, checkout 4 while max is 3: the 4th
+// waits for a checkin. Checkouts to a closed port fail together. Idle
+// connections are evicted down to minIdle.
+
+const uint16_t kPort = 9988;
+const uint16_t kDeadPort = 9989;
+const int kCheckouts = 4;
+
+std::shared_ptr<ConnectionPool> pool;
+SocketAddr addr("127.0.0.1", kPort);
+SocketAddr deadAddr("127.0.0.1", kDeadPort);
+
+int accepted = 0;
+int echoed = 0;
+int failed = 0;
+size_t maxBusy = 0;
+size_t idleAfterWarm = 0;
+bool succ = false;
+
+void OnNewConnection(Connection* conn) {
+    ++ accepted;
+}
+
+void CheckEviction() {
+    const size_t idle = pool->IdleCount(addr);
+    cerr << "accepted " << accepted << ", warm idle " << idleAfterWarm
+         << ", echoed " << echoed << ", max busy " << maxBusy
+         << ", failed " << failed << ", idle after eviction " << idle << endl;
+
+    succ = idleAfterWarm == 2 &&
+           echoed == kCheckouts && maxBusy == 3 &&
+           accepted == 3 &&
+           failed == 2 &&
+           idle == 2;
+    Application::Instance().Exit();
+}
+
+void CheckoutDead() {
+    for (int i = 0; i < 2; ++ i) {
+        pool->Checkout(deadAddr).Then([](Try<Connection* >&& c) {
+            if (c.HasException())
+                ++ failed;
+        });
+    }
+
+    // idle timeout is 1s, eviction tick is finer
+    Application::Instance().BaseLoop()->ScheduleAfter(std::chrono::milliseconds(1500), CheckEviction);
+}
+
+void CheckoutAll() {
+    idleAfterWarm = pool->IdleCount(addr);
+
+    for (int i = 0; i < kCheckouts; ++ i) {
+        pool->Checkout(addr).Then([i](Try<Connection* >&& c) {
+            if (c.HasException()) {
+                cerr << "checkout " << i << " failed" << endl;
+                return;
+            }
+
+            Connection* conn = c.Value();
+            maxBusy = std::max(maxBusy, pool->BusyCount(addr));
+
+            const std::string ping = "ping" + std::to_string(i);
+            conn->SetOnMessage([ping](Connection* conn, const char* data, size_t len) {
+                if (len < ping.size())
+                    return size_t(0);
+
+                if (std::string(data, ping.size()) == ping)
+                    ++ echoed;
+
+                // checkin in the callback, the pool replaces it
+                pool->Checkin(conn);
+                if (echoed == kCheckouts)
+                    CheckoutDead();
+
+                return ping.size();
+            });
+            conn->SendPacket(ping);
+        });
+    }
+}
+
+int main(int ac, char* av[]) {
+    auto& app = Application::Instance();
+    app.Listen(addr, OnNewConnection);
+
+    ConnectionPoolOptions options;
+    options.minIdle = 2;
+    options.maxConns = 3;
+    options.idleTimeout = std::chrono::milliseconds(1000);
+    options.connectTimeout = std::chrono::milliseconds(500);
+    pool = std::make_shared<ConnectionPool>(app.BaseLoop(), options);
+    pool->Prewarm(addr);
+
+    app.BaseLoop()->ScheduleAfter(std::chrono::milliseconds(300), CheckoutAll);
+    app.Run(ac, av);
+
+    pool.reset();
+    cerr << (succ ? "BYE BYE\n" : "FAILED\n");
+    return succ ? 0 : -1;
+}
@@ -0,0 +1,146 @@
+#include <unistd.h>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "net/Connection.h"
+#include "net/EventLoop.h"
+#include "net/Application.h"
+#include "util/BufferPool.h"
+
+// Memory cost of idle connections, eg. websocket servers.
+// Usage: ./idle_conn_bench [conns] [shared recv buffer 0/1] [ports] [workers]
+// For 1M connections, raise fs.nr_open and ulimit -n first, and listen on
+// many ports because of loopback ephemeral ports.
+
+using std::cerr;
+using std::endl; // for test
+
+using namespace ananas;
+
+const uint16_t kBasePort = 9900;
+
+size_t conns = 1000000;
+bool shared = true;
+int ports = 32;
+size_t workers = 4;
+
+std::atomic<size_t> serverConns {0};
+std::atomic<size_t> clientConns {0};
+std::atomic<size_t> clientFails {0};
+std::atomic<size_t> lines {0};
+
+size_t RssBytes() {
+    size_t pages = 0, rss = 0;
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if (fp) {
+        if (fscanf(fp, "%zu %zu", &pages, &rss) != 2)
+            rss = 0;
+        fclose(fp);
+    }
+
+    return rss * static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+}
+
+// line protocol, the partial line is left in buffer
+size_t OnLine(Connection* conn, const char* data, size_t len) {
+    const char* end = data + len;
+    const char* p = data;
+    while (true) {
+        const char* crlf = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (!crlf)
+            break;
+
+        ++ lines;
+        p = crlf + 1;
+    }
+
+    return p - data;
+}
+
+void OnNewConnection(Connection* conn) {
+    conn->SetSharedRecvBuffer(shared);
+    conn->SetOnMessage(OnLine);
+    ++ serverConns;
+}
+
+void OnConnect(Connection* conn) {
+    size_t n = ++ clientConns;
+
+    // every 10th connection leaves a partial line in server
+    if (n % 10 == 0)
+        conn->SendPacket(std::string("ping\r\npi"));
+    else
+        conn->SendPacket(std::string("ping\r\n"));
+}
+
+void OnConnFail(EventLoop* , const SocketAddr& ) {
+    ++ clientFails;
+}
+
+void ConnectBatch(size_t start) {
+    auto& app = Application::Instance();
+
+    const size_t kBatch = 1000;
+    size_t i = start;
+    for (; i < conns && i < start + kBatch; ++ i)
+        app.Connect("127.0.0.1", static_cast<uint16_t>(kBasePort + i % ports), OnConnect, OnConnFail);
+
+    if (i < conns) {
+        app.BaseLoop()->ScheduleAfter(std::chrono::milliseconds(5), [i]() {
+            ConnectBatch(i);
+        });
+    }
+}
+
+int main(int ac, char* av[]) {
+    if (ac > 1)
+        conns = static_cast<size_t>(std::stoul(av[1]));
+    if (ac > 2)
+        shared = std::stoi(av[2]) != 0;
+    if (ac > 3)
+        ports = std::stoi(av[3]);
+    if (ac > 4)
+        workers = static_cast<size_t>(std::stoi(av[4]));
+
+    // both client and server fds are in this process
+    EventLoop::SetMaxOpenFd(2 * conns + 1024);
+
+    auto& app = Application::Instance();
+    app.SetNumOfWorker(workers);
+    for (int i = 0; i < ports; ++ i)
+        app.Listen("127.0.0.1", static_cast<uint16_t>(kBasePort + i), OnNewConnection);
+
+    const size_t rssBefore = RssBytes();
+    const auto poolBefore = BufferPool::GlobalStats();
+
+    app.BaseLoop()->ScheduleAfter(std::chrono::milliseconds(200), []() {
+        ConnectBatch(0);
+    });
+
+    app.BaseLoop()->ScheduleAfterWithRepeat<kForever>(std::chrono::seconds(1), [&]() {
+        size_t done = clientConns + clientFails;
+        cerr << "server " << serverConns << ", client " << clientConns
+             << ", failed " << clientFails << ", lines " << lines << endl;
+
+        if (done < conns || lines < clientConns)
+            return;
+
+        const size_t n = serverConns ? serverConns.load() : 1;
+        const size_t rss = RssBytes() - rssBefore;
+        const auto pool = BufferPool::GlobalStats();
+
+        cerr << "shared recv buffer: " << shared << endl;
+        cerr << "RSS per connection pair: " << rss / n << " bytes" << endl;
+        cerr << "sizeof(Connection): " << sizeof(Connection) << endl;
+        cerr << "Pool bytes per connection: " << (pool.usedBytes - poolBefore.usedBytes) / n << endl;
+        cerr << "BufferPool: " << pool.ToString() << endl;
+
+        Application::Instance().Exit();
+    });
+
+    app.Run(ac, av);
+
+    return 0;
+}
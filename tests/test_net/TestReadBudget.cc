@@ -0,0 +1,130 @@
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <thread>
+
+#include "net/Connection.h"
+#include "net/EventLoop.h"
+#include "net/Application.h"
+
+using std::cerr;
+using std::endl; // for test
+
+using namespace ananas;
+
+// Two firehose clients, each read event handles at most kBudgetMessages
+// messages, the rest are served round-robin in next loop iterations.
+
+const uint16_t kPort = 9980;
+const int kProducers = 2;
+const size_t kMessageSize = 100;
+const size_t kMessages = 100 * 1000;
+const size_t kBudgetMessages = 16;
+
+struct Stat {
+    size_t messages = 0;
+    size_t inIteration = 0;
+    size_t maxInIteration = 0;
+    bool ok = true;
+};
+
+std::map<Connection*, Stat> stats;
+int finished = 0;
+std::atomic<bool> succ {false};
+
+void Producer() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(kPort);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0) {
+        ::close(fd);
+        Application::Instance().Exit();
+        return;
+    }
+
+    char buf[kMessageSize * 100];
+    size_t sent = 0;
+    while (sent < kMessages) {
+        size_t n = std::min<size_t>(100, kMessages - sent);
+        for (size_t i = 0; i < n; ++ i)
+            std::fill_n(buf + i * kMessageSize, kMessageSize, static_cast<char>('a' + (sent + i) % 26));
+
+        size_t len = n * kMessageSize;
+        size_t off = 0;
+        while (off < len) {
+            ssize_t bytes = ::send(fd, buf + off, len - off, 0);
+            if (bytes <= 0) {
+                ::close(fd);
+                return;
+            }
+            off += static_cast<size_t>(bytes);
+        }
+        sent += n;
+    }
+
+    ::close(fd);
+}
+
+size_t OnMessage(Connection* conn, const char* data, size_t len) {
+    if (len < kMessageSize)
+        return 0;
+
+    auto& s = stats[conn];
+    s.ok = s.ok && data[0] == static_cast<char>('a' + s.messages % 26) && data[kMessageSize - 1] == data[0];
+    ++ s.messages;
+    s.maxInIteration = std::max(s.maxInIteration, ++ s.inIteration);
+
+    if (s.messages == kMessages && ++ finished == kProducers) {
+        bool ok = true;
+        for (const auto& kv : stats) {
+            cerr << "messages " << kv.second.messages
+                 << ", max in one iteration " << kv.second.maxInIteration << endl;
+            ok = ok && kv.second.ok && kv.second.maxInIteration <= kBudgetMessages;
+        }
+
+        succ = ok;
+        Application::Instance().Exit();
+    }
+
+    return kMessageSize;
+}
+
+void OnNewConnection(Connection* conn) {
+    stats[conn];
+    conn->SetOnMessage(OnMessage);
+}
+
+int main(int ac, char* av[]) {
+    auto& app = Application::Instance();
+    app.BaseLoop()->SetReadBudget(0, kBudgetMessages);
+    app.BaseLoop()->AddIterationHook([]() {
+        for (auto& kv : stats)
+            kv.second.inIteration = 0;
+        return false;
+    });
+    app.Listen("127.0.0.1", kPort, OnNewConnection);
+
+    std::vector<std::thread> producers;
+    for (int i = 0; i < kProducers; ++ i)
+        producers.emplace_back(Producer);
+
+    app.Run(ac, av);
+    for (auto& t : producers)
+        t.join();
+
+    cerr << (succ ? "BYE BYE\n" : "FAILED\n");
+    return succ ? 0 : -1;
+}
@@ -0,0 +1,137 @@
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include "net/Connection.h"
+#include "net/EventLoop.h"
+#include "net/Application.h"
+
+using std::cerr;
+using std::endl; // for test
+
+using namespace ananas;
+
+// The server doesn't consume at first, the receive buffer must stop at its
+// limit. Then it consumes with PauseRead/ResumeRead every few chunks, resumed
+// by timer or at once in the callback.
+
+const uint16_t kPort = 9981;
+const size_t kTotal = 16 * 1024 * 1024;
+const size_t kMaxRecvBuf = 64 * 1024;
+const size_t kPauseEvery = 1024 * 1024;
+
+bool consuming = false;
+size_t maxBuffered = 0;
+size_t consumed = 0;
+size_t nextPause = kPauseEvery;
+int pauses = 0;
+bool ok = true;
+std::atomic<bool> succ {false};
+
+char Pattern(size_t i) {
+    return static_cast<char>('a' + i % 26);
+}
+
+void Producer() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(kPort);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0) {
+        ::close(fd);
+        Application::Instance().Exit();
+        return;
+    }
+
+    char buf[64 * 1024];
+    size_t sent = 0;
+    while (sent < kTotal) {
+        size_t n = std::min(sizeof buf, kTotal - sent);
+        for (size_t i = 0; i < n; ++ i)
+            buf[i] = Pattern(sent + i);
+
+        ssize_t bytes = ::send(fd, buf, n, 0);
+        if (bytes <= 0)
+            break;
+        sent += static_cast<size_t>(bytes);
+    }
+
+    ::close(fd);
+}
+
+size_t OnMessage(Connection* conn, const char* data, size_t len) {
+    maxBuffered = std::max(maxBuffered, len);
+    if (!consuming)
+        return 0;
+
+    for (size_t i = 0; i < len; ++ i)
+        ok = ok && data[i] == Pattern(consumed + i);
+    consumed += len;
+
+    if (consumed == kTotal) {
+        succ = ok && maxBuffered <= kMaxRecvBuf && pauses > 0;
+        Application::Instance().Exit();
+    } else if (consumed >= nextPause) {
+        nextPause += kPauseEvery;
+        ++ pauses;
+
+        conn->PauseRead();
+        assert (conn->IsReadPaused());
+
+        if (pauses % 2) {
+            // resumed in callback, this message must not be delivered again
+            conn->ResumeRead();
+        } else {
+            auto c = std::static_pointer_cast<Connection>(conn->shared_from_this());
+            conn->GetLoop()->ScheduleAfter(std::chrono::milliseconds(10), [c]() {
+                c->ResumeRead();
+            });
+        }
+    }
+
+    return len;
+}
+
+void OnNewConnection(Connection* conn) {
+    conn->SetMaxRecvBufferSize(kMaxRecvBuf);
+    conn->SetOnMessage(OnMessage);
+    conn->SetOnConnect([](Connection* c) {
+        auto self = std::static_pointer_cast<Connection>(c->shared_from_this());
+        c->GetLoop()->ScheduleAfter(std::chrono::milliseconds(300), [self]() {
+            if (!self->IsReadPaused() || self->PeekRecvBuffer().Size() != kMaxRecvBuf) {
+                cerr << "not paused by full buffer\n";
+                Application::Instance().Exit();
+                return;
+            }
+
+            consuming = true;
+            self->ResumeRead();
+        });
+    });
+}
+
+int main(int ac, char* av[]) {
+    auto& app = Application::Instance();
+    app.Listen("127.0.0.1", kPort, OnNewConnection);
+
+    std::thread producer(Producer);
+    app.Run(ac, av);
+    producer.join();
+
+    cerr << "consumed " << consumed << ", max buffered " << maxBuffered
+         << ", pauses " << pauses << endl;
+    cerr << (succ ? "BYE BYE\n" : "FAILED\n");
+    return succ ? 0 : -1;
+}
@@ -0,0 +1,116 @@
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "net/Connection.h"
+#include "net/EventLoop.h"
+#include "net/Application.h"
+
+using std::cerr;
+using std::endl; // for test
+
+using namespace ananas;
+
+// Many threads SafeSend to one connection, like responses made in thread
+// pool. Lines of each thread must arrive in order.
+
+const uint16_t kPort = 9978;
+const int kThreads = 4;
+const int kLines = 20000;
+
+std::vector<std::thread> senders;
+std::atomic<bool> succ {false};
+
+void Sender(std::shared_ptr<Connection> conn, int id) {
+    for (int i = 0; i < kLines; ++ i) {
+        std::string line = std::to_string(id) + " " + std::to_string(i) + "\n";
+        switch (i % 3) {
+        case 0:
+            conn->SafeSend(std::move(line));
+            break;
+
+        case 1:
+            conn->SafeSend(line);
+            break;
+
+        default:
+            conn->SafeSend(line.data(), line.size());
+            break;
+        }
+    }
+}
+
+void OnNewConnection(Connection* conn) {
+    auto c = std::static_pointer_cast<Connection>(conn->shared_from_this());
+    for (int i = 0; i < kThreads; ++ i)
+        senders.emplace_back(Sender, c, i);
+}
+
+void Receiver() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(kPort);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0) {
+        ::close(fd);
+        Application::Instance().Exit();
+        return;
+    }
+
+    std::vector<int> next(kThreads, 0);
+    int total = 0;
+    bool ok = true;
+    std::string pending;
+    char buf[64 * 1024];
+    while (total < kThreads * kLines) {
+        ssize_t bytes = ::recv(fd, buf, sizeof buf, 0);
+        if (bytes <= 0)
+            break;
+
+        pending.append(buf, bytes);
+        std::string::size_type start = 0, end;
+        while ((end = pending.find('\n', start)) != std::string::npos) {
+            std::istringstream line(pending.substr(start, end - start));
+            int id = -1, seq = -1;
+            line >> id >> seq;
+            if (id < 0 || id >= kThreads || seq != next[id] ++)
+                ok = false;
+
+            ++ total;
+            start = end + 1;
+        }
+        pending.erase(0, start);
+    }
+
+    ::close(fd);
+
+    cerr << "received " << total << " lines" << endl;
+    succ = ok && total == kThreads * kLines;
+    Application::Instance().Exit();
+}
+
+int main(int ac, char* av[]) {
+    auto& app = Application::Instance();
+    app.Listen("127.0.0.1", kPort, OnNewConnection);
+
+    std::thread receiver(Receiver);
+    app.Run(ac, av);
+    receiver.join();
+    for (auto& t : senders)
+        t.join();
+
+    cerr << (succ ? "BYE BYE\n" : "FAILED\n");
+    return succ ? 0 : -1;
+}
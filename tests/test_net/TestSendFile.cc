@@ -0,0 +1,79 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "net/Connection.h"
+#include "net/EventLoop.h"
+#include "net/Application.h"
+
+using std::cerr;
+using std::endl; // for test
+
+using namespace ananas;
+
+const uint16_t kPort = 9985;
+const size_t kOffset = 100;
+const size_t kFileBytes = 8 * 1024 * 1024;
+
+std::string content; // whole file
+std::string received;
+int fileFd = -1;
+bool succ = false;
+
+void OnNewConnection(Connection* conn) {
+    conn->SetOnConnect([](Connection* c) {
+        // file segment is in order with packets
+        c->SendPacket(std::string("HEAD\n"));
+        bool ok = c->SendFile(fileFd, kOffset, kFileBytes);
+        assert (ok);
+        c->SendPacket(std::string("TAIL\n"));
+        cerr << "Pending bytes " << c->PendingSendBytes() << endl;
+
+        // wait for all bytes sent
+        c->ActiveClose();
+    });
+}
+
+void OnConnect(Connection* conn) {
+    conn->SetOnMessage([](Connection* , const char* data, size_t len) {
+        received.append(data, len);
+        return len;
+    });
+
+    conn->SetOnDisconnect([](Connection* ) {
+        std::string expect = "HEAD\n" + content.substr(kOffset, kFileBytes) + "TAIL\n";
+        succ = (received == expect);
+        cerr << "Received " << received.size() << " bytes, expect " << expect.size() << endl;
+        Application::Instance().Exit();
+    });
+}
+
+int main(int ac, char* av[]) {
+    char path[] = "/tmp/ananas_sendfile_XXXXXX";
+    fileFd = ::mkstemp(path);
+    assert (fileFd != -1);
+    ::unlink(path);
+
+    content.resize(kOffset + kFileBytes + 100);
+    for (size_t i = 0; i < content.size(); ++ i)
+        content[i] = static_cast<char>(::rand());
+
+    auto bytes = ::write(fileFd, content.data(), content.size());
+    assert (bytes == static_cast<ssize_t>(content.size()));
+
+    auto& app = Application::Instance();
+    app.Listen("127.0.0.1", kPort, OnNewConnection);
+    app.Connect("127.0.0.1", kPort, OnConnect, [](EventLoop* , const SocketAddr& ) {
+        cerr << "Connect failed\n";
+        Application::Instance().Exit();
+    });
+
+    app.Run(ac, av);
+    ::close(fileFd);
+
+    cerr << (succ ? "BYE BYE\n" : "FAILED\n");
+    return succ ? 0 : -1;
+}
@@ -0,0 +1,75 @@
+
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "net/Connection.h"
+#include "net/EventLoop.h"
+#include "net/Application.h"
+
+using std::cerr;
+using std::endl; // for test
+
+using namespace ananas;
+
+// Echo server: all accepted connections share one callback table, set by
+// Listen, no new connection callback. Each client sends hello and closes
+// when it's echoed.
+
+const uint16_t kPort = 9977;
+const int kClients = 10;
+
+std::weak_ptr<ConnectionCallbacks> shared;
+int echoed = 0;
+int disconnects = 0;
+bool sharedByAll = true;
+std::atomic<bool> succ {false};
+
+void OnConnect(Connection* conn) {
+    conn->SetOnMessage([](Connection* c, const char* data, size_t len) {
+        if (std::string(data, len) == "hello")
+            ++ echoed;
+
+        c->ActiveClose();
+        return len;
+    });
+
+    conn->SendPacket("hello", 5);
+}
+
+int main(int ac, char* av[]) {
+    auto callbacks = std::make_shared<ConnectionCallbacks>();
+    callbacks->onConnect = [](Connection* ) {
+        // each connection holds the table, instead of a copy
+        auto table = shared.lock();
+        sharedByAll = sharedByAll && table && table.use_count() > 2;
+    };
+    callbacks->onMessage = [](Connection* conn, const char* data, size_t len) {
+        conn->SendPacket(data, len);
+        return len;
+    };
+    callbacks->onDisconnect = [](Connection* ) {
+        if (++ disconnects == kClients) {
+            succ = sharedByAll && echoed == kClients;
+            Application::Instance().Exit();
+        }
+    };
+    shared = callbacks;
+
+    auto& app = Application::Instance();
+    app.Listen("127.0.0.1", kPort, std::move(callbacks), NewTcpConnCallback());
+
+    for (int i = 0; i < kClients; ++ i) {
+        app.Connect("127.0.0.1", kPort, OnConnect, [](EventLoop* , const SocketAddr& ) {
+            cerr << "Connect failed\n";
+            Application::Instance().Exit();
+        });
+    }
+
+    app.Run(ac, av);
+
+    cerr << "echoed " << echoed << ", disconnects " << disconnects << endl;
+    cerr << (succ ? "BYE BYE\n" : "FAILED\n");
+    return succ ? 0 : -1;
+}
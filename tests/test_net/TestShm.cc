@@ -0,0 +1,148 @@
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "net/Connection.h"
+#include "net/EventLoop.h"
+#include "net/Application.h"
+
+using std::cerr;
+using std::endl; // for test
+
+using namespace ananas;
+
+// Connect on unix socket and move to shared memory rings, the server echoes
+// length prefixed frames. The ring is small, so the large frame is gathered,
+// small frames are pipelined, and one frame is sent from file.
+
+const size_t kRingSize = 64 * 1024;
+const size_t kLarge = 1024 * 1024;
+const size_t kFileFrame = 200 * 1024;
+const int kSmall = 2000;
+
+std::string path;
+std::string filePath;
+std::vector<std::string> frames; // to send and expect back
+size_t echoed = 0;
+std::atomic<bool> serverShm {false};
+std::atomic<bool> succ {false};
+
+std::string MakeFrame(size_t len, char c) {
+    std::string frame(sizeof(uint32_t) + len, c);
+    uint32_t n = static_cast<uint32_t>(len);
+    memcpy(&frame[0], &n, sizeof n);
+    return frame;
+}
+
+// Return bytes of complete frames
+size_t ParseFrames(const char* data, size_t len, std::vector<StringView>& out) {
+    size_t offset = 0;
+    while (len - offset >= sizeof(uint32_t)) {
+        uint32_t n;
+        memcpy(&n, data + offset, sizeof n);
+        if (len - offset - sizeof n < n)
+            break;
+
+        out.push_back(StringView(data + offset, sizeof n + n));
+        offset += sizeof n + n;
+    }
+
+    return offset;
+}
+
+size_t OnServerMessage(Connection* conn, const char* data, size_t len) {
+    serverShm = conn->IsShm();
+
+    std::vector<StringView> out;
+    size_t bytes = ParseFrames(data, len, out);
+    for (const auto& f : out)
+        conn->SendPacket(f.Data(), f.Size());
+
+    return bytes;
+}
+
+void OnNewConnection(Connection* conn) {
+    conn->AcceptShm();
+    conn->SetOnMessage(OnServerMessage);
+}
+
+size_t OnClientMessage(Connection* conn, const char* data, size_t len) {
+    std::vector<StringView> out;
+    size_t bytes = ParseFrames(data, len, out);
+    for (const auto& f : out) {
+        if (echoed >= frames.size() ||
+            f.Size() != frames[echoed].size() ||
+            memcmp(f.Data(), frames[echoed].data(), f.Size()) != 0) {
+            cerr << "bad echo frame " << echoed << ", size " << f.Size() << endl;
+            Application::Instance().Exit();
+            return bytes;
+        }
+
+        ++ echoed;
+    }
+
+    if (echoed == frames.size()) {
+        cerr << "echoed " << echoed << " frames, server shm " << serverShm
+             << ", client shm " << conn->IsShm() << endl;
+        succ = serverShm && conn->IsShm();
+        Application::Instance().Exit();
+    }
+
+    return bytes;
+}
+
+void OnConnect(Connection* conn) {
+    conn->SetOnMessage(OnClientMessage);
+    if (!conn->ConnectShm(kRingSize)) {
+        cerr << "ConnectShm failed" << endl;
+        Application::Instance().Exit();
+        return;
+    }
+
+    for (int i = 0; i < kSmall; ++ i) {
+        frames.push_back(MakeFrame(1 + i % 300, 'a' + i % 26));
+        conn->SendPacket(frames.back());
+    }
+
+    // larger than ring
+    frames.push_back(MakeFrame(kLarge, 'L'));
+    conn->SendPacket(frames.back());
+
+    frames.push_back(MakeFrame(kFileFrame, 'F'));
+    int fd = ::open(filePath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (::write(fd, frames.back().data(), frames.back().size()) != static_cast<ssize_t>(frames.back().size()))
+        cerr << "write file failed" << endl;
+    conn->SendFile(fd, 0, frames.back().size());
+    ::close(fd);
+
+    for (int i = 0; i < kSmall; ++ i) {
+        frames.push_back(MakeFrame(1 + i % 100, 'A' + i % 26));
+        conn->SendPacket(frames.back());
+    }
+}
+
+int main(int ac, char* av[]) {
+    path = "/tmp/ananas_shm_test_" + std::to_string(::getpid()) + ".sock";
+    filePath = "/tmp/ananas_shm_test_" + std::to_string(::getpid()) + ".dat";
+
+    auto& app = Application::Instance();
+    app.SetNumOfWorker(2); // server and client may be in different threads
+    SocketAddr addr("unix:" + path);
+    app.Listen(addr, OnNewConnection);
+    app.Connect(addr, OnConnect, [](EventLoop* , const SocketAddr& peer) {
+        cerr << "connect failed " << peer.ToString() << endl;
+        Application::Instance().Exit();
+    });
+
+    app.Run(ac, av);
+    ::unlink(path.c_str());
+    ::unlink(filePath.c_str());
+
+    cerr << (succ ? "BYE BYE\n" : "FAILED\n");
+    return succ ? 0 : -1;
+}
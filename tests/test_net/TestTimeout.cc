@@ -0,0 +1,137 @@
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "net/Connection.h"
+#include "net/EventLoop.h"
+#include "net/Application.h"
+
+using std::cerr;
+using std::endl; // for test
+
+using namespace ananas;
+
+// 1st connection: idle timeout, the client never sends.
+// 2nd connection: read timeout, the client sends for a while then stops.
+// 3rd connection: write timeout, the client never reads.
+
+const uint16_t kPort = 9979;
+const auto kTimeoutMs = std::chrono::milliseconds(300);
+
+int accepted = 0;
+std::atomic<int> writeTimeouts {0};
+std::atomic<bool> succ {true};
+
+using Clock = std::chrono::steady_clock;
+
+long ElapsedMs(Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+}
+
+int Connect() {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(kPort);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0) {
+        ::close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// Return true if closed by server in [minMs, maxMs]
+bool WaitClose(int fd, Clock::time_point start, long minMs, long maxMs) {
+    char buf[64 * 1024];
+    while (true) {
+        ssize_t bytes = ::recv(fd, buf, sizeof buf, 0);
+        if (bytes > 0)
+            continue;
+
+        long ms = ElapsedMs(start);
+        cerr << "closed after " << ms << "ms, expect [" << minMs << ", " << maxMs << "]" << endl;
+        return ms >= minMs && ms <= maxMs;
+    }
+}
+
+void Client() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // idle
+    int fd = Connect();
+    auto start = Clock::now();
+    if (fd < 0 || !WaitClose(fd, start, 250, 1000))
+        succ = false;
+    ::close(fd);
+
+    // read timeout is delayed by sending
+    fd = Connect();
+    for (int i = 0; i < 10; ++ i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        ::send(fd, "x", 1, 0);
+    }
+    start = Clock::now();
+    if (fd < 0 || !WaitClose(fd, start, 250, 1000))
+        succ = false;
+    ::close(fd);
+
+    // write stall, don't read
+    fd = Connect();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    if (fd < 0 || writeTimeouts != 1)
+        succ = false;
+    ::close(fd);
+
+    Application::Instance().Exit();
+}
+
+void OnNewConnection(Connection* conn) {
+    switch (accepted ++) {
+    case 0:
+        conn->SetIdleTimeout(kTimeoutMs);
+        break;
+
+    case 1:
+        conn->SetReadTimeout(kTimeoutMs);
+        conn->SetOnMessage([](Connection* , const char* , size_t len) {
+            return len;
+        });
+        break;
+
+    default:
+        conn->SetWriteTimeout(kTimeoutMs);
+        conn->SetOnTimeout([](Connection* c, TimeoutType type) {
+            if (type == TimeoutType::eWrite)
+                ++ writeTimeouts;
+            c->Shutdown(ShutdownMode::eSM_Both); // drop the pending data
+            c->ActiveClose();
+        });
+        conn->SetOnConnect([](Connection* c) {
+            std::string data(32 * 1024 * 1024, 'x');
+            c->SendPacket(std::move(data));
+        });
+        break;
+    }
+}
+
+int main(int ac, char* av[]) {
+    auto& app = Application::Instance();
+    app.Listen("127.0.0.1", kPort, OnNewConnection);
+
+    std::thread client(Client);
+    app.Run(ac, av);
+    client.join();
+
+    cerr << (succ ? "BYE BYE\n" : "FAILED\n");
+    return succ ? 0 : -1;
+}
@@ -0,0 +1,139 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <atomic>
+#include <iostream>
+#include <string>
+
+#include "net/Connection.h"
+#include "net/EventLoop.h"
+#include "net/Application.h"
+
+using std::cerr;
+using std::endl; // for test
+
+using namespace ananas;
+
+// Listen and connect on unix socket, pass a pipe to the server after
+// a large packet, the server writes to the pipe. Listen never removes a
+// regular file or the socket of a live server at the path, only a stale one.
+
+const size_t kBulk = 1024 * 1024;
+
+std::string path;
+int pipeFds[2] = {-1, -1};
+
+size_t bulkReceived = 0;
+size_t fdsAtMark = 0;
+size_t bulkAtMark = 0;
+std::string reply;
+bool pathKept = false;
+std::atomic<bool> succ {false};
+
+size_t OnServerMessage(Connection* conn, const char* data, size_t len) {
+    for (size_t i = 0; i < len; ++ i) {
+        switch (data[i]) {
+        case 'F': {
+            auto fds = conn->TakeReceivedFds();
+            fdsAtMark = fds.size();
+            bulkAtMark = bulkReceived;
+            for (int fd : fds) {
+                if (::write(fd, "hello", 5) != 5)
+                    cerr << "write pipe failed" << endl;
+                ::close(fd);
+            }
+            break;
+        }
+
+        case '\n':
+            conn->SendPacket("done\n", 5);
+            break;
+
+        default:
+            ++ bulkReceived;
+            break;
+        }
+    }
+
+    return len;
+}
+
+void OnNewConnection(Connection* conn) {
+    conn->SetFdPassing(true);
+    conn->SetOnMessage(OnServerMessage);
+}
+
+void OnConnect(Connection* conn) {
+    conn->SetOnMessage([](Connection* c, const char* data, size_t len) {
+        reply.append(data, len);
+        if (reply.size() < 5)
+            return len;
+
+        char buf[8] {};
+        ssize_t bytes = ::read(pipeFds[0], buf, sizeof buf);
+
+        cerr << "reply " << reply.substr(0, 4)
+             << ", bulk " << bulkReceived << ", fds " << fdsAtMark
+             << ", peer " << c->Peer().ToString() << endl;
+
+        succ = reply == "done\n" &&
+               bulkReceived == kBulk && bulkAtMark == kBulk &&
+               fdsAtMark == 1 &&
+               bytes == 5 && std::string(buf, 5) == "hello" &&
+               c->Peer().IsUnix() &&
+               pathKept;
+        Application::Instance().Exit();
+        return len;
+    });
+
+    // fds must keep order with the pending bulk
+    std::string bulk(kBulk, 'a');
+    conn->SendPacket(std::move(bulk));
+    conn->SendFds(&pipeFds[1], 1, "F", 1);
+    conn->SendPacket("\n", 1);
+
+    // server has its own copy
+    ::close(pipeFds[1]);
+}
+
+int main(int ac, char* av[]) {
+    path = "/tmp/ananas_unix_test_" + std::to_string(::getpid()) + ".sock";
+    if (::pipe(pipeFds) != 0)
+        return -1;
+
+    auto& app = Application::Instance();
+    SocketAddr addr("unix:" + path);
+
+    // not a socket
+    ::close(::open(path.c_str(), O_CREAT | O_WRONLY, 0600));
+    struct stat st;
+    pathKept = !app.BaseLoop()->Listen(addr, OnNewConnection) &&
+               ::stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+    ::unlink(path.c_str());
+
+    // live server
+    sockaddr_un un {};
+    un.sun_family = AF_UNIX;
+    path.copy(un.sun_path, sizeof un.sun_path - 1);
+    int live = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (::bind(live, reinterpret_cast<sockaddr*>(&un), sizeof un) != 0 || ::listen(live, 1) != 0)
+        return -1;
+    pathKept = pathKept && !app.BaseLoop()->Listen(addr, OnNewConnection);
+
+    // closed without unlink, the stale socket file is taken over
+    ::close(live);
+    app.Listen(addr, OnNewConnection);
+    app.Connect(addr, OnConnect, [](EventLoop* , const SocketAddr& peer) {
+        cerr << "connect failed " << peer.ToString() << endl;
+        Application::Instance().Exit();
+    });
+
+    app.Run(ac, av);
+    ::unlink(path.c_str());
+
+    cerr << (succ ? "BYE BYE\n" : "FAILED\n");
+    return succ ? 0 : -1;
+}
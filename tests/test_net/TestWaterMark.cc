@@ -0,0 +1,212 @@
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "net/Connection.h"
+#include "net/EventLoop.h"
+#include "net/Application.h"
+
+using std::cerr;
+using std::endl; // for test
+
+using namespace ananas;
+
+// Proxy: bytes from producer are forwarded to a consumer which reads late.
+// The consumer connection pauses reading of producer at high water mark,
+// so the proxy's memory is bounded.
+// Then another consumer never reads and is closed above high water mark,
+// its producer must be resumed.
+
+const uint16_t kPort = 9982;
+const size_t kTotal = 32 * 1024 * 1024;
+const size_t kHigh = 1024 * 1024;
+const size_t kLow = 128 * 1024;
+
+std::shared_ptr<Connection> consumer;
+size_t maxPending = 0;
+int highCount = 0;
+int lowCount = 0;
+std::atomic<bool> succ {false};
+
+// never reads, closed above high water mark
+std::shared_ptr<Connection> deadConsumer;
+std::atomic<bool> deadHigh {false};
+std::atomic<size_t> orphanReceived {0};
+
+char Pattern(size_t i) {
+    return static_cast<char>('a' + i % 26);
+}
+
+int Connect() {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(kPort);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0) {
+        ::close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+void Producer(int fd, size_t total) {
+    char buf[64 * 1024];
+    size_t sent = 0;
+    while (sent < total) {
+        size_t n = std::min(sizeof buf, total - sent);
+        for (size_t i = 0; i < n; ++ i)
+            buf[i] = Pattern(sent + i);
+
+        ssize_t bytes = ::send(fd, buf, n, 0);
+        if (bytes <= 0)
+            break;
+        sent += static_cast<size_t>(bytes);
+    }
+
+    ::close(fd);
+}
+
+void Consumer(int fd) {
+    // slow peer
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+    char buf[64 * 1024];
+    size_t received = 0;
+    bool ok = true;
+    while (received < kTotal) {
+        ssize_t bytes = ::recv(fd, buf, sizeof buf, 0);
+        if (bytes <= 0)
+            break;
+
+        for (ssize_t i = 0; i < bytes; ++ i)
+            ok = ok && buf[i] == Pattern(received + i);
+        received += static_cast<size_t>(bytes);
+    }
+
+    ::close(fd);
+
+    cerr << "received " << received << ", max pending " << maxPending
+         << ", high " << highCount << ", low " << lowCount << endl;
+
+    Application::Instance().BaseLoop()->Execute([ok, received]() {
+        succ = ok && received == kTotal &&
+               highCount > 0 && lowCount > 0 &&
+               maxPending < kHigh + 512 * 1024;
+    }).Wait();
+}
+
+bool CloseAboveHighWater() {
+    int c = Connect();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    int p = Connect();
+    if (c < 0 || p < 0)
+        return false;
+
+    std::thread producer(Producer, p, kTotal);
+    while (!deadHigh)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    // unread data makes RST, consumer is closed by error
+    ::close(c);
+
+    // producer is resumed and sends all
+    for (int i = 0; i < 500 && orphanReceived < kTotal; ++ i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    const bool ok = orphanReceived == kTotal;
+    if (!ok)
+        ::shutdown(p, SHUT_RDWR); // wake up the blocked producer
+
+    producer.join();
+    cerr << "after consumer closed, upstream received " << orphanReceived << endl;
+    return ok;
+}
+
+void OnNewConnection(Connection* conn) {
+    static int accepted = 0;
+    ++ accepted;
+
+    if (accepted == 4) {
+        deadConsumer->AddUpstream(std::static_pointer_cast<Connection>(conn->shared_from_this()));
+        conn->SetOnMessage([](Connection* , const char* data, size_t len) {
+            deadConsumer->SendPacket(data, len); // fails after closed
+            orphanReceived += len;
+            return len;
+        });
+        return;
+    }
+
+    if (accepted == 3) {
+        deadConsumer = std::static_pointer_cast<Connection>(conn->shared_from_this());
+        conn->SetSendWaterMarks(kHigh, kLow, HighWaterPolicy::ePauseUpstream);
+        conn->SetOnHighWaterMark([](Connection* , size_t ) {
+            deadHigh = true;
+        });
+        return;
+    }
+
+    if (accepted == 1) {
+        consumer = std::static_pointer_cast<Connection>(conn->shared_from_this());
+        conn->SetSendWaterMarks(kHigh, kLow, HighWaterPolicy::ePauseUpstream);
+        conn->SetOnHighWaterMark([](Connection* , size_t ) {
+            ++ highCount;
+        });
+        conn->SetOnLowWaterMark([](Connection* ) {
+            ++ lowCount;
+        });
+        return;
+    }
+
+    consumer->AddUpstream(std::static_pointer_cast<Connection>(conn->shared_from_this()));
+    conn->SetOnMessage([](Connection* , const char* data, size_t len) {
+        consumer->SendPacket(data, len);
+        maxPending = std::max(maxPending, consumer->PendingSendBytes());
+        return len;
+    });
+}
+
+int main(int ac, char* av[]) {
+    auto& app = Application::Instance();
+    app.Listen("127.0.0.1", kPort, OnNewConnection);
+
+    std::thread client([]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        int c = Connect();
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        int p = Connect();
+        if (c < 0 || p < 0) {
+            Application::Instance().Exit();
+            return;
+        }
+
+        std::thread producer(Producer, p, kTotal);
+        Consumer(c);
+        producer.join();
+
+        if (!CloseAboveHighWater())
+            succ = false;
+
+        Application::Instance().Exit();
+    });
+
+    app.Run(ac, av);
+    client.join();
+    consumer.reset();
+    deadConsumer.reset();
+
+    cerr << "total pending " << Connection::TotalPendingSendBytes() << endl;
+    cerr << (succ ? "BYE BYE\n" : "FAILED\n");
+    return succ ? 0 : -1;
+}
@@ -0,0 +1,92 @@
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "net/Connection.h"
+#include "net/EventLoop.h"
+#include "net/Application.h"
+
+using std::cerr;
+using std::endl; // for test
+
+using namespace ananas;
+
+// Pub/sub fan-out: a timer publishes to all subscribers, packets sent in
+// one loop iteration are coalesced to one writev per connection.
+
+const uint16_t kPort = 9983;
+const int kSubscribers = 8;
+const int kRounds = 50;
+const int kMessagesPerRound = 20;
+
+std::vector<std::shared_ptr<Connection>> subscribers;
+int finished = 0;
+bool succ = true;
+
+std::string Message(int round, int i) {
+    return "msg " + std::to_string(round) + " " + std::to_string(i) + "\n";
+}
+
+void Publish(int round) {
+    for (int i = 0; i < kMessagesPerRound; ++ i) {
+        auto msg = Message(round, i);
+        for (const auto& c : subscribers) {
+            c->SendPacket(msg);
+            assert (c->PendingSendBytes() > 0); // buffered, not sent yet
+        }
+    }
+}
+
+void OnNewConnection(Connection* conn) {
+    conn->SetOnConnect([](Connection* c) {
+        subscribers.push_back(std::static_pointer_cast<Connection>(c->shared_from_this()));
+        if (subscribers.size() < kSubscribers)
+            return;
+
+        auto loop = c->GetLoop();
+        loop->ScheduleAfterWithRepeat<kRounds>(std::chrono::milliseconds(5), [loop]() {
+            static int round = 0;
+            Publish(round ++);
+        });
+    });
+}
+
+void OnSubscribe(Connection* conn) {
+    auto expect = std::make_shared<std::string>();
+    for (int r = 0; r < kRounds; ++ r)
+        for (int i = 0; i < kMessagesPerRound; ++ i)
+            *expect += Message(r, i);
+
+    auto received = std::make_shared<std::string>();
+    conn->SetOnMessage([expect, received](Connection* , const char* data, size_t len) {
+        received->append(data, len);
+        if (received->size() >= expect->size()) {
+            if (*received != *expect)
+                succ = false;
+
+            if (++ finished == kSubscribers)
+                Application::Instance().Exit();
+        }
+
+        return len;
+    });
+}
+
+int main(int ac, char* av[]) {
+    auto& app = Application::Instance();
+    app.BaseLoop()->SetWriteCoalescing(true);
+    app.Listen("127.0.0.1", kPort, OnNewConnection);
+
+    for (int i = 0; i < kSubscribers; ++ i) {
+        app.Connect("127.0.0.1", kPort, OnSubscribe, [](EventLoop* , const SocketAddr& ) {
+            succ = false;
+            Application::Instance().Exit();
+        });
+    }
+
+    app.Run(ac, av);
+
+    cerr << (succ ? "BYE BYE\n" : "FAILED\n");
+    return succ ? 0 : -1;
+}
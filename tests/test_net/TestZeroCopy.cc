@@ -0,0 +1,80 @@
+#include <cassert>
+#include <iostream>
+#include <string>
+
+#include "net/Connection.h"
+#include "net/EventLoop.h"
+#include "net/Application.h"
+
+using std::cerr;
+using std::endl; // for test
+
+using namespace ananas;
+
+const uint16_t kPort = 9984;
+const size_t kChunk = 1024 * 1024;
+const int kChunks = 32;
+
+size_t received = 0;
+unsigned long sum = 0;
+bool succ = false;
+
+unsigned long Expect() {
+    unsigned long s = 0;
+    for (int c = 0; c < kChunks; ++ c)
+        for (size_t i = 0; i < kChunk; ++ i)
+            s += static_cast<unsigned char>((c + i) % 251);
+
+    return s;
+}
+
+void OnNewConnection(Connection* conn) {
+    conn->SetOnConnect([](Connection* c) {
+        if (!c->SetZeroCopyThreshold(64 * 1024))
+            cerr << "MSG_ZEROCOPY not supported, fallback to copy" << endl;
+
+        for (int c2 = 0; c2 < kChunks; ++ c2) {
+            Buffer buf;
+            buf.AssureSpace(kChunk);
+            for (size_t i = 0; i < kChunk; ++ i)
+                buf.WriteAddr()[i] = static_cast<char>((c2 + i) % 251);
+            buf.Produce(kChunk);
+
+            c->SendPacket(std::move(buf));
+        }
+
+        cerr << "Pending " << c->PendingSendBytes()
+             << ", zero copy not completed " << c->ZeroCopyPendingBytes() << endl;
+        c->ActiveClose();
+    });
+}
+
+void OnConnect(Connection* conn) {
+    conn->SetOnMessage([](Connection* , const char* data, size_t len) {
+        for (size_t i = 0; i < len; ++ i)
+            sum += static_cast<unsigned char>(data[i]);
+
+        received += len;
+        return len;
+    });
+
+    conn->SetOnDisconnect([](Connection* ) {
+        succ = (received == kChunk * kChunks && sum == Expect());
+        cerr << "Received " << received << " bytes" << endl;
+        Application::Instance().Exit();
+    });
+}
+
+int main(int ac, char* av[]) {
+    auto& app = Application::Instance();
+    app.Listen("127.0.0.1", kPort, OnNewConnection);
+    app.Connect("127.0.0.1", kPort, OnConnect, [](EventLoop* , const SocketAddr& ) {
+        cerr << "Connect failed\n";
+        Application::Instance().Exit();
+    });
+
+    app.Run(ac, av);
+
+    cerr << (succ ? "BYE BYE\n" : "FAILED\n");
+    return succ ? 0 : -1;
+}
@@ -0,0 +1,108 @@
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "net/DatagramSocket.h"
+#include "net/EventLoop.h"
+#include "net/Application.h"
+
+using std::cerr;
+using std::endl; // for test
+
+using namespace ananas;
+
+// Echo server with batch callback, replies are flushed by sendmmsg.
+// The client keeps a window of packets in flight, and checks every echo.
+
+const uint16_t kPort = 7002;
+const int kTotal = 20000;
+const int kWindow = 64;
+
+size_t maxBatch = 0;
+size_t batches = 0;
+std::atomic<bool> succ {false};
+
+void OnBatch(DatagramSocket* dg, const UDPPacket* packets, size_t count) {
+    ++ batches;
+    maxBatch = std::max(maxBatch, count);
+    for (size_t i = 0; i < count; ++ i)
+        dg->SendPacket(packets[i].data, packets[i].len, &packets[i].peer);
+}
+
+std::string Payload(int seq) {
+    return "packet-" + std::to_string(seq);
+}
+
+void Client() {
+    int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    timeval tv {1, 0};
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(kPort);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr);
+
+    int sent = 0;
+    int received = 0;
+    bool ok = true;
+    char buf[256];
+    while (received < kTotal) {
+        while (sent < kTotal && sent - received < kWindow) {
+            auto data = Payload(sent ++);
+            ::send(fd, data.data(), data.size(), 0);
+        }
+
+        ssize_t bytes = ::recv(fd, buf, sizeof buf, 0);
+        if (bytes <= 0)
+            break; // lost
+
+        // loopback keeps order
+        auto expect = Payload(received ++);
+        ok = ok && std::string(buf, bytes) == expect;
+    }
+
+    ::close(fd);
+
+    cerr << "received " << received << ", batches " << batches
+         << ", max batch " << maxBatch << endl;
+
+    Application::Instance().BaseLoop()->Execute([ok, received]() {
+        succ = ok && received == kTotal && maxBatch > 1;
+        Application::Instance().Exit();
+    });
+}
+
+int main(int ac, char* av[]) {
+    auto& app = Application::Instance();
+    app.ListenUDP("127.0.0.1", kPort,
+                  nullptr,
+                  [](DatagramSocket* dg) {
+                      dg->SetBatchCallback(OnBatch);
+                  },
+                  [](bool ok, const SocketAddr& addr) {
+                      if (!ok)
+                          Application::Instance().Exit();
+                  });
+
+    std::thread client([]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        Client();
+    });
+
+    app.Run(ac, av);
+    client.join();
+
+    cerr << (succ ? "BYE BYE\n" : "FAILED\n");
+    return succ ? 0 : -1;
+}
@@ -0,0 +1,139 @@
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "net/DatagramSocket.h"
+#include "net/EventLoop.h"
+#include "net/Application.h"
+
+using std::cerr;
+using std::endl; // for test
+
+using namespace ananas;
+
+// Client sends GSO super-packets, server receives them with GRO enabled,
+// callback must see the original datagrams. Server echoes with GSO, client
+// receives plain datagrams.
+
+const uint16_t kPort = 7003;
+const size_t kSegment = 1200;
+const int kSegmentsPerSend = 40;
+const int kSends = 200;
+const int kTotal = kSegmentsPerSend * kSends;
+
+size_t badPackets = 0;
+size_t coalesced = 0; // packets split from GRO super-packets
+std::atomic<bool> offload {false};
+std::atomic<bool> ready {false};
+std::atomic<bool> succ {false};
+
+char Pattern(int seq, size_t i) {
+    return static_cast<char>('a' + (seq + i) % 26);
+}
+
+void OnBatch(DatagramSocket* dg, const UDPPacket* packets, size_t count) {
+    for (size_t i = 0; i < count; ++ i) {
+        if (packets[i].len != kSegment)
+            ++ badPackets;
+        if (i > 0 && packets[i].data == packets[i - 1].data + packets[i - 1].len)
+            ++ coalesced;
+        dg->SendPacket(packets[i].data, packets[i].len, &packets[i].peer);
+    }
+}
+
+void Client() {
+    int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    timeval tv {1, 0};
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+    int rcvbuf = 4 * 1024 * 1024;
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof rcvbuf);
+
+    int segment = kSegment;
+    ::setsockopt(fd, SOL_UDP, UDP_SEGMENT, &segment, sizeof segment);
+
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(kPort);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr);
+
+    int sent = 0;
+    int received = 0;
+    bool ok = true;
+    std::string buf(kSegment * kSegmentsPerSend, 0);
+    char rbuf[2048];
+    while (received < kTotal) {
+        // at most two super-packets in flight
+        while (sent < kTotal && sent - received < 2 * kSegmentsPerSend) {
+            for (int s = 0; s < kSegmentsPerSend; ++ s)
+                for (size_t i = 0; i < kSegment; ++ i)
+                    buf[s * kSegment + i] = Pattern(sent + s, i);
+
+            ::send(fd, buf.data(), buf.size(), 0);
+            sent += kSegmentsPerSend;
+        }
+
+        ssize_t bytes = ::recv(fd, rbuf, sizeof rbuf, 0);
+        if (bytes <= 0)
+            break; // lost
+
+        ok = ok && bytes == static_cast<ssize_t>(kSegment);
+        for (ssize_t i = 0; ok && i < bytes; ++ i)
+            ok = rbuf[i] == Pattern(received, i);
+        ++ received;
+    }
+
+    ::close(fd);
+
+    cerr << "received " << received << ", bad " << badPackets
+         << ", coalesced " << coalesced << endl;
+
+    Application::Instance().BaseLoop()->Execute([ok, received]() {
+        succ = ok && received == kTotal && badPackets == 0;
+        Application::Instance().Exit();
+    });
+}
+
+int main(int ac, char* av[]) {
+    auto& app = Application::Instance();
+    app.ListenUDP("127.0.0.1", kPort,
+                  nullptr,
+                  [](DatagramSocket* dg) {
+                      offload = dg->EnableGRO(true) && dg->EnableGSO(true);
+                      dg->SetBatchCallback(OnBatch);
+                      ready = true;
+                  },
+                  [](bool ok, const SocketAddr& addr) {
+                      if (!ok)
+                          Application::Instance().Exit();
+                  });
+
+    std::thread client([]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (!ready || !offload) {
+            cerr << "UDP offload not supported, skip" << endl;
+            succ = true;
+            Application::Instance().BaseLoop()->Execute([]() {
+                Application::Instance().Exit();
+            });
+            return;
+        }
+
+        Client();
+    });
+
+    app.Run(ac, av);
+    client.join();
+
+    cerr << (succ ? "BYE BYE\n" : "FAILED\n");
+    return succ ? 0 : -1;
+}
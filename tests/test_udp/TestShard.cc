@@ -0,0 +1,124 @@
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+#include "net/DatagramSocket.h"
+#include "net/EventLoop.h"
+#include "net/Application.h"
+
+using std::cerr;
+using std::endl; // for test
+
+using namespace ananas;
+
+// One SO_REUSEPORT socket per worker, steered by flow hash.
+// Every peer must be served by only one thread, and more than one thread
+// must be used.
+
+const uint16_t kPort = 7004;
+const size_t kWorkers = 4;
+const int kFlows = 32;
+const int kPacketsPerFlow = 50;
+
+std::mutex mutex;
+std::map<uint16_t, std::set<std::thread::id>> flowThreads; // peer port -> threads
+std::atomic<int> shards {0};
+std::atomic<bool> bound {false};
+std::atomic<bool> succ {false};
+
+void OnMessage(DatagramSocket* dg, const char* data, size_t len) {
+    {
+        std::unique_lock<std::mutex> guard(mutex);
+        flowThreads[dg->PeerAddr().GetPort()].insert(std::this_thread::get_id());
+    }
+
+    dg->SendPacket(data, len);
+}
+
+bool RunFlow() {
+    int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    timeval tv {1, 0};
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(kPort);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr);
+
+    bool ok = true;
+    char buf[64];
+    for (int i = 0; ok && i < kPacketsPerFlow; ++ i) {
+        auto data = std::to_string(i);
+        ::send(fd, data.data(), data.size(), 0);
+
+        ssize_t bytes = ::recv(fd, buf, sizeof buf, 0);
+        ok = bytes > 0 && std::string(buf, bytes) == data;
+    }
+
+    ::close(fd);
+    return ok;
+}
+
+void Client() {
+    bool ok = true;
+    for (int i = 0; ok && i < kFlows; ++ i)
+        ok = RunFlow();
+
+    std::set<std::thread::id> threads;
+    bool sticky = true;
+    {
+        std::unique_lock<std::mutex> guard(mutex);
+        for (const auto& kv : flowThreads) {
+            sticky = sticky && kv.second.size() == 1;
+            threads.insert(kv.second.begin(), kv.second.end());
+        }
+    }
+
+    cerr << "shards " << shards << ", flows " << flowThreads.size()
+         << ", threads " << threads.size() << ", sticky " << sticky << endl;
+
+    Application::Instance().BaseLoop()->Execute([ok, sticky, threads]() {
+        succ = ok && sticky && shards == kWorkers && threads.size() > 1;
+        Application::Instance().Exit();
+    });
+}
+
+int main(int ac, char* av[]) {
+    auto& app = Application::Instance();
+    app.SetNumOfWorker(kWorkers);
+    app.ListenUDPSharded("127.0.0.1", kPort,
+                         OnMessage,
+                         [](DatagramSocket* ) {
+                             ++ shards;
+                         },
+                         true,
+                         [](bool ok, const SocketAddr& addr) {
+                             bound = ok;
+                             if (!ok)
+                                 Application::Instance().Exit();
+                         });
+
+    std::thread client([]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        if (bound)
+            Client();
+    });
+
+    app.Run(ac, av);
+    client.join();
+
+    cerr << (succ ? "BYE BYE\n" : "FAILED\n");
+    return succ ? 0 : -1;
+}
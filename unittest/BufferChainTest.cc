@@ -0,0 +1,116 @@
+#include <string>
+#include <thread>
+#include "gtest/gtest.h"
+#include "util/Buffer.h"
+
+using namespace ananas;
+
+static std::string ToString(const BufferChain& chain) {
+    std::string s(chain.TotalBytes(), '\0');
+    chain.CopyTo(&s[0], s.size());
+    return s;
+}
+
+
+TEST(bufferchain, append) {
+    BufferChain chain;
+    EXPECT_TRUE(chain.Empty());
+    EXPECT_EQ(chain.SegmentCount(), 0);
+
+    chain.Append("hello", 5);
+    chain.Append(" world", 6);
+    // small appends are merged in the tail block
+    EXPECT_EQ(chain.SegmentCount(), 1);
+    EXPECT_EQ(ToString(chain), "hello world");
+
+    chain.Consume(6);
+    EXPECT_EQ(ToString(chain), "world");
+
+    chain.Consume(5);
+    EXPECT_TRUE(chain.Empty());
+    EXPECT_EQ(chain.SegmentCount(), 0);
+}
+
+
+TEST(bufferchain, adopt) {
+    Buffer buf("abcdef", 6);
+    buf.Consume(1);
+    const char* addr = buf.ReadAddr();
+
+    BufferChain chain(std::move(buf));
+    EXPECT_EQ(buf.Capacity(), 0);
+    EXPECT_EQ(chain.TotalBytes(), 5);
+    EXPECT_EQ((*chain.begin()).data, addr);
+    EXPECT_EQ(ToString(chain), "bcdef");
+}
+
+
+TEST(bufferchain, share) {
+    BufferChain a;
+    a.Append("0123456789", 10);
+
+    BufferChain b(a);
+    EXPECT_EQ((*a.begin()).data, (*b.begin()).data);
+
+    // shared tail block is not written
+    b.Append("xyz", 3);
+    EXPECT_EQ(b.SegmentCount(), 2);
+    EXPECT_EQ(ToString(a), "0123456789");
+    EXPECT_EQ(ToString(b), "0123456789xyz");
+
+    a.Clear();
+    EXPECT_EQ(ToString(b), "0123456789xyz");
+}
+
+
+TEST(bufferchain, split) {
+    BufferChain chain;
+    chain.Append("hello", 5);
+    chain.Append(Buffer(" world", 6));
+    EXPECT_EQ(chain.SegmentCount(), 2);
+
+    BufferChain head = chain.Split(7);
+    EXPECT_EQ(ToString(head), "hello w");
+    EXPECT_EQ(ToString(chain), "orld");
+    EXPECT_EQ(head.SegmentCount(), 2);
+    EXPECT_EQ(chain.SegmentCount(), 1);
+
+    head.Append(std::move(chain));
+    EXPECT_TRUE(chain.Empty());
+    EXPECT_EQ(ToString(head), "hello world");
+
+    std::string s;
+    for (const auto& slice : head)
+        s.append(static_cast<const char*>(slice.data), slice.len);
+    EXPECT_EQ(s, "hello world");
+}
+
+
+TEST(bufferchain, cross_thread) {
+    BufferChain chain;
+    chain.Append(std::string(10000, 'a').data(), 10000);
+
+    BufferChain copy(chain);
+    std::thread t([copy]() mutable {
+        EXPECT_EQ(copy.TotalBytes(), 10000);
+        copy.Clear();
+    });
+
+    t.join();
+    chain.Consume(10000);
+    EXPECT_TRUE(chain.Empty());
+}
+
+
+TEST(bufferchain, adopt_string) {
+    std::string s(4096, 'x');
+    const char* addr = s.data();
+
+    BufferChain chain;
+    chain.Append(std::move(s));
+    EXPECT_EQ(chain.TotalBytes(), 4096);
+    EXPECT_EQ((*chain.begin()).data, addr);
+
+    chain.Consume(4000);
+    EXPECT_EQ(ToString(chain), std::string(96, 'x'));
+}
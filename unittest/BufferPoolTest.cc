@@ -0,0 +1,119 @@
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+#include "util/Buffer.h"
+#include "util/BufferPool.h"
+
+using namespace ananas;
+
+
+TEST(bufferpool, reuse) {
+    auto& pool = BufferPool::ThisThread();
+
+    void* p = BufferPool::Allocate(1000);
+    auto stats = pool.GetStats();
+    EXPECT_GE(stats.usedBytes, 1024);
+    EXPECT_GE(stats.mappedBytes, BufferPool::kArenaSize);
+
+    BufferPool::Deallocate(p, 1000);
+    void* q = BufferPool::Allocate(1024); // same size class
+    EXPECT_EQ(p, q);
+
+    BufferPool::Deallocate(q, 1024);
+    EXPECT_EQ(pool.GetStats().usedBytes, stats.usedBytes - 1024);
+}
+
+
+TEST(bufferpool, large) {
+    const std::size_t size = BufferPool::kMaxBlock + 1;
+    auto before = BufferPool::GlobalStats().largeBytes;
+
+    void* p = BufferPool::Allocate(size);
+    EXPECT_EQ(BufferPool::GlobalStats().largeBytes, before + size);
+
+    BufferPool::Deallocate(p, size);
+    EXPECT_EQ(BufferPool::GlobalStats().largeBytes, before);
+}
+
+
+TEST(bufferpool, remote_free) {
+    auto& pool = BufferPool::ThisThread();
+    auto remoteFrees = pool.GetStats().remoteFrees;
+
+    Buffer buf;
+    buf.PushData("hello", 5);
+
+    // buffer migrates to other thread, and is freed there
+    std::thread t([&buf]() {
+        Buffer other(std::move(buf));
+        EXPECT_EQ(other.ReadableSize(), 5);
+    });
+    t.join();
+
+    EXPECT_EQ(pool.GetStats().remoteFrees, remoteFrees + 1);
+
+    // owner still works
+    Buffer again;
+    again.PushData("world", 5);
+    EXPECT_EQ(again.ReadableSize(), 5);
+}
+
+
+TEST(bufferpool, adopt_orphan) {
+    BufferPool* exited = nullptr;
+    void* p = nullptr;
+
+    // block outlives its thread
+    std::thread t1([&]() {
+        exited = &BufferPool::ThisThread();
+        p = BufferPool::Allocate(1000);
+    });
+    t1.join();
+
+    BufferPool::Deallocate(p, 1000);
+
+    // new thread adopts the pool, and the remote free is reclaimed
+    std::thread t2([&]() {
+        EXPECT_EQ(&BufferPool::ThisThread(), exited);
+        void* q = BufferPool::Allocate(1000);
+        EXPECT_EQ(p, q);
+        BufferPool::Deallocate(q, 1000);
+    });
+    t2.join();
+}
+
+
+TEST(bufferpool, trim) {
+    std::thread t([]() {
+        auto& pool = BufferPool::ThisThread();
+        pool.Trim();
+        const auto mapped = pool.GetStats().mappedBytes;
+
+        // 2 arenas, the first one is full
+        const std::size_t size = BufferPool::kMaxBlock;
+        const std::size_t count = BufferPool::kArenaSize / size;
+        std::vector<void*> blocks;
+        for (std::size_t i = 0; i < count; ++ i)
+            blocks.push_back(BufferPool::Allocate(size));
+        EXPECT_EQ(pool.GetStats().mappedBytes, mapped + 2 * BufferPool::kArenaSize);
+
+        // keep the first arena
+        for (std::size_t i = 1; i < count; ++ i)
+            BufferPool::Deallocate(blocks[i], size);
+        EXPECT_EQ(pool.Trim(), BufferPool::kArenaSize);
+        EXPECT_EQ(pool.GetStats().mappedBytes, mapped + BufferPool::kArenaSize);
+        memset(blocks[0], 'x', size);
+
+        BufferPool::Deallocate(blocks[0], size);
+        EXPECT_EQ(pool.Trim(), BufferPool::kArenaSize);
+        EXPECT_EQ(pool.GetStats().mappedBytes, mapped);
+        EXPECT_EQ(pool.GetStats().cachedBytes, 0);
+
+        // still works after trim
+        void* p = BufferPool::Allocate(size);
+        EXPECT_EQ(pool.GetStats().mappedBytes, mapped + BufferPool::kArenaSize);
+        BufferPool::Deallocate(p, size);
+    });
+    t.join();
+}
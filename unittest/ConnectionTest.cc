@@ -0,0 +1,85 @@
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "net/Connection.h"
+#include "net/EventLoop.h"
+#include "net/Socket.h"
+#include "util/BufferPool.h"
+
+using namespace ananas;
+
+namespace {
+
+const int kConns = 1000;
+
+size_t OnMessage(Connection* , const char* , size_t len) {
+    return len;
+}
+
+// Idle connected connections, not registered to loop
+std::vector<std::shared_ptr<Connection>> CreateIdle(EventLoop* loop,
+                                                    std::shared_ptr<ConnectionCallbacks> callbacks,
+                                                    std::vector<int>& peers) {
+    std::vector<std::shared_ptr<Connection>> conns;
+    for (int i = 0; i < kConns; ++ i) {
+        int fds[2];
+        EXPECT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+        auto conn = Connection::Create(loop);
+        conn->Init(fds[0], SocketAddr());
+        if (callbacks)
+            conn->SetCallbacks(callbacks);
+        else
+            conn->SetOnMessage(OnMessage);
+
+        conns.push_back(conn);
+        peers.push_back(fds[1]);
+    }
+
+    return conns;
+}
+
+} // end namespace
+
+TEST(connection, bytes_per_idle_connection) {
+    // EventLoop is one per thread
+    std::thread t([]() {
+        EventLoop loop;
+        auto& pool = BufferPool::ThisThread();
+
+        std::vector<int> peers;
+        const auto before = pool.GetStats();
+        auto conns = CreateIdle(&loop, nullptr, peers);
+        const auto after = pool.GetStats();
+
+        const auto bytes = (after.usedBytes - before.usedBytes) / kConns;
+        printf("sizeof(Connection) %zu, pool bytes per idle connection %zu\n",
+               sizeof(Connection), bytes);
+        EXPECT_LE(bytes, 1024);
+
+        // recycled by the pool, no more arena
+        conns.clear();
+        EXPECT_EQ(pool.GetStats().usedBytes, before.usedBytes);
+
+        // callbacks shared by connections
+        auto callbacks = std::make_shared<ConnectionCallbacks>();
+        callbacks->onMessage = OnMessage;
+        conns = CreateIdle(&loop, callbacks, peers);
+        EXPECT_EQ(pool.GetStats().mappedBytes, after.mappedBytes);
+
+        const auto sharedBytes = (pool.GetStats().usedBytes - before.usedBytes) / kConns;
+        printf("pool bytes per idle connection with shared callbacks %zu\n", sharedBytes);
+        EXPECT_LT(sharedBytes, bytes);
+
+        conns.clear();
+        for (int fd : peers)
+            ::close(fd);
+    });
+
+    t.join();
+}
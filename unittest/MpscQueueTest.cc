@@ -0,0 +1,60 @@
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+#include "util/MpscQueue.h"
+
+using namespace ananas;
+
+
+TEST(mpscqueue, fifo) {
+    MpscQueue<int> q;
+    EXPECT_TRUE(q.Empty());
+
+    for (int i = 0; i < 10; ++ i)
+        q.Push(i);
+
+    EXPECT_FALSE(q.Empty());
+
+    int v = -1;
+    for (int i = 0; i < 10; ++ i) {
+        EXPECT_TRUE(q.Pop(v));
+        EXPECT_EQ(v, i);
+    }
+
+    EXPECT_FALSE(q.Pop(v));
+    EXPECT_TRUE(q.Empty());
+}
+
+
+TEST(mpscqueue, producers) {
+    const int kProducers = 4;
+    const int kPerProducer = 100000;
+
+    MpscQueue<int> q;
+    std::vector<std::thread> producers;
+    for (int p = 0; p < kProducers; ++ p) {
+        producers.emplace_back([&q, p]() {
+            for (int i = 0; i < kPerProducer; ++ i)
+                q.Push(p * kPerProducer + i);
+        });
+    }
+
+    // order of each producer is kept
+    std::vector<int> last(kProducers, -1);
+    int got = 0;
+    while (got < kProducers * kPerProducer) {
+        int v;
+        if (!q.Pop(v))
+            continue;
+
+        int p = v / kPerProducer;
+        EXPECT_GT(v, last[p]);
+        last[p] = v;
+        ++ got;
+    }
+
+    for (auto& t : producers)
+        t.join();
+
+    EXPECT_TRUE(q.Empty());
+}
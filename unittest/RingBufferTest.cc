@@ -0,0 +1,49 @@
+#include <string>
+#include "gtest/gtest.h"
+#include "util/RingBuffer.h"
+
+using namespace ananas;
+
+
+TEST(ringbuffer, wrap_around) {
+    RingBuffer ring;
+    ASSERT_TRUE(ring.Init(4096));
+    EXPECT_EQ(ring.Capacity() % 4096, 0);
+
+    const std::size_t cap = ring.Capacity();
+    std::string head(cap - 100, 'a');
+    EXPECT_EQ(ring.PushData(head.data(), head.size()), head.size());
+    ring.Consume(head.size() - 10);
+
+    // 10 bytes left at tail, now write across the end
+    std::string data(1000, 'b');
+    EXPECT_EQ(ring.PushData(data.data(), data.size()), data.size());
+    EXPECT_EQ(ring.Capacity(), cap); // no grow, no move
+
+    // readable bytes are still continuous
+    std::string expect = std::string(10, 'a') + data;
+    EXPECT_EQ(ring.ReadableSize(), expect.size());
+    EXPECT_EQ(std::string(ring.ReadAddr(), ring.ReadableSize()), expect);
+
+    ring.Consume(ring.ReadableSize());
+    EXPECT_TRUE(ring.IsEmpty());
+    EXPECT_EQ(ring.WritableSize(), cap);
+}
+
+
+TEST(ringbuffer, grow) {
+    RingBuffer ring;
+    ASSERT_TRUE(ring.Init(4096));
+
+    const std::size_t cap = ring.Capacity();
+    std::string data(cap, 'x');
+    ring.PushData(data.data(), data.size());
+    ring.Consume(cap / 2);
+
+    std::string more(cap, 'y');
+    EXPECT_EQ(ring.PushData(more.data(), more.size()), more.size());
+    EXPECT_GT(ring.Capacity(), cap);
+
+    std::string expect = std::string(cap / 2, 'x') + more;
+    EXPECT_EQ(std::string(ring.ReadAddr(), ring.ReadableSize()), expect);
+}
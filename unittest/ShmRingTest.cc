@@ -0,0 +1,89 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <vector>
+#include "gtest/gtest.h"
+#include "net/ShmTransport.h"
+
+using namespace ananas::internal;
+
+
+TEST(shmring, reader_checks_tail) {
+    ShmRing::Header header {};
+    std::vector<char> data(4096);
+
+    ShmRing reader;
+    reader.Attach(&header, data.data(), data.size());
+
+    header.tail = 100;
+    EXPECT_EQ(reader.ReadableSize(), 100u);
+    EXPECT_FALSE(reader.Corrupted());
+
+    // peer claims more than capacity
+    header.tail = data.size() + 1;
+    EXPECT_EQ(reader.ReadableSize(), 0u);
+    EXPECT_TRUE(reader.Corrupted());
+
+    // and never trusted again
+    header.tail = 100;
+    EXPECT_EQ(reader.ReadableSize(), 0u);
+}
+
+
+TEST(shmring, writer_checks_head) {
+    ShmRing::Header header {};
+    std::vector<char> data(4096);
+
+    ShmRing writer;
+    writer.Attach(&header, data.data(), data.size());
+
+    writer.Produce(10);
+    EXPECT_EQ(writer.WritableSize(), data.size() - 10);
+
+    // peer consumed more than produced
+    header.head = 11;
+    EXPECT_EQ(writer.WritableSize(), 0u);
+    EXPECT_TRUE(writer.Corrupted());
+}
+
+
+TEST(shmring, attach_checks_positions) {
+    ShmRing::Header header {};
+    std::vector<char> data(4096);
+    header.head = 1;
+
+    ShmRing ring;
+    ring.Attach(&header, data.data(), data.size());
+    EXPECT_TRUE(ring.Corrupted());
+}
+
+
+#if defined(__linux__) && defined(SYS_memfd_create) && defined(F_GET_SEALS)
+TEST(shmtransport, attach_needs_sealed_memfd) {
+    ShmTransport client;
+    ASSERT_TRUE(client.Create(4096));
+
+    char hello[ShmTransport::kHelloSize];
+    client.MakeHello(hello);
+    int fds[ShmTransport::kPassFds];
+    client.GetPassFds(fds);
+
+    // right size, but the client could still shrink it
+    struct stat st;
+    ASSERT_EQ(::fstat(fds[0], &st), 0);
+    int unsealed = static_cast<int>(::syscall(SYS_memfd_create, "unsealed", 0));
+    ASSERT_EQ(::ftruncate(unsealed, st.st_size), 0);
+
+    ShmTransport bad;
+    EXPECT_FALSE(bad.Attach(hello, {unsealed, ::dup(fds[1]), ::dup(fds[2])}));
+
+    ShmTransport server;
+    EXPECT_TRUE(server.Attach(hello, {::dup(fds[0]), ::dup(fds[1]), ::dup(fds[2])}));
+
+    // nor can the client resize the sealed one
+    EXPECT_NE(::ftruncate(fds[0], 0), 0);
+    EXPECT_NE(::fcntl(fds[0], F_ADD_SEALS, 0), 0);
+}
+#endif
@@ -1,7 +1,11 @@
 
 #include "Buffer.h"
+#include "BufferPool.h"
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <limits>
+#include <new>
 #include <cassert>
 
 namespace ananas {
@@ -97,12 +101,13 @@ void Buffer::AssureSpace(std::size_t needsize) {
     }
 
     if (oldCap < capacity_) {
-        std::unique_ptr<char []> tmp(new char[capacity_]);
+        char* tmp = static_cast<char*>(BufferPool::Allocate(capacity_));
 
         if (dataSize != 0)
-            memcpy(&tmp[0], &buffer_[readPos_], dataSize);
+            memcpy(tmp, &buffer_[readPos_], dataSize);
 
-        buffer_.swap(tmp);
+        BufferPool::Deallocate(buffer_, oldCap);
+        buffer_ = tmp;
     } else {
         assert (readPos_ > 0);
         ::memmove(&buffer_[0], &buffer_[readPos_], dataSize);
@@ -113,12 +118,17 @@ void Buffer::AssureSpace(std::size_t needsize) {
 }
 
 
+Buffer::~Buffer() {
+    BufferPool::Deallocate(buffer_, capacity_);
+}
+
 void Buffer::Shrink() {
     if (IsEmpty()) {
         if (capacity_ > 8 * 1024) {
             Clear();
+            BufferPool::Deallocate(buffer_, capacity_);
+            buffer_ = nullptr;
             capacity_ = 0;
-            buffer_.reset();
         }
 
         return;
@@ -131,9 +141,10 @@ void Buffer::Shrink() {
 
     std::size_t newCap = RoundUp2Power(dataSize);
 
-    std::unique_ptr<char []> tmp(new char[newCap]);
-    memcpy(&tmp[0], &buffer_[readPos_], dataSize);
-    buffer_.swap(tmp);
+    char* tmp = static_cast<char*>(BufferPool::Allocate(newCap));
+    memcpy(tmp, &buffer_[readPos_], dataSize);
+    BufferPool::Deallocate(buffer_, oldCap);
+    buffer_ = tmp;
     capacity_ = newCap;
 
     readPos_  = 0;
@@ -148,10 +159,13 @@ void Buffer::Swap(Buffer& buf) {
     std::swap(readPos_, buf.readPos_);
     std::swap(writePos_, buf.writePos_);
     std::swap(capacity_, buf.capacity_);
-    buffer_.swap(buf.buffer_);
+    std::swap(buffer_, buf.buffer_);
 }
 
-Buffer::Buffer(Buffer&& other) {
+Buffer::Buffer(Buffer&& other) :
+    readPos_(0),
+    writePos_(0),
+    capacity_(0) {
     _MoveFrom(std::move(other));
 }
 
@@ -161,17 +175,301 @@ Buffer& Buffer::operator= (Buffer&& other) {
 
 Buffer& Buffer::_MoveFrom(Buffer&& other) {
     if (this != &other) {
+        BufferPool::Deallocate(this->buffer_, this->capacity_);
+
         this->readPos_ = other.readPos_;
         this->writePos_ = other.writePos_;
         this->capacity_ = other.capacity_;
-        this->buffer_ = std::move(other.buffer_);
+        this->buffer_ = other.buffer_;
 
         other.Clear();
-        other.Shrink();
+        other.capacity_ = 0;
+        other.buffer_ = nullptr;
+    }
+
+    return *this;
+}
+
+struct BufferChain::Block {
+    std::atomic<int> refs;
+    char* data;
+    std::size_t capacity;
+    std::size_t used;
+    std::size_t allocSize; // memory from pool, header included
+    bool external; // data is adopted from Buffer
+    std::string* str; // data is adopted from string
+};
+
+namespace {
+const std::size_t kMinChainBlock = 4 * 1024;
+}
+
+BufferChain::Block* BufferChain::_NewBlock(std::size_t minCapacity) {
+    // header and data in one allocation
+    std::size_t allocSize = sizeof(Block) + minCapacity;
+    if (allocSize <= BufferPool::kMaxBlock)
+        allocSize = std::max(RoundUp2Power(allocSize), kMinChainBlock);
+
+    void* mem = BufferPool::Allocate(allocSize);
+    Block* b = new (mem) Block;
+    b->refs.store(1, std::memory_order_relaxed);
+    b->data = reinterpret_cast<char*>(b + 1);
+    b->capacity = allocSize - sizeof(Block);
+    b->used = 0;
+    b->allocSize = allocSize;
+    b->external = false;
+    b->str = nullptr;
+    return b;
+}
+
+void BufferChain::_Ref(Block* b) {
+    b->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void BufferChain::_Unref(Block* b) {
+    if (b->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+
+    if (b->str)
+        delete b->str;
+    else if (b->external)
+        BufferPool::Deallocate(b->data, b->capacity);
+
+    const std::size_t allocSize = b->allocSize;
+    b->~Block();
+    BufferPool::Deallocate(b, allocSize);
+}
+
+void BufferChain::_PushSegment(Block* b, const char* data, std::size_t len) {
+    segments_.push_back(Segment {b, data, len});
+    totalBytes_ += len;
+}
+
+BufferChain::BufferChain(Buffer&& buf) {
+    Append(std::move(buf));
+}
+
+BufferChain::BufferChain(const BufferChain& other) :
+    segments_(other.segments_),
+    totalBytes_(other.totalBytes_) {
+    for (const auto& seg : segments_)
+        _Ref(seg.block);
+}
+
+BufferChain& BufferChain::operator= (const BufferChain& other) {
+    if (this != &other) {
+        Clear();
+        Append(other);
+    }
+
+    return *this;
+}
+
+BufferChain::BufferChain(BufferChain&& other) :
+    segments_(std::move(other.segments_)),
+    totalBytes_(other.totalBytes_) {
+    other.segments_.clear();
+    other.totalBytes_ = 0;
+}
+
+BufferChain& BufferChain::operator= (BufferChain&& other) {
+    if (this != &other) {
+        Clear();
+        segments_.swap(other.segments_);
+        std::swap(totalBytes_, other.totalBytes_);
     }
 
     return *this;
 }
 
+BufferChain::~BufferChain() {
+    Clear();
+}
+
+void BufferChain::Clear() {
+    for (const auto& seg : segments_)
+        _Unref(seg.block);
+
+    segments_.clear();
+    totalBytes_ = 0;
+}
+
+void BufferChain::Append(const void* data, std::size_t size) {
+    if (!data || size == 0)
+        return;
+
+    const char* src = static_cast<const char*>(data);
+
+    // Fill the tail block if nobody else sees it
+    if (!segments_.empty()) {
+        Segment& tail = segments_.back();
+        Block* b = tail.block;
+        if (b->refs.load(std::memory_order_acquire) == 1 &&
+            tail.data + tail.len == b->data + b->used &&
+            b->used < b->capacity) {
+            const std::size_t bytes = std::min(size, b->capacity - b->used);
+            ::memcpy(b->data + b->used, src, bytes);
+            b->used += bytes;
+            tail.len += bytes;
+            totalBytes_ += bytes;
+
+            src += bytes;
+            size -= bytes;
+        }
+    }
+
+    if (size == 0)
+        return;
+
+    Block* b = _NewBlock(size);
+    ::memcpy(b->data, src, size);
+    b->used = size;
+    _PushSegment(b, b->data, size);
+}
+
+void BufferChain::Append(Buffer&& buf) {
+    if (buf.IsEmpty())
+        return;
+
+    void* mem = BufferPool::Allocate(sizeof(Block));
+    Block* b = new (mem) Block;
+    b->refs.store(1, std::memory_order_relaxed);
+    b->data = buf.buffer_;
+    b->capacity = buf.capacity_;
+    b->used = buf.writePos_;
+    b->allocSize = sizeof(Block);
+    b->external = true;
+    b->str = nullptr;
+
+    _PushSegment(b, b->data + buf.readPos_, buf.ReadableSize());
+
+    buf.Clear();
+    buf.buffer_ = nullptr;
+    buf.capacity_ = 0;
+}
+
+void BufferChain::Append(std::string&& str) {
+    if (str.empty())
+        return;
+
+    // small string is stored inline, just copy it
+    if (str.size() < kMinChainBlock / 4) {
+        Append(str.data(), str.size());
+        str.clear();
+        return;
+    }
+
+    void* mem = BufferPool::Allocate(sizeof(Block));
+    Block* b = new (mem) Block;
+    b->refs.store(1, std::memory_order_relaxed);
+    b->str = new std::string(std::move(str));
+    b->data = &(*b->str)[0];
+    b->capacity = b->str->size();
+    b->used = b->capacity;
+    b->allocSize = sizeof(Block);
+    b->external = true;
+
+    _PushSegment(b, b->data, b->str->size());
+}
+
+void BufferChain::Append(const BufferChain& other) {
+    if (&other == this) {
+        BufferChain tmp(other);
+        Append(std::move(tmp));
+        return;
+    }
+
+    segments_.reserve(segments_.size() + other.segments_.size());
+    for (const auto& seg : other.segments_) {
+        _Ref(seg.block);
+        segments_.push_back(seg);
+    }
+
+    totalBytes_ += other.totalBytes_;
+}
+
+void BufferChain::Append(BufferChain&& other) {
+    if (&other == this) {
+        BufferChain tmp(other);
+        Append(std::move(tmp));
+        return;
+    }
+
+    if (segments_.empty()) {
+        segments_.swap(other.segments_);
+    } else {
+        segments_.insert(segments_.end(), other.segments_.begin(), other.segments_.end());
+        other.segments_.clear();
+    }
+
+    totalBytes_ += other.totalBytes_;
+    other.totalBytes_ = 0;
+}
+
+void BufferChain::Consume(std::size_t bytes) {
+    assert (bytes <= totalBytes_);
+
+    std::size_t skipped = 0;
+    while (skipped < segments_.size() && bytes > 0) {
+        Segment& seg = segments_[skipped];
+        if (bytes < seg.len) {
+            seg.data += bytes;
+            seg.len -= bytes;
+            totalBytes_ -= bytes;
+            break;
+        }
+
+        bytes -= seg.len;
+        totalBytes_ -= seg.len;
+        _Unref(seg.block);
+        ++ skipped;
+    }
+
+    segments_.erase(segments_.begin(), segments_.begin() + skipped);
+}
+
+BufferChain BufferChain::Split(std::size_t bytes) {
+    assert (bytes <= totalBytes_);
+
+    BufferChain head;
+    std::size_t moved = 0;
+    while (moved < segments_.size() && bytes > 0) {
+        Segment& seg = segments_[moved];
+        if (bytes < seg.len) {
+            // the block is shared by both
+            _Ref(seg.block);
+            head._PushSegment(seg.block, seg.data, bytes);
+
+            seg.data += bytes;
+            seg.len -= bytes;
+            totalBytes_ -= bytes;
+            break;
+        }
+
+        bytes -= seg.len;
+        totalBytes_ -= seg.len;
+        head._PushSegment(seg.block, seg.data, seg.len);
+        ++ moved;
+    }
+
+    segments_.erase(segments_.begin(), segments_.begin() + moved);
+    return head;
+}
+
+std::size_t BufferChain::CopyTo(void* dst, std::size_t size) const {
+    char* out = static_cast<char*>(dst);
+    std::size_t copied = 0;
+    for (const auto& seg : segments_) {
+        if (copied == size)
+            break;
+
+        const std::size_t bytes = std::min(size - copied, seg.len);
+        ::memcpy(out + copied, seg.data, bytes);
+        copied += bytes;
+    }
+
+    return copied;
+}
+
 } // end namespace ananas
 
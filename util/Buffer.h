@@ -2,14 +2,20 @@
 #ifndef BERT_BUFFER_H
 #define BERT_BUFFER_H
 
+#include <cstddef>
 #include <cstring>
+#include <iterator>
 #include <memory>
 #include <list>
+#include <string>
+#include <vector>
 
 ///@file Buffer.h
 namespace ananas {
 
 ///@brief A simple buffer with memory management like STL's vector<char>
+///
+/// Memory is from the BufferPool of current thread.
 class Buffer {
 public:
     Buffer() :
@@ -25,6 +31,8 @@ public:
         PushData(data, size);
     }
 
+    ~Buffer();
+
     Buffer(const Buffer& ) = delete;
     void operator = (const Buffer& ) = delete;
 
@@ -72,116 +80,158 @@ public:
     static const std::size_t  kDefaultSize;
 
 private:
+    friend class BufferChain;
     Buffer& _MoveFrom(Buffer&& );
 
     std::size_t readPos_;
     std::size_t writePos_;
     std::size_t capacity_;
-    std::unique_ptr<char []>  buffer_;
+    char* buffer_ {nullptr};
 };
 
 
-struct BufferVector {
-    static constexpr int kMinSize = 1024;
+struct Slice {
+    const void* data;
+    size_t len;
 
-    typedef std::list<Buffer> BufferContainer;
+    explicit
+    Slice(const void* d = nullptr, size_t l = 0) :
+        data(d),
+        len(l)
+    {}
+};
 
-    typedef BufferContainer::const_iterator const_iterator;
-    typedef BufferContainer::iterator iterator;
-    typedef BufferContainer::value_type value_type;
-    typedef BufferContainer::reference reference;
-    typedef BufferContainer::const_reference const_reference;
+///@brief Chain of refcounted and sliceable memory blocks, like folly's IOBuf
+///
+/// Copy a chain only increases reference counts, so data can be shared
+/// between connections; Split/Consume only adjust the views of blocks.
+/// Bytes are copied only when appending raw pointer, and they are
+/// appended to the tail block if it's not shared and has space.
+class BufferChain {
+public:
+    class const_iterator;
 
-    BufferVector() {
+    BufferChain() {
     }
 
-    BufferVector(Buffer&& first) {
-        Push(std::move(first));
-    }
+    ///@brief Adopt the memory of buf, no copy
+    explicit
+    BufferChain(Buffer&& buf);
+
+    // Share blocks, no copy
+    BufferChain(const BufferChain& other);
+    BufferChain& operator= (const BufferChain& other);
+
+    BufferChain(BufferChain&& other);
+    BufferChain& operator= (BufferChain&& other);
+
+    ~BufferChain();
 
     bool Empty() const {
-        return buffers.empty();
+        return totalBytes_ == 0;
     }
 
     std::size_t TotalBytes() const {
-        return totalBytes;
+        return totalBytes_;
     }
 
-    void Clear() {
-        buffers.clear();
-        totalBytes = 0;
+    ///@brief Count of segments, for writev
+    std::size_t SegmentCount() const {
+        return segments_.size();
     }
 
-    void Push(Buffer&& buf) {
-        totalBytes += buf.ReadableSize();
-        if (_ShouldMerge()) {
-            auto& last = buffers.back();
-            last.PushData(buf.ReadAddr(), buf.ReadableSize());
-        } else {
-            buffers.push_back(std::move(buf));
-        }
-    }
+    void Clear();
 
-    void Push(const void* data, size_t size) {
-        totalBytes += size;
-        if (_ShouldMerge()) {
-            auto& last = buffers.back();
-            last.PushData(data, size);
-        } else {
-            buffers.push_back(Buffer(data, size));
-        }
-    }
+    ///@brief Copy bytes to the tail
+    void Append(const void* data, std::size_t size);
+    ///@brief Adopt the memory of buf, no copy
+    void Append(Buffer&& buf);
+    ///@brief Adopt the string, no copy
+    void Append(std::string&& str);
+    ///@brief Share the blocks of other, no copy
+    void Append(const BufferChain& other);
+    ///@brief Take the blocks of other
+    void Append(BufferChain&& other);
+
+    ///@brief Discard bytes from the head
+    void Consume(std::size_t bytes);
+    ///@brief Cut the first bytes off as a new chain, no copy
+    BufferChain Split(std::size_t bytes);
 
-    void Pop() {
-        totalBytes -= buffers.front().ReadableSize();
-        buffers.pop_front();
-    }
+    ///@brief Copy out to a continuous buffer
+    std::size_t CopyTo(void* dst, std::size_t size) const;
 
-    iterator begin() {
-        return buffers.begin();
+    // Same as Append
+    void Push(const void* data, std::size_t size) {
+        Append(data, size);
     }
-    iterator end() {
-        return buffers.end();
+    void Push(Buffer&& buf) {
+        Append(std::move(buf));
     }
 
-    const_iterator begin() const {
-        return buffers.begin();
-    }
-    const_iterator end() const {
-        return buffers.end();
-    }
+    ///@brief Iterate segments as Slice
+    const_iterator begin() const;
+    const_iterator end() const;
 
-    const_iterator cbegin() const {
-        return buffers.cbegin();
-    }
-    const_iterator cend() const {
-        return buffers.cend();
-    }
+private:
+    struct Block;
+    struct Segment {
+        Block* block;
+        const char* data;
+        std::size_t len;
+    };
 
-    BufferContainer buffers;
-    size_t totalBytes {0};
+    static Block* _NewBlock(std::size_t minCapacity);
+    static void _Ref(Block* b);
+    static void _Unref(Block* b);
+    void _PushSegment(Block* b, const char* data, std::size_t len);
 
-private:
-    bool _ShouldMerge() const {
-        if (buffers.empty()) {
-            return false;
-        } else {
-            const auto& last = buffers.back();
-            return last.ReadableSize() < kMinSize;
+    std::vector<Segment> segments_; // no allocation when empty
+    std::size_t totalBytes_ {0};
+
+public:
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Slice;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Slice*;
+        using reference = Slice;
+
+        explicit
+        const_iterator(std::vector<Segment>::const_iterator it) : it_(it) { }
+
+        Slice operator*() const {
+            return Slice(it_->data, it_->len);
         }
-    }
+        const_iterator& operator++() {
+            ++ it_;
+            return *this;
+        }
+        const_iterator operator++(int) {
+            auto tmp = *this;
+            ++ it_;
+            return tmp;
+        }
+        bool operator== (const const_iterator& other) const {
+            return it_ == other.it_;
+        }
+        bool operator!= (const const_iterator& other) const {
+            return it_ != other.it_;
+        }
+
+    private:
+        std::vector<Segment>::const_iterator it_;
+    };
 };
 
-struct Slice {
-    const void* data;
-    size_t len;
+inline BufferChain::const_iterator BufferChain::begin() const {
+    return const_iterator(segments_.begin());
+}
 
-    explicit
-    Slice(const void* d = nullptr, size_t l = 0) :
-        data(d),
-        len(l)
-    {}
-};
+inline BufferChain::const_iterator BufferChain::end() const {
+    return const_iterator(segments_.end());
+}
 
 struct SliceVector {
 private:
@@ -0,0 +1,353 @@
+
+#include <sys/mman.h>
+
+#include <cassert>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "BufferPool.h"
+
+namespace ananas {
+
+namespace internal {
+
+// Placed at the beginning of every arena
+struct ArenaHeader {
+    BufferPool* owner;
+    std::size_t classIndex;
+    std::size_t usedBlocks; // modified by owner only
+    ArenaHeader* next;
+};
+
+} // end namespace internal
+
+namespace {
+
+using internal::ArenaHeader;
+
+const std::size_t kArenaHeaderSize = 64;
+static_assert(sizeof(ArenaHeader) <= kArenaHeaderSize, "ArenaHeader too big");
+
+std::atomic<bool> g_hugePage {false};
+std::atomic<std::size_t> g_largeBytes {0};
+
+thread_local BufferPool* g_thisPool = nullptr;
+
+// Orphan the pool when thread exits
+struct PoolHolder {
+    ~PoolHolder();
+};
+
+thread_local PoolHolder g_poolHolder;
+
+// Never destroyed, buffers may be freed when process exit
+std::mutex& PoolsMutex() {
+    static auto mutex = new std::mutex;
+    return *mutex;
+}
+
+std::vector<BufferPool*>& Pools() {
+    static auto pools = new std::vector<BufferPool*>;
+    return *pools;
+}
+
+// Pools of exited threads, waiting for adoption
+std::vector<BufferPool*>& Orphans() {
+    static auto orphans = new std::vector<BufferPool*>;
+    return *orphans;
+}
+
+ArenaHeader* ArenaOf(void* p) {
+    auto addr = reinterpret_cast<std::uintptr_t>(p);
+    return reinterpret_cast<ArenaHeader*>(addr & ~(BufferPool::kArenaSize - 1));
+}
+
+void* MapArena() {
+    const std::size_t size = BufferPool::kArenaSize;
+
+#if defined(MAP_HUGETLB)
+    if (g_hugePage) {
+        // huge page mapping is naturally aligned
+        void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED)
+            return p;
+    }
+#endif
+
+    // map twice size, then trim to aligned
+    char* p = static_cast<char*>(::mmap(nullptr, 2 * size, PROT_READ | PROT_WRITE,
+                                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (p == MAP_FAILED)
+        return nullptr;
+
+    auto addr = reinterpret_cast<std::uintptr_t>(p);
+    auto aligned = (addr + size - 1) & ~(size - 1);
+    char* start = reinterpret_cast<char*>(aligned);
+
+    if (start > p)
+        ::munmap(p, start - p);
+    if (p + 2 * size > start + size)
+        ::munmap(start + size, (p + 2 * size) - (start + size));
+
+#if defined(MADV_HUGEPAGE)
+    if (g_hugePage)
+        ::madvise(start, size, MADV_HUGEPAGE);
+#endif
+
+    return start;
+}
+
+} // end namespace
+
+std::string BufferPool::Stats::ToString() const {
+    return "mapped:" + std::to_string(mappedBytes) +
+           " used:" + std::to_string(usedBytes) +
+           " cached:" + std::to_string(cachedBytes) +
+           " large:" + std::to_string(largeBytes) +
+           " remote_frees:" + std::to_string(remoteFrees);
+}
+
+const std::size_t BufferPool::kMinBlock;
+const std::size_t BufferPool::kMaxBlock;
+const std::size_t BufferPool::kArenaSize;
+
+BufferPool::BufferPool() {
+}
+
+PoolHolder::~PoolHolder() {
+    BufferPool* pool = g_thisPool;
+    if (!pool)
+        return;
+
+    // Still the owner thread, no one else touches the free lists
+    pool->Trim();
+    g_thisPool = nullptr;
+
+    std::unique_lock<std::mutex> guard(PoolsMutex());
+    Orphans().push_back(pool);
+}
+
+BufferPool& BufferPool::ThisThread() {
+    // Never deleted: other threads may still free blocks to it
+    if (!g_thisPool) {
+        // Make sure the holder is constructed, to orphan pool at exit
+        (void)&g_poolHolder;
+
+        std::unique_lock<std::mutex> guard(PoolsMutex());
+        if (!Orphans().empty()) {
+            g_thisPool = Orphans().back();
+            Orphans().pop_back();
+        } else {
+            g_thisPool = new BufferPool;
+            Pools().push_back(g_thisPool);
+        }
+    }
+
+    return *g_thisPool;
+}
+
+void BufferPool::SetHugePage(bool enable) {
+    g_hugePage = enable;
+}
+
+std::size_t BufferPool::_ClassIndex(std::size_t size) {
+    std::size_t index = 0;
+    std::size_t block = kMinBlock;
+    while (block < size) {
+        block <<= 1;
+        ++ index;
+    }
+
+    return index;
+}
+
+std::size_t BufferPool::_ClassSize(std::size_t index) {
+    return kMinBlock << index;
+}
+
+void* BufferPool::Allocate(std::size_t size) {
+    if (size > kMaxBlock) {
+        g_largeBytes += size;
+        return ::operator new(size);
+    }
+
+    return ThisThread()._Allocate(_ClassIndex(size));
+}
+
+void BufferPool::Deallocate(void* p, std::size_t size) {
+    if (!p)
+        return;
+
+    if (size > kMaxBlock) {
+        g_largeBytes -= size;
+        ::operator delete(p);
+        return;
+    }
+
+    ArenaHeader* arena = ArenaOf(p);
+    assert (arena->classIndex == _ClassIndex(size));
+
+    if (arena->owner == g_thisPool)
+        g_thisPool->_LocalFree(p, arena->classIndex);
+    else
+        arena->owner->_RemoteFree(p);
+}
+
+void* BufferPool::_Allocate(std::size_t index) {
+    assert (index < kClasses);
+
+    const std::size_t blockSize = _ClassSize(index);
+    if (!free_[index])
+        _DrainRemote();
+
+    if (FreeBlock* block = free_[index]) {
+        free_[index] = block->next;
+        ++ ArenaOf(block)->usedBlocks;
+        cachedBytes_ -= blockSize;
+        usedBytes_ += blockSize;
+        return block;
+    }
+
+    if (arenaCur_[index] + blockSize > arenaEnd_[index]) {
+        if (!_NewArena(index))
+            throw std::bad_alloc();
+    }
+
+    void* p = arenaCur_[index];
+    arenaCur_[index] += blockSize;
+    ++ ArenaOf(p)->usedBlocks;
+    usedBytes_ += blockSize;
+    return p;
+}
+
+void BufferPool::_LocalFree(void* p, std::size_t index) {
+    const std::size_t blockSize = _ClassSize(index);
+
+    FreeBlock* block = static_cast<FreeBlock*>(p);
+    block->next = free_[index];
+    free_[index] = block;
+    -- ArenaOf(p)->usedBlocks;
+
+    usedBytes_ -= blockSize;
+    cachedBytes_ += blockSize;
+}
+
+void BufferPool::_RemoteFree(void* p) {
+    // Treiber stack push, the owner takes all at once, so no ABA
+    FreeBlock* block = static_cast<FreeBlock*>(p);
+    block->next = remoteFree_.load(std::memory_order_relaxed);
+    while (!remoteFree_.compare_exchange_weak(block->next, block,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed))
+        ;
+
+    ++ remoteFrees_;
+}
+
+void BufferPool::_DrainRemote() {
+    if (!remoteFree_.load(std::memory_order_relaxed))
+        return;
+
+    FreeBlock* block = remoteFree_.exchange(nullptr, std::memory_order_acquire);
+    while (block) {
+        FreeBlock* next = block->next;
+        _LocalFree(block, ArenaOf(block)->classIndex);
+        block = next;
+    }
+}
+
+bool BufferPool::_NewArena(std::size_t index) {
+    void* p = MapArena();
+    if (!p)
+        return false;
+
+    ArenaHeader* arena = static_cast<ArenaHeader*>(p);
+    arena->owner = this;
+    arena->classIndex = index;
+    arena->usedBlocks = 0;
+    arena->next = arenas_;
+    arenas_ = arena;
+
+    // The left space of old arena is wasted, at most one block
+    char* start = static_cast<char*>(p);
+    arenaCur_[index] = start + kArenaHeaderSize;
+    arenaEnd_[index] = start + kArenaSize;
+
+    mappedBytes_ += kArenaSize;
+    return true;
+}
+
+std::size_t BufferPool::Trim() {
+    _DrainRemote();
+
+    // Take free blocks of empty arenas out of free lists
+    for (std::size_t index = 0; index < kClasses; ++ index) {
+        const std::size_t blockSize = _ClassSize(index);
+
+        FreeBlock** link = &free_[index];
+        while (FreeBlock* block = *link) {
+            if (ArenaOf(block)->usedBlocks == 0) {
+                *link = block->next;
+                cachedBytes_ -= blockSize;
+            } else {
+                link = &block->next;
+            }
+        }
+    }
+
+    std::size_t trimmed = 0;
+    ArenaHeader** link = &arenas_;
+    while (ArenaHeader* arena = *link) {
+        if (arena->usedBlocks != 0) {
+            link = &arena->next;
+            continue;
+        }
+
+        *link = arena->next;
+
+        // The unused space of current arena is not counted as cached
+        const std::size_t index = arena->classIndex;
+        if (arenaEnd_[index] == reinterpret_cast<char*>(arena) + kArenaSize) {
+            arenaCur_[index] = nullptr;
+            arenaEnd_[index] = nullptr;
+        }
+
+        ::munmap(arena, kArenaSize);
+        mappedBytes_ -= kArenaSize;
+        trimmed += kArenaSize;
+    }
+
+    return trimmed;
+}
+
+BufferPool::Stats BufferPool::GetStats() const {
+    Stats stats;
+    stats.mappedBytes = mappedBytes_;
+    stats.usedBytes = usedBytes_;
+    stats.cachedBytes = cachedBytes_;
+    stats.largeBytes = g_largeBytes;
+    stats.remoteFrees = remoteFrees_;
+    return stats;
+}
+
+BufferPool::Stats BufferPool::GlobalStats() {
+    Stats stats;
+
+    std::unique_lock<std::mutex> guard(PoolsMutex());
+    for (const auto pool : Pools()) {
+        auto s = pool->GetStats();
+        stats.mappedBytes += s.mappedBytes;
+        stats.usedBytes += s.usedBytes;
+        stats.cachedBytes += s.cachedBytes;
+        stats.remoteFrees += s.remoteFrees;
+    }
+
+    stats.largeBytes = g_largeBytes;
+    return stats;
+}
+
+} // end namespace ananas
+
@@ -0,0 +1,137 @@
+#ifndef BERT_BUFFERPOOL_H
+#define BERT_BUFFERPOOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+///@file BufferPool.h
+///@brief Size class memory pool for Buffer
+namespace ananas {
+
+namespace internal {
+struct ArenaHeader;
+}
+
+///@brief Per-thread slab pool with power-of-two size classes
+///
+/// Each thread (usually an EventLoop) has its own pool, blocks are carved
+/// from 2MB aligned arenas, one arena serves only one size class.
+/// Block freed in other thread is pushed to the owner's lock-free remote
+/// list, and reclaimed by the owner when its free list is empty.
+/// Requests bigger than kMaxBlock bypass the pool.
+///
+/// Pools live as long as the process, so buffers can migrate freely.
+/// When a thread exits, its pool is trimmed and orphaned, the next new
+/// thread adopts it, together with the blocks freed to it meanwhile.
+class BufferPool {
+public:
+    static const std::size_t kMinBlock = 64;
+    static const std::size_t kMaxBlock = 256 * 1024;
+    static const std::size_t kArenaSize = 2 * 1024 * 1024;
+
+    struct Stats {
+        std::size_t mappedBytes {0}; // arenas
+        std::size_t usedBytes {0};   // blocks held by buffers
+        std::size_t cachedBytes {0}; // free blocks in pools
+        std::size_t largeBytes {0};  // big buffers not from pool
+        std::size_t remoteFrees {0}; // blocks freed by other threads
+
+        std::string ToString() const;
+    };
+
+    ///@brief Allocate at least size bytes
+    static void* Allocate(std::size_t size);
+    ///@brief Free memory, size must be the same as Allocate
+    ///
+    /// Thread-safe, p may be allocated in other thread.
+    static void Deallocate(void* p, std::size_t size);
+
+    ///@brief Pool of this thread
+    static BufferPool& ThisThread();
+
+    ///@brief Unmap arenas whose blocks are all free
+    ///
+    /// Must be called in the owner thread.
+    ///@return Bytes unmapped
+    std::size_t Trim();
+
+    ///@brief Stats of this pool
+    Stats GetStats() const;
+    ///@brief Stats of all pools
+    static Stats GlobalStats();
+
+    ///@brief Try MAP_HUGETLB for arenas, fallback to transparent huge page
+    ///
+    /// Should be called before any allocation.
+    static void SetHugePage(bool enable);
+
+    BufferPool(const BufferPool& ) = delete;
+    void operator= (const BufferPool& ) = delete;
+
+private:
+    BufferPool();
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    static const std::size_t kClasses = 13; // 64B ~ 256KB
+
+    static std::size_t _ClassIndex(std::size_t size);
+    static std::size_t _ClassSize(std::size_t index);
+
+    void* _Allocate(std::size_t index);
+    void _LocalFree(void* p, std::size_t index);
+    void _RemoteFree(void* p);
+    void _DrainRemote();
+    bool _NewArena(std::size_t index);
+
+    FreeBlock* free_[kClasses] {};
+    char* arenaCur_[kClasses] {};
+    char* arenaEnd_[kClasses] {};
+    internal::ArenaHeader* arenas_ {nullptr};
+
+    std::atomic<FreeBlock*> remoteFree_ {nullptr};
+
+    std::atomic<std::size_t> mappedBytes_ {0};
+    std::atomic<std::size_t> usedBytes_ {0};
+    std::atomic<std::size_t> cachedBytes_ {0};
+    std::atomic<std::size_t> remoteFrees_ {0};
+};
+
+///@brief STL allocator on BufferPool, eg. for allocate_shared
+///
+/// Objects are recycled by the pool of allocating thread.
+template <typename T>
+class PoolAllocator {
+public:
+    using value_type = T;
+
+    PoolAllocator() = default;
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& ) {
+    }
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(BufferPool::Allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) {
+        BufferPool::Deallocate(p, n * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator== (const PoolAllocator<U>& ) const {
+        return true;
+    }
+    template <typename U>
+    bool operator!= (const PoolAllocator<U>& ) const {
+        return false;
+    }
+};
+
+} // end namespace ananas
+
+#endif
+
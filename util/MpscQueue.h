@@ -0,0 +1,83 @@
+#ifndef BERT_MPSCQUEUE_H
+#define BERT_MPSCQUEUE_H
+
+#include <atomic>
+#include <utility>
+
+///@file MpscQueue.h
+///@brief Lock-free multi producer single consumer queue
+namespace ananas {
+
+///@brief Unbounded MPSC queue, based on Dmitry Vyukov's algorithm
+///
+/// Push is wait-free and can be called in any thread, Pop must be called
+/// in one consumer thread. T must be default constructible.
+template <typename T>
+class MpscQueue {
+public:
+    MpscQueue() :
+        head_(new Node),
+        tail_(head_.load(std::memory_order_relaxed)) {
+    }
+
+    ~MpscQueue() {
+        T tmp;
+        while (Pop(tmp))
+            ;
+
+        delete tail_;
+    }
+
+    MpscQueue(const MpscQueue& ) = delete;
+    void operator= (const MpscQueue& ) = delete;
+
+    ///@brief Push value, thread-safe
+    template <typename U>
+    void Push(U&& value) {
+        Node* node = new Node(std::forward<U>(value));
+        Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    ///@brief Pop value, only in consumer thread
+    ///@return False if empty, or a producer is in the middle of Push
+    bool Pop(T& value) {
+        Node* tail = tail_;
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (!next)
+            return false;
+
+        value = std::move(next->value);
+        next->value = T();
+        tail_ = next;
+        delete tail;
+        return true;
+    }
+
+    ///@brief Only in consumer thread
+    ///
+    /// If not empty but Pop returns false, a producer is pushing.
+    bool Empty() const {
+        return head_.load(std::memory_order_acquire) == tail_;
+    }
+
+private:
+    struct Node {
+        Node() : next(nullptr) { }
+
+        template <typename U>
+        explicit
+        Node(U&& v) : next(nullptr), value(std::forward<U>(v)) { }
+
+        std::atomic<Node*> next;
+        T value;
+    };
+
+    std::atomic<Node*> head_; // producers
+    Node* tail_;              // consumer, always a stub
+};
+
+} // end namespace ananas
+
+#endif
+
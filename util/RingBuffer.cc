@@ -0,0 +1,158 @@
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <string>
+
+#include "RingBuffer.h"
+
+namespace ananas {
+
+const std::size_t RingBuffer::kDefaultSize = 256 * 1024;
+
+namespace {
+
+std::size_t RoundUpPage(std::size_t size) {
+    const std::size_t page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    if (size == 0)
+        size = page;
+
+    return (size + page - 1) / page * page;
+}
+
+// Anonymous file shared by the two mappings
+int CreateMemFile() {
+#if defined(__linux__) && defined(SYS_memfd_create)
+    return static_cast<int>(::syscall(SYS_memfd_create, "ananas_ring", 0x0001U)); // MFD_CLOEXEC
+#else
+    static std::atomic<int> seq {0};
+    std::string name = "/ananas_ring_" + std::to_string(::getpid()) + "_" + std::to_string(seq++);
+    int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd != -1)
+        ::shm_unlink(name.c_str());
+
+    return fd;
+#endif
+}
+
+} // end namespace
+
+RingBuffer::RingBuffer() {
+}
+
+RingBuffer::~RingBuffer() {
+    _Unmap(base_, capacity_);
+}
+
+bool RingBuffer::Init(std::size_t capacity) {
+    _Unmap(base_, capacity_);
+    Clear();
+
+    capacity_ = RoundUpPage(capacity);
+    base_ = _Map(capacity_);
+    if (!base_)
+        capacity_ = 0;
+
+    return base_ != nullptr;
+}
+
+char* RingBuffer::_Map(std::size_t capacity) {
+    int fd = CreateMemFile();
+    if (fd == -1)
+        return nullptr;
+
+    if (::ftruncate(fd, static_cast<off_t>(capacity)) != 0) {
+        ::close(fd);
+        return nullptr;
+    }
+
+    // reserve address space, then map the file twice into it
+    void* area = ::mmap(nullptr, 2 * capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (area == MAP_FAILED) {
+        ::close(fd);
+        return nullptr;
+    }
+
+    char* base = static_cast<char*>(area);
+    void* first = ::mmap(base, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+    void* second = ::mmap(base + capacity, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+
+    // mappings hold the file
+    ::close(fd);
+
+    if (first != base || second != base + capacity) {
+        ::munmap(base, 2 * capacity);
+        return nullptr;
+    }
+
+    return base;
+}
+
+void RingBuffer::_Unmap(char* base, std::size_t capacity) {
+    if (base)
+        ::munmap(base, 2 * capacity);
+}
+
+std::size_t RingBuffer::PushData(const void* data, std::size_t size) {
+    if (!data || size == 0)
+        return 0;
+
+    if (!AssureSpace(size))
+        return 0;
+
+    ::memcpy(WriteAddr(), data, size);
+    Produce(size);
+    return size;
+}
+
+void RingBuffer::Produce(std::size_t bytes) {
+    assert (bytes <= WritableSize());
+    size_ += bytes;
+}
+
+void RingBuffer::Consume(std::size_t bytes) {
+    assert (bytes <= size_);
+
+    size_ -= bytes;
+    if (size_ == 0)
+        readPos_ = 0; // reuse the hot pages at the front
+    else
+        readPos_ = (readPos_ + bytes) % capacity_;
+}
+
+void RingBuffer::Clear() {
+    readPos_ = size_ = 0;
+}
+
+bool RingBuffer::AssureSpace(std::size_t size) {
+    if (base_ && WritableSize() >= size)
+        return true;
+
+    std::size_t newCap = capacity_ ? capacity_ : kDefaultSize;
+    while (newCap - size_ < size)
+        newCap *= 2;
+
+    newCap = RoundUpPage(newCap);
+    char* base = _Map(newCap);
+    if (!base)
+        return false;
+
+    // data is continuous in the mirror, copy once
+    if (size_ > 0)
+        ::memcpy(base, ReadAddr(), size_);
+
+    _Unmap(base_, capacity_);
+    base_ = base;
+    capacity_ = newCap;
+    readPos_ = 0;
+    return true;
+}
+
+} // end namespace ananas
+
@@ -0,0 +1,77 @@
+#ifndef BERT_RINGBUFFER_H
+#define BERT_RINGBUFFER_H
+
+#include <cstddef>
+
+///@file RingBuffer.h
+namespace ananas {
+
+///@brief Ring buffer on mirrored virtual memory
+///
+/// The same physical pages are mapped twice, back to back, so readable
+/// bytes are always continuous even if they wrap around, and the writable
+/// space is continuous too. So it never memmove like Buffer, suitable for
+/// receiving large stream.
+///
+/// Capacity is rounded up to page size. Only for Linux memfd or posix shm.
+class RingBuffer {
+public:
+    static const std::size_t kDefaultSize;
+
+    RingBuffer();
+    ~RingBuffer();
+
+    RingBuffer(const RingBuffer& ) = delete;
+    void operator= (const RingBuffer& ) = delete;
+
+    ///@brief Map the memory
+    ///@return False if the system doesn't support mirrored mapping
+    bool Init(std::size_t capacity = kDefaultSize);
+    bool IsValid() const {
+        return base_ != nullptr;
+    }
+
+    std::size_t PushData(const void* data, std::size_t size);
+    void Produce(std::size_t bytes);
+    void Consume(std::size_t bytes);
+
+    char* ReadAddr() const {
+        return base_ + readPos_;
+    }
+    char* WriteAddr() const {
+        return base_ + (readPos_ + size_) % capacity_;
+    }
+
+    bool IsEmpty() const {
+        return size_ == 0;
+    }
+    std::size_t ReadableSize() const {
+        return size_;
+    }
+    std::size_t WritableSize() const {
+        return capacity_ - size_;
+    }
+    std::size_t Capacity() const {
+        return capacity_;
+    }
+
+    void Clear();
+
+    ///@brief Grow to a bigger mapping if writable space is less than size
+    ///@return False if failed to map
+    bool AssureSpace(std::size_t size);
+
+private:
+    static char* _Map(std::size_t capacity);
+    static void _Unmap(char* base, std::size_t capacity);
+
+    char* base_ {nullptr};
+    std::size_t capacity_ {0};
+    std::size_t readPos_ {0}; // [0, capacity_)
+    std::size_t size_ {0};
+};
+
+} // end namespace ananas
+
+#endif
+